@@ -0,0 +1,146 @@
+/* Binary operation log. */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "binlog.h"
+#include "entry.h"
+#include "log.h"
+
+/* Records are buffered this much before they are written out. */
+#define BUFFER_SIZE (64 * 1024)
+
+static int active = 0;
+static int enabled = 1;
+
+/* Protects everything below and the log ids of entries. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *file = NULL;
+static uint32_t next_id = 1;
+static unsigned long long records = 0;
+
+static uint64_t clock_ns(clockid_t clock) {
+    struct timespec ts;
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Called with lock held. */
+static void put(const binlog_record_t *r) {
+    if (fwrite(r, sizeof(*r), 1, file) == 1) {
+        records++;
+    }
+}
+
+/* Give e an id, introducing it with its path. Called with lock held. */
+static void name(entry_t *e, uint64_t time_ns) {
+    binlog_record_t r;
+    memset(&r, 0, sizeof(r));
+    r.time_ns = time_ns;
+    r.entry = e->log_id = next_id++;
+    r.op = BINLOG_NAME;
+    r.size = strlen(e->path);
+    put(&r);
+    size_t off;
+    for (off = 0; off < r.size; off += sizeof(r)) {
+        binlog_record_t chunk;
+        memset(&chunk, 0, sizeof(chunk));
+        memcpy(&chunk, e->path + off,
+            r.size - off < sizeof(chunk) ? r.size - off : sizeof(chunk));
+        put(&chunk);
+    }
+}
+
+int binlog_open(const char *path) {
+    assert(path != NULL);
+    FILE *f = fopen(path, "ab");
+    if (f == NULL) {
+        return -1;
+    }
+    (void)setvbuf(f, NULL, _IOFBF, BUFFER_SIZE);
+
+    pthread_mutex_lock(&lock);
+    if (file != NULL) {
+        fclose(file);
+    }
+    file = f;
+    binlog_record_t r;
+    memset(&r, 0, sizeof(r));
+    r.time_ns = clock_ns(CLOCK_REALTIME);
+    r.handle = BINLOG_MAGIC;
+    r.size = BINLOG_VERSION;
+    r.op = BINLOG_START;
+    put(&r);
+    pthread_mutex_unlock(&lock);
+    active = 1;
+    return 0;
+}
+
+void binlog_close(void) {
+    pthread_mutex_lock(&lock);
+    active = 0;
+    if (file != NULL && fclose(file) != 0) {
+        LOG("Failed to write binary log");
+    }
+    file = NULL;
+    pthread_mutex_unlock(&lock);
+}
+
+void binlog_set_enabled(int on) {
+    enabled = on;
+    if (!on) {
+        /* Let whatever was logged be read while we're paused. */
+        pthread_mutex_lock(&lock);
+        if (file != NULL) {
+            fflush(file);
+        }
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+void binlog_begin(binlog_sample_t *s) {
+    assert(s != NULL);
+    s->active = active && enabled;
+    if (s->active) {
+        s->time_ns = clock_ns(CLOCK_REALTIME);
+        s->start_ns = clock_ns(CLOCK_MONOTONIC);
+    }
+}
+
+void binlog_end(binlog_sample_t *s, binlog_op_t op, entry_t *e,
+        uint64_t handle, uint64_t size, int ret) {
+    assert(s != NULL);
+    assert(op < BINLOG_OPS);
+    if (!s->active) {
+        return;
+    }
+    binlog_record_t r;
+    memset(&r, 0, sizeof(r));
+    r.time_ns = s->time_ns;
+    r.latency_ns = clock_ns(CLOCK_MONOTONIC) - s->start_ns;
+    r.handle = handle;
+    r.size = size;
+    r.error = ret < 0 ? -ret : 0;
+    r.op = op;
+
+    pthread_mutex_lock(&lock);
+    if (file != NULL) {
+        if (e != NULL && e->log_id == 0) {
+            name(e, r.time_ns);
+        }
+        r.entry = e == NULL ? 0 : e->log_id;
+        put(&r);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+unsigned long long binlog_records(void) {
+    pthread_mutex_lock(&lock);
+    unsigned long long n = records;
+    pthread_mutex_unlock(&lock);
+    return n;
+}
@@ -0,0 +1,77 @@
+#ifndef _EXECFS_BINLOG_H_
+#define _EXECFS_BINLOG_H_
+
+/* Binary operation log. With --binlog, every FUSE operation is appended to the
+ * log file as one fixed-size record, in the host's byte order, without any
+ * formatting. tools/execfs-logdump turns the records back into text and
+ * summarises latencies per entry and operation.
+ *
+ * Each run of execfs starts with a BINLOG_START record. Entries are referred
+ * to by ids that are only valid until the next BINLOG_START: an entry's id is
+ * introduced by a BINLOG_NAME record, whose size is the length of the entry's
+ * path, followed by as many records as it takes to hold the path.
+ */
+
+#include <stdint.h>
+
+#include "entry.h"
+
+/* BINLOG_START's handle, identifying the file. */
+#define BINLOG_MAGIC 0x474c534643455845ULL /* "EXECFSLG" */
+/* BINLOG_START's size. */
+#define BINLOG_VERSION 1
+
+/* Operations, as stored. Only add to the end. */
+typedef enum {
+    BINLOG_START,
+    BINLOG_NAME,
+    BINLOG_GETATTR,
+    BINLOG_FGETATTR,
+    BINLOG_OPEN,
+    BINLOG_READ,
+    BINLOG_READ_BUF,
+    BINLOG_WRITE,
+    BINLOG_POLL,
+    BINLOG_FLUSH,
+    BINLOG_RELEASE,
+    BINLOG_READDIR,
+    BINLOG_GETXATTR,
+    BINLOG_LISTXATTR,
+    BINLOG_OPS,
+} binlog_op_t;
+
+typedef struct {
+    uint64_t time_ns;    /* When it started, in nanoseconds since the epoch. */
+    uint64_t latency_ns;
+    uint64_t handle;     /* The file handle, or 0. */
+    uint64_t size;       /* Bytes asked for by reads and writes. */
+    uint32_t entry;      /* Entry id, or 0 for the root directory. */
+    int32_t error;       /* errno it failed with, or 0. */
+    uint16_t op;
+    uint8_t pad[6];
+} binlog_record_t;
+
+/* An operation in progress. */
+typedef struct {
+    int active;
+    uint64_t time_ns;
+    uint64_t start_ns; /* Monotonic. */
+} binlog_sample_t;
+
+/* Start appending records to path. Returns 0 on success. */
+int binlog_open(const char *path);
+void binlog_close(void);
+/* Pause or resume writing records, along with the text log. */
+void binlog_set_enabled(int enabled);
+
+void binlog_begin(binlog_sample_t *s);
+/* Record an operation on e, which may be NULL for the root directory, that
+ * returned ret.
+ */
+void binlog_end(binlog_sample_t *s, binlog_op_t op, entry_t *e,
+        uint64_t handle, uint64_t size, int ret);
+
+/* Records written. */
+unsigned long long binlog_records(void);
+
+#endif
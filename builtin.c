@@ -0,0 +1,516 @@
+/* Built-in commands evaluated without forking. */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "builtin.h"
+#include "errbuf.h"
+#include "log.h"
+#include "stats.h"
+
+/* Default format of date(1). */
+#define DATE_FORMAT "%a %b %e %H:%M:%S %Z %Y"
+#define DATE_SIZE 256
+
+typedef enum {
+    BUILTIN_CAT,
+    BUILTIN_ECHO,
+    BUILTIN_PRINTENV,
+    BUILTIN_DATE,
+    BUILTIN_STATS,
+    BUILTIN_STDERR,
+} builtin_type_t;
+
+struct builtin {
+    builtin_type_t type;
+    /* Words following the command name. For cat, quoted[i] is set when
+     * argument i was quoted and so should not be globbed.
+     */
+    char **args;
+    int *quoted;
+    size_t args_sz;
+    /* Precomputed output of echo. */
+    char *text;
+    size_t text_sz;
+};
+
+/* A contiguous piece of output, either held in memory or read from a file. */
+typedef struct {
+    int fd; /* -1 for memory. */
+    char *data;
+    size_t size;
+} segment_t;
+
+struct builtin_output {
+    segment_t *segments;
+    size_t segments_sz;
+    size_t size;
+};
+
+/* Split s into shell-like words. Returns the number of words, or -1 on
+ * failure.
+ */
+static int split_words(const char *s, char ***words, int **quoted) {
+    size_t len = strlen(s);
+    int n = 0;
+    *words = NULL;
+    *quoted = NULL;
+
+    while (1) {
+        while (*s == ' ' || *s == '\t') {
+            s++;
+        }
+        if (*s == '\0') {
+            break;
+        }
+
+        /* A word can't be longer than the remaining input. */
+        char *word = malloc(len + 1), *out = word;
+        if (word == NULL) {
+            goto split_words_fail;
+        }
+        int q = 0;
+        char quote = '\0';
+        while (*s != '\0' && (quote != '\0' || (*s != ' ' && *s != '\t'))) {
+            if (quote == '\0' && (*s == '\'' || *s == '"')) {
+                quote = *s++;
+                q = 1;
+            } else if (quote != '\0' && *s == quote) {
+                quote = '\0';
+                s++;
+            } else if (*s == '\\' && quote != '\'' && s[1] != '\0') {
+                *out++ = s[1];
+                s += 2;
+                q = 1;
+            } else {
+                *out++ = *s++;
+            }
+        }
+        *out = '\0';
+        if (quote != '\0') {
+            /* Unterminated quote. */
+            free(word);
+            errno = EINVAL;
+            goto split_words_fail;
+        }
+
+        char **w = realloc(*words, sizeof(char*) * (n + 1));
+        if (w != NULL) {
+            *words = w;
+        }
+        int *qs = realloc(*quoted, sizeof(int) * (n + 1));
+        if (qs != NULL) {
+            *quoted = qs;
+        }
+        if (w == NULL || qs == NULL) {
+            free(word);
+            goto split_words_fail;
+        }
+        (*words)[n] = word;
+        (*quoted)[n] = q;
+        n++;
+    }
+    return n;
+
+split_words_fail:
+    while (n > 0) {
+        free((*words)[--n]);
+    }
+    free(*words);
+    free(*quoted);
+    *words = NULL;
+    *quoted = NULL;
+    return -1;
+}
+
+builtin_t *builtin_parse(const char *command) {
+    assert(command != NULL);
+    char **words;
+    int *quoted;
+    int n = split_words(command, &words, &quoted);
+    if (n == -1) {
+        return NULL;
+    } else if (n == 0) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    builtin_t *b = calloc(1, sizeof(*b));
+    if (b == NULL) {
+        goto builtin_parse_fail;
+    }
+    b->args = words + 1;
+    b->quoted = quoted + 1;
+    b->args_sz = n - 1;
+
+    if (!strcmp(words[0], "cat") && b->args_sz > 0) {
+        b->type = BUILTIN_CAT;
+    } else if (!strcmp(words[0], "echo")) {
+        b->type = BUILTIN_ECHO;
+        size_t i = 0;
+        int newline = 1;
+        if (b->args_sz > 0 && !strcmp(b->args[0], "-n")) {
+            newline = 0;
+            i = 1;
+        }
+        /* Join the arguments with spaces, as echo(1) would. */
+        size_t len = 0, j;
+        for (j = i; j < b->args_sz; ++j) {
+            len += strlen(b->args[j]) + 1;
+        }
+        b->text = malloc(len + 1);
+        if (b->text == NULL) {
+            goto builtin_parse_fail;
+        }
+        char *out = b->text;
+        for (j = i; j < b->args_sz; ++j) {
+            if (j > i) {
+                *out++ = ' ';
+            }
+            strcpy(out, b->args[j]);
+            out += strlen(b->args[j]);
+        }
+        if (newline) {
+            *out++ = '\n';
+        }
+        *out = '\0';
+        b->text_sz = out - b->text;
+    } else if (!strcmp(words[0], "printenv") && b->args_sz == 1) {
+        b->type = BUILTIN_PRINTENV;
+    } else if (!strcmp(words[0], "date") && (b->args_sz == 0 ||
+            (b->args_sz == 1 && b->args[0][0] == '+'))) {
+        b->type = BUILTIN_DATE;
+    } else if (!strcmp(words[0], "stats") && b->args_sz == 0) {
+        b->type = BUILTIN_STATS;
+    } else if (!strcmp(words[0], "stderr") && b->args_sz == 1) {
+        b->type = BUILTIN_STDERR;
+    } else {
+        errno = EINVAL;
+        goto builtin_parse_fail;
+    }
+
+    free(words[0]);
+    return b;
+
+builtin_parse_fail:
+    if (b != NULL) {
+        free(b->text);
+        free(b);
+    }
+    while (n > 0) {
+        free(words[--n]);
+    }
+    free(words);
+    free(quoted);
+    return NULL;
+}
+
+void builtin_free(builtin_t *b) {
+    if (b == NULL) {
+        return;
+    }
+    size_t i;
+    for (i = 0; i < b->args_sz; ++i) {
+        free(b->args[i]);
+    }
+    /* The command name was freed when parsing. */
+    free(b->args - 1);
+    free(b->quoted - 1);
+    free(b->text);
+    free(b);
+}
+
+/* Append a segment to the output. Takes ownership of data or fd. */
+static int add_segment(builtin_output_t *o, int fd, char *data, size_t size) {
+    segment_t *s = realloc(o->segments,
+        sizeof(segment_t) * (o->segments_sz + 1));
+    if (s == NULL) {
+        return -1;
+    }
+    o->segments = s;
+    s[o->segments_sz].fd = fd;
+    s[o->segments_sz].data = data;
+    s[o->segments_sz].size = size;
+    o->segments_sz++;
+    o->size += size;
+    return 0;
+}
+
+/* Add a single file to the output. Unreadable files are skipped, as cat
+ * would after complaining.
+ */
+static int add_file(builtin_output_t *o, const char *path) {
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        LOG("Built-in cat: skipping %s", path);
+        if (fd != -1) {
+            close(fd);
+        }
+        return 0;
+    }
+    if (add_segment(o, fd, NULL, st.st_size) != 0) {
+        close(fd);
+        return -1;
+    }
+    return 0;
+}
+
+/* Add every file matching pattern to the output. Quoted words are taken
+ * literally, as they would be by the shell.
+ */
+static int add_files(builtin_output_t *o, const char *pattern, int quoted) {
+    if (quoted) {
+        return add_file(o, pattern);
+    }
+
+    glob_t g;
+    int ret = glob(pattern, GLOB_TILDE, NULL, &g);
+    if (ret == GLOB_NOMATCH) {
+        /* Like cat in a shell, skip patterns that match nothing. */
+        LOG("Built-in cat: no match for %s", pattern);
+        return 0;
+    } else if (ret != 0) {
+        return -1;
+    }
+
+    size_t i;
+    int result = 0;
+    for (i = 0; i < g.gl_pathc && result == 0; ++i) {
+        result = add_file(o, g.gl_pathv[i]);
+    }
+    globfree(&g);
+    return result;
+}
+
+builtin_output_t *builtin_open(builtin_t *b) {
+    assert(b != NULL);
+    builtin_output_t *o = calloc(1, sizeof(*o));
+    if (o == NULL) {
+        return NULL;
+    }
+
+    switch (b->type) {
+        case BUILTIN_CAT: {
+            size_t i;
+            for (i = 0; i < b->args_sz; ++i) {
+                if (add_files(o, b->args[i], b->quoted[i]) != 0) {
+                    goto builtin_open_fail;
+                }
+            }
+            break;
+        } case BUILTIN_ECHO: {
+            char *data = malloc(b->text_sz);
+            if (data == NULL) {
+                goto builtin_open_fail;
+            }
+            memcpy(data, b->text, b->text_sz);
+            if (add_segment(o, -1, data, b->text_sz) != 0) {
+                free(data);
+                goto builtin_open_fail;
+            }
+            break;
+        } case BUILTIN_PRINTENV: {
+            char *value = getenv(b->args[0]);
+            if (value == NULL) {
+                /* printenv prints nothing for an unset variable. */
+                break;
+            }
+            size_t len = strlen(value);
+            char *data = malloc(len + 1);
+            if (data == NULL) {
+                goto builtin_open_fail;
+            }
+            memcpy(data, value, len);
+            data[len] = '\n';
+            if (add_segment(o, -1, data, len + 1) != 0) {
+                free(data);
+                goto builtin_open_fail;
+            }
+            break;
+        } case BUILTIN_DATE: {
+            const char *format = b->args_sz == 0 ? DATE_FORMAT : b->args[0] + 1;
+            char *data = malloc(DATE_SIZE);
+            if (data == NULL) {
+                goto builtin_open_fail;
+            }
+            time_t now = time(NULL);
+            struct tm tm;
+            size_t len = strftime(data, DATE_SIZE - 1, format,
+                localtime_r(&now, &tm));
+            data[len++] = '\n';
+            if (add_segment(o, -1, data, len) != 0) {
+                free(data);
+                goto builtin_open_fail;
+            }
+            break;
+        } case BUILTIN_STATS: {
+            size_t len;
+            char *data = stats_format(&len);
+            if (data == NULL) {
+                goto builtin_open_fail;
+            }
+            if (add_segment(o, -1, data, len) != 0) {
+                free(data);
+                goto builtin_open_fail;
+            }
+            break;
+        } case BUILTIN_STDERR: {
+            size_t len;
+            char *data = errbuf_read(b->args[0], &len);
+            if (data == NULL) {
+                goto builtin_open_fail;
+            }
+            if (add_segment(o, -1, data, len) != 0) {
+                free(data);
+                goto builtin_open_fail;
+            }
+            break;
+        } default: {
+            assert(!"Unreachable");
+        }
+    }
+    return o;
+
+builtin_open_fail:
+    builtin_close(o);
+    errno = ENOMEM;
+    return NULL;
+}
+
+void builtin_close(builtin_output_t *o) {
+    if (o == NULL) {
+        return;
+    }
+    size_t i;
+    for (i = 0; i < o->segments_sz; ++i) {
+        if (o->segments[i].fd != -1) {
+            close(o->segments[i].fd);
+        }
+        free(o->segments[i].data);
+    }
+    free(o->segments);
+    free(o);
+}
+
+size_t builtin_size(builtin_output_t *o) {
+    assert(o != NULL);
+    return o->size;
+}
+
+/* Find the segment containing offset. Returns o->segments_sz at or past the
+ * end of the output, with *skip set to the offset into the returned segment.
+ */
+static size_t find_segment(builtin_output_t *o, off_t offset, size_t *skip) {
+    size_t i;
+    for (i = 0; i < o->segments_sz; ++i) {
+        if ((size_t)offset < o->segments[i].size) {
+            break;
+        }
+        offset -= o->segments[i].size;
+    }
+    *skip = offset;
+    return i;
+}
+
+ssize_t builtin_read(builtin_output_t *o, char *buf, size_t size, off_t offset) {
+    assert(o != NULL);
+    size_t skip, done = 0;
+    size_t i = find_segment(o, offset, &skip);
+
+    for (; i < o->segments_sz && done < size; ++i, skip = 0) {
+        segment_t *s = &o->segments[i];
+        size_t len = s->size - skip;
+        if (len > size - done) {
+            len = size - done;
+        }
+        if (s->fd == -1) {
+            memcpy(buf + done, s->data + skip, len);
+        } else {
+            ssize_t sz = pread(s->fd, buf + done, len, skip);
+            if (sz == -1) {
+                return done > 0 ? (ssize_t)done : -1;
+            } else if ((size_t)sz < len) {
+                /* The file shrank after we opened it. Stop here rather than
+                 * returning a hole.
+                 */
+                done += sz;
+                break;
+            }
+        }
+        done += len;
+    }
+    return done;
+}
+
+int builtin_read_buf(builtin_output_t *o, struct fuse_bufvec **bufp,
+        size_t size, off_t offset) {
+    assert(o != NULL);
+    assert(bufp != NULL);
+    size_t skip;
+    size_t first = find_segment(o, offset, &skip);
+    size_t i, count = 0, remaining = size;
+
+    /* Count the segments we'll need first so the vector is allocated once. */
+    size_t s = skip;
+    for (i = first; i < o->segments_sz && remaining > 0; ++i, s = 0) {
+        size_t len = o->segments[i].size - s;
+        remaining -= len < remaining ? len : remaining;
+        count++;
+    }
+
+    struct fuse_bufvec *v = malloc(sizeof(struct fuse_bufvec) +
+        sizeof(struct fuse_buf) * (count > 0 ? count - 1 : 0));
+    if (v == NULL) {
+        return -ENOMEM;
+    }
+    *v = FUSE_BUFVEC_INIT(0);
+    v->count = count > 0 ? count : 1;
+
+    remaining = size;
+    for (i = 0; i < count; ++i, skip = 0) {
+        segment_t *seg = &o->segments[first + i];
+        struct fuse_buf *b = &v->buf[i];
+        size_t len = seg->size - skip;
+        if (len > remaining) {
+            len = remaining;
+        }
+        b->size = len;
+        if (seg->fd == -1) {
+            /* FUSE frees memory buffers once it has replied, so hand it a
+             * copy.
+             */
+            b->flags = 0;
+            b->fd = -1;
+            b->pos = 0;
+            b->mem = malloc(len);
+            if (b->mem == NULL) {
+                size_t j;
+                for (j = 0; j < i; ++j) {
+                    free(v->buf[j].mem);
+                }
+                free(v);
+                return -ENOMEM;
+            }
+            memcpy(b->mem, seg->data + skip, len);
+        } else {
+            b->flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+            b->fd = seg->fd;
+            b->pos = skip;
+            b->mem = NULL;
+        }
+        remaining -= len;
+    }
+
+    *bufp = v;
+    return 0;
+}
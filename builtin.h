@@ -0,0 +1,55 @@
+#ifndef _EXECFS_BUILTIN_H_
+#define _EXECFS_BUILTIN_H_
+
+/* Built-in commands that are evaluated inside execfs itself rather than by
+ * forking a shell. Only a handful of trivial commands are understood:
+ *  cat PATTERN...      Concatenation of files, with glob patterns expanded
+ *                      each time the entry is opened.
+ *  echo [-n] TEXT...   A fixed string.
+ *  printenv NAME       The value of an environment variable of execfs.
+ *  date [+FORMAT]      The current time, formatted with strftime().
+ *  stats               Statistics of execfs itself (see stats.h).
+ *  stderr PATH         Recent stderr of the commands of entries at PATH (see
+ *                      errbuf.h).
+ * Arguments are split into words on whitespace. Single and double quotes and
+ * backslashes work as they do in the shell, but nothing else does.
+ */
+
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct builtin builtin_t;
+
+/* Output of a built-in for one open of its entry. */
+typedef struct builtin_output builtin_output_t;
+
+/* Parse a command into a built-in. Returns NULL and sets errno if the command
+ * is not one of the supported built-ins or is malformed.
+ */
+builtin_t *builtin_parse(const char *command);
+void builtin_free(builtin_t *b);
+
+/* Evaluate a built-in. Returns NULL on failure with errno set. */
+builtin_output_t *builtin_open(builtin_t *b);
+void builtin_close(builtin_output_t *o);
+
+/* Total size in bytes of the output. */
+size_t builtin_size(builtin_output_t *o);
+
+/* Copy up to size bytes of the output starting at offset into buf. Returns
+ * the number of bytes copied or -1 on error.
+ */
+ssize_t builtin_read(builtin_output_t *o, char *buf, size_t size, off_t offset);
+
+/* Like builtin_read(), but describes the output as FUSE buffers. File contents
+ * are passed by file descriptor so FUSE can splice them straight into the
+ * kernel without copying them through our memory. Returns 0 on success or a
+ * negative errno.
+ */
+int builtin_read_buf(builtin_output_t *o, struct fuse_bufvec **bufp,
+        size_t size, off_t offset);
+
+#endif
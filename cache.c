@@ -0,0 +1,816 @@
+/* Caching of command output. */
+
+#define _GNU_SOURCE /* asprintf(), memfd_create(), F_ADD_SEALS */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "compress.h"
+#include "config.h"
+#include "entry.h"
+#include "hash.h"
+#include "log.h"
+
+#define BUCKETS 4096
+#define KEY_SIZE 64
+/* Initial size of the buffer an opener's environment is read into. */
+#define ENVIRON_SIZE 4096
+/* Most outputs to keep in memfds, leaving descriptors for everything else. */
+#define MAX_MEMFDS 256
+
+typedef enum {
+    OBJ_FILLING, /* Placeholder while the first opener runs the command. */
+    OBJ_READY,
+    OBJ_DEAD,    /* Aborted, expired or evicted. Freed with its last ref. */
+} obj_state_t;
+
+/* Ready outputs are kept in a segmented LRU. New outputs start on probation
+ * and are promoted to the protected segment when they are used again, so a
+ * scan of many outputs that are each read once can't flush the ones that are
+ * actually popular.
+ */
+typedef enum {
+    SEG_PROBATION,
+    SEG_PROTECTED,
+    SEGMENTS,
+} segment_t;
+
+/* Share of the budget the protected segment may occupy. */
+#define PROTECTED_PERCENT 80
+
+typedef struct {
+    cache_obj_t *head, *tail; /* Most recently used first. */
+    size_t bytes;
+} lru_t;
+
+struct cache_obj {
+    entry_t *entry; /* Held. */
+    char *key;
+    uint64_t hash;
+    obj_state_t state;
+    segment_t segment;
+    /* The output is held in exactly one of these: a sealed memfd, which lets
+     * FUSE splice it to readers without copying, a compressed buffer for
+     * entries with a codec, or plain memory if neither is available.
+     */
+    int fd;
+    char *data;
+    compressed_t *packed;
+    size_t size;
+    uint64_t digest; /* Of the uncompressed output. */
+    time_t created;
+    time_t changed;  /* When the output last differed from its predecessor. */
+    /* What the output replaced, if anything, while filling. */
+    int has_prev;
+    uint64_t prev_digest;
+    size_t prev_size;
+    time_t prev_changed;
+    int refs;
+    /* Hash chain. */
+    cache_obj_t *next;
+    /* Position in its segment's LRU list. */
+    cache_obj_t *lru_prev, *lru_next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when a placeholder is filled or aborted. */
+static pthread_cond_t filled = PTHREAD_COND_INITIALIZER;
+
+static cache_obj_t *buckets[BUCKETS];
+static lru_t lru[SEGMENTS];
+static size_t budget = CACHE_DEFAULT_BUDGET;
+static size_t max_object = CACHE_DEFAULT_MAX_OBJECT;
+static size_t used = 0;
+static cache_stats_t stats;
+/* Outputs currently held in memfds. Updated atomically. */
+static int memfds = 0;
+
+/* Memory attributed to an object. */
+static size_t footprint(cache_obj_t *o) {
+    size_t data = o->packed != NULL ? compressed_footprint(o->packed) : o->size;
+    return data + strlen(o->key) + sizeof(*o);
+}
+
+static uint64_t fnv(uint64_t h, const char *s) {
+    for (; *s != '\0'; ++s) {
+        h = (h ^ (unsigned char)*s) * 1099511628211ULL;
+    }
+    return h * 1099511628211ULL; /* Separator. */
+}
+
+/* FNV-1a over what identifies the entry's output and the key. */
+static uint64_t hash_key(entry_t *e, const char *key) {
+    uint64_t h = 14695981039346656037ULL;
+    h = fnv(h, e->path);
+    h = fnv(h, e->command);
+    return fnv(h, key);
+}
+
+/* Whether a and b produce the same output. Entries of different mounts
+ * running the same command at the same path share their cached output, as
+ * long as they would also keep it the same way: objects are expired, stored
+ * and evicted according to the entry that filled them.
+ */
+static int same_output(entry_t *a, entry_t *b) {
+    if (a == b) {
+        return 1;
+    }
+    return a->kind == b->kind && a->cache_policy == b->cache_policy &&
+        !strcmp(a->path, b->path) && !strcmp(a->command, b->command) &&
+        (a->cache_env == NULL) == (b->cache_env == NULL) &&
+        (a->cache_env == NULL || !strcmp(a->cache_env, b->cache_env)) &&
+        a->cache_ttl == b->cache_ttl && a->cache_codec == b->cache_codec &&
+        a->cache_pin == b->cache_pin;
+}
+
+/* A placeholder for the output of e for key. */
+static cache_obj_t *new_obj(entry_t *e, const char *key, uint64_t hash) {
+    cache_obj_t *o = calloc(1, sizeof(*o));
+    if (o != NULL) {
+        o->key = strdup(key);
+    }
+    if (o == NULL || o->key == NULL) {
+        free(o);
+        return NULL;
+    }
+    o->entry = e;
+    entry_hold(e);
+    o->hash = hash;
+    o->state = OBJ_FILLING;
+    o->refs = 1;
+    o->fd = -1;
+    return o;
+}
+
+static void free_obj(cache_obj_t *o) {
+    if (o->fd != -1) {
+        close(o->fd);
+        __sync_fetch_and_sub(&memfds, 1);
+    }
+    free(o->data);
+    compressed_free(o->packed);
+    free(o->key);
+    entry_release(o->entry);
+    free(o);
+}
+
+static void lru_unlink(cache_obj_t *o) {
+    lru_t *l = &lru[o->segment];
+    if (o->lru_prev != NULL) {
+        o->lru_prev->lru_next = o->lru_next;
+    } else if (l->head == o) {
+        l->head = o->lru_next;
+    }
+    if (o->lru_next != NULL) {
+        o->lru_next->lru_prev = o->lru_prev;
+    } else if (l->tail == o) {
+        l->tail = o->lru_prev;
+    }
+    o->lru_prev = o->lru_next = NULL;
+    l->bytes -= footprint(o);
+}
+
+static void lru_push(cache_obj_t *o, segment_t segment) {
+    lru_t *l = &lru[segment];
+    o->segment = segment;
+    o->lru_prev = NULL;
+    o->lru_next = l->head;
+    if (l->head != NULL) {
+        l->head->lru_prev = o;
+    }
+    l->head = o;
+    if (l->tail == NULL) {
+        l->tail = o;
+    }
+    l->bytes += footprint(o);
+}
+
+/* Record a use of a ready object. Called with lock held. */
+static void touch(cache_obj_t *o) {
+    lru_unlink(o);
+    lru_push(o, SEG_PROTECTED);
+
+    /* Keep the protected segment within its share by demoting its least
+     * recently used outputs back to probation.
+     */
+    size_t limit = budget / 100 * PROTECTED_PERCENT;
+    while (lru[SEG_PROTECTED].bytes > limit &&
+            lru[SEG_PROTECTED].tail != o) {
+        cache_obj_t *victim = lru[SEG_PROTECTED].tail;
+        lru_unlink(victim);
+        lru_push(victim, SEG_PROBATION);
+    }
+}
+
+/* Remove an object from the table. It is freed now if nobody is using it, or
+ * when the last user releases it otherwise. A placeholder killed while it is
+ * filled still serves whoever is filling it. Called with lock held.
+ */
+static void kill_obj(cache_obj_t *o) {
+    cache_obj_t **p = &buckets[o->hash % BUCKETS];
+    while (*p != NULL && *p != o) {
+        p = &(*p)->next;
+    }
+    if (*p == o) {
+        *p = o->next;
+    }
+    o->next = NULL;
+    if (o->state == OBJ_READY) {
+        lru_unlink(o);
+        used -= footprint(o);
+        stats.objects--;
+        stats.raw_bytes -= o->size;
+    }
+    o->state = OBJ_DEAD;
+    if (o->refs == 0) {
+        free_obj(o);
+    }
+}
+
+/* Evict outputs until we're within budget, least recently used first and
+ * starting with those on probation. Pinned outputs are never evicted. Called
+ * with lock held.
+ */
+static void evict(void) {
+    segment_t seg;
+    for (seg = SEG_PROBATION; seg < SEGMENTS && used > budget; ++seg) {
+        cache_obj_t *o = lru[seg].tail;
+        while (o != NULL && used > budget) {
+            cache_obj_t *prev = o->lru_prev;
+            if (!o->entry->cache_pin) {
+                LOG("Evicting %zu bytes of output of %s (%s)", o->size,
+                    o->entry->path, o->key);
+                kill_obj(o);
+                stats.evictions++;
+            }
+            o = prev;
+        }
+    }
+}
+
+void cache_set_budget(size_t bytes) {
+    pthread_mutex_lock(&lock);
+    budget = bytes;
+    evict();
+    pthread_mutex_unlock(&lock);
+}
+
+void cache_set_max_object(size_t bytes) {
+    pthread_mutex_lock(&lock);
+    max_object = bytes;
+    pthread_mutex_unlock(&lock);
+}
+
+size_t cache_max_object(void) {
+    pthread_mutex_lock(&lock);
+    size_t m = max_object;
+    pthread_mutex_unlock(&lock);
+    return m;
+}
+
+void cache_get_stats(cache_stats_t *out) {
+    assert(out != NULL);
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    out->budget = budget;
+    out->used = used;
+    out->protected_bytes = lru[SEG_PROTECTED].bytes;
+    pthread_mutex_unlock(&lock);
+}
+
+/* Read the environment process pid started with, as NUL-terminated strings.
+ * Returns a malloced buffer and sets *size, or NULL and sets errno if it
+ * can't be read.
+ */
+static char *read_environ(pid_t pid, size_t *size) {
+    char path[KEY_SIZE];
+    snprintf(path, sizeof(path), "/proc/%d/environ", (int)pid);
+    int fd = open(path, O_RDONLY|O_CLOEXEC);
+    if (fd == -1) {
+        return NULL;
+    }
+    size_t len = ENVIRON_SIZE, got = 0;
+    char *env = NULL;
+    while (1) {
+        char *tmp = realloc(env, len + 1);
+        if (tmp == NULL) {
+            close(fd);
+            free(env);
+            errno = ENOMEM;
+            return NULL;
+        }
+        env = tmp;
+        ssize_t sz = read(fd, env + got, len - got);
+        if (sz == -1 && errno == EINTR) {
+            continue;
+        } else if (sz == -1) {
+            int err = errno;
+            close(fd);
+            free(env);
+            errno = err;
+            return NULL;
+        } else if (sz == 0) {
+            break;
+        }
+        got += sz;
+        if (got == len) {
+            len *= 2;
+        }
+    }
+    close(fd);
+    /* Terminate the last string even if it was cut short. */
+    env[got] = '\0';
+    *size = got;
+    return env;
+}
+
+/* The key of an opener partitioned by its environment variable name. The
+ * whole value is used, however long, so that values differing only towards
+ * their end are kept apart.
+ */
+static char *env_key(const char *name, pid_t pid) {
+    size_t env_sz;
+    char *env = read_environ(pid, &env_sz);
+    if (env == NULL || env_sz == 0) {
+        /* The opener has exited, isn't ours to look at or is a kernel
+         * thread, and none of those can be told apart.
+         */
+        int err = env == NULL && errno == ENOMEM ? ENOMEM : EIO;
+        free(env);
+        errno = err;
+        return NULL;
+    }
+
+    size_t name_len = strlen(name);
+    const char *value = NULL;
+    char *p;
+    for (p = env; p < env + env_sz; p += strlen(p) + 1) {
+        if (!strncmp(p, name, name_len) && p[name_len] == '=') {
+            value = p + name_len + 1;
+            break;
+        }
+    }
+    char *key;
+    int len = value != NULL ? asprintf(&key, "%s=%s", name, value) :
+        asprintf(&key, "!%s", name);
+    free(env);
+    if (len == -1) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return key;
+}
+
+char *cache_key(entry_t *e, uid_t uid, gid_t gid, pid_t pid) {
+    assert(e != NULL);
+    char key[KEY_SIZE];
+    switch (e->cache_policy) {
+        case CACHE_GLOBAL: {
+            key[0] = '\0';
+            break;
+        } case CACHE_UID: {
+            snprintf(key, sizeof(key), "uid=%u", (unsigned int)uid);
+            break;
+        } case CACHE_GID: {
+            snprintf(key, sizeof(key), "gid=%u", (unsigned int)gid);
+            break;
+        } case CACHE_PIDTREE: {
+            /* Processes descending from the same session leader (a login, a
+             * service) share output, unless they changed credentials (su,
+             * sudo, a setuid binary) since.
+             */
+            pid_t sid = getsid(pid);
+            if (sid == -1) {
+                /* The opener has already gone, so its session is unknown. */
+                errno = EIO;
+                return NULL;
+            }
+            snprintf(key, sizeof(key), "sid=%d,uid=%u,gid=%u", (int)sid,
+                     (unsigned int)uid, (unsigned int)gid);
+            break;
+        } case CACHE_ENV: {
+            return env_key(e->cache_env, pid);
+        } default: {
+            assert(!"Unreachable");
+            return NULL;
+        }
+    }
+    return strdup(key);
+}
+
+/* Find an object. Called with lock held. */
+static cache_obj_t *lookup(entry_t *e, const char *key, uint64_t hash) {
+    cache_obj_t *o;
+    for (o = buckets[hash % BUCKETS]; o != NULL; o = o->next) {
+        if (o->hash == hash && same_output(o->entry, e) &&
+                !strcmp(o->key, key)) {
+            return o;
+        }
+    }
+    return NULL;
+}
+
+/* Whether a ready object has outlived its entry's time to live. */
+static int expired(cache_obj_t *o) {
+    return o->entry->cache_ttl > 0 &&
+        time(NULL) - o->created >= o->entry->cache_ttl;
+}
+
+/* Look up or create the output of e for key, or only look it up if fill is
+ * NULL. If it is being filled, wait for it if told to, or fail with EBUSY.
+ */
+static cache_obj_t *acquire(entry_t *e, const char *key, int *fill,
+        int wait) {
+    assert(e != NULL);
+    assert(key != NULL);
+    uint64_t hash = hash_key(e, key);
+    int has_prev = 0;
+    uint64_t prev_digest = 0;
+    size_t prev_size = 0;
+    time_t prev_changed = 0;
+
+    pthread_mutex_lock(&lock);
+    while (1) {
+        cache_obj_t *o = lookup(e, key, hash);
+        if (o != NULL && o->state == OBJ_READY && expired(o) && fill == NULL) {
+            /* Leave the stale output for the next open to replace, which
+             * needs it to tell whether the output has changed.
+             */
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        } else if (o != NULL && o->state == OBJ_READY && expired(o)) {
+            /* Remember the stale output so that if the command produces the
+             * same again, the file doesn't appear to have changed.
+             */
+            has_prev = 1;
+            prev_digest = o->digest;
+            prev_size = o->size;
+            prev_changed = o->changed;
+            kill_obj(o);
+            o = NULL;
+        }
+        if (o != NULL && o->state == OBJ_READY) {
+            o->refs++;
+            if (fill != NULL) {
+                /* Only count real opens, not size queries. */
+                touch(o);
+                stats.hits++;
+            }
+            pthread_mutex_unlock(&lock);
+            return o;
+        } else if (o != NULL) {
+            assert(o->state == OBJ_FILLING);
+            if (fill == NULL || !wait) {
+                pthread_mutex_unlock(&lock);
+                errno = EBUSY;
+                return NULL;
+            }
+            /* Wait for whoever is running the command, then look again in
+             * case they gave up.
+             */
+            o->refs++;
+            while (o->state == OBJ_FILLING) {
+                pthread_cond_wait(&filled, &lock);
+            }
+            if (--o->refs == 0 && o->state == OBJ_DEAD) {
+                free_obj(o);
+            }
+            continue;
+        }
+
+        if (fill == NULL) {
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+        o = new_obj(e, key, hash);
+        if (o == NULL) {
+            pthread_mutex_unlock(&lock);
+            return NULL;
+        }
+        o->has_prev = has_prev;
+        o->prev_digest = prev_digest;
+        o->prev_size = prev_size;
+        o->prev_changed = prev_changed;
+        stats.misses++;
+        if (e->cache_retired) {
+            /* Nobody will look for this output again, so it only serves
+             * this opener.
+             */
+            o->state = OBJ_DEAD;
+            pthread_mutex_unlock(&lock);
+            *fill = 1;
+            return o;
+        }
+        o->next = buckets[hash % BUCKETS];
+        buckets[hash % BUCKETS] = o;
+        pthread_mutex_unlock(&lock);
+        *fill = 1;
+        return o;
+    }
+}
+
+cache_obj_t *cache_acquire(entry_t *e, const char *key, int *fill) {
+    assert(fill != NULL);
+    *fill = 0;
+    return acquire(e, key, fill, 1);
+}
+
+cache_obj_t *cache_try_acquire(entry_t *e, const char *key, int *fill) {
+    assert(fill != NULL);
+    *fill = 0;
+    return acquire(e, key, fill, 0);
+}
+
+cache_obj_t *cache_peek(entry_t *e, const char *key) {
+    return acquire(e, key, NULL, 0);
+}
+
+int cache_filling(entry_t *e, const char *key) {
+    assert(e != NULL);
+    assert(key != NULL);
+    uint64_t hash = hash_key(e, key);
+    pthread_mutex_lock(&lock);
+    cache_obj_t *o = lookup(e, key, hash);
+    int filling = o != NULL && o->state == OBJ_FILLING;
+    pthread_mutex_unlock(&lock);
+    return filling;
+}
+
+/* Copy output into a sealed memfd. Returns the descriptor, or -1 if memfds
+ * aren't available or too many are in use already.
+ */
+static int materialize(entry_t *e, const char *data, size_t size) {
+    if (__sync_add_and_fetch(&memfds, 1) > MAX_MEMFDS) {
+        __sync_fetch_and_sub(&memfds, 1);
+        return -1;
+    }
+    char name[KEY_SIZE];
+    snprintf(name, sizeof(name), "execfs:%s", e->path);
+    int fd = memfd_create(name, MFD_CLOEXEC|MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        __sync_fetch_and_sub(&memfds, 1);
+        return -1;
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t sz = write(fd, data + done, size - done);
+        if (sz == -1 && errno == EINTR) {
+            continue;
+        } else if (sz <= 0) {
+            close(fd);
+            __sync_fetch_and_sub(&memfds, 1);
+            return -1;
+        }
+        done += sz;
+    }
+    /* Nothing may change the output behind the back of a reader. */
+    (void)fcntl(fd, F_ADD_SEALS,
+        F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL);
+    return fd;
+}
+
+void cache_fill(cache_obj_t *o, char *data, size_t size) {
+    assert(o != NULL);
+    /* A reload may move the placeholder to another entry at any time. */
+    pthread_mutex_lock(&lock);
+    entry_t *e = o->entry;
+    entry_hold(e);
+    pthread_mutex_unlock(&lock);
+
+    /* Nobody else touches the output of a placeholder, so hash and compress
+     * outside the lock.
+     */
+    o->digest = hash_xxh64(data, size, 0);
+    if (e->cache_codec != CODEC_NONE) {
+        o->packed = compress_buffer(e->cache_codec, data, size);
+        if (o->packed != NULL) {
+            free(data);
+            data = NULL;
+        } else {
+            LOG("Failed to compress output of %s, storing it as is", e->path);
+        }
+    }
+    if (o->packed == NULL) {
+        o->fd = materialize(e, data, size);
+        if (o->fd != -1) {
+            free(data);
+            data = NULL;
+        }
+    }
+
+    pthread_mutex_lock(&lock);
+    assert(o->state == OBJ_FILLING || o->state == OBJ_DEAD);
+    o->data = data;
+    o->size = size;
+    o->created = time(NULL);
+    if (o->has_prev && o->prev_digest == o->digest && o->prev_size == size) {
+        o->changed = o->prev_changed;
+        stats.unchanged++;
+    } else {
+        o->changed = o->created;
+    }
+    if (o->state == OBJ_FILLING) {
+        o->state = OBJ_READY;
+        used += footprint(o);
+        stats.objects++;
+        stats.raw_bytes += size;
+        lru_push(o, SEG_PROBATION);
+        evict();
+    }
+    pthread_cond_broadcast(&filled);
+    pthread_mutex_unlock(&lock);
+    entry_release(e);
+}
+
+int cache_store(entry_t *e, const char *key, char *data, size_t size) {
+    assert(e != NULL);
+    assert(key != NULL);
+    cache_obj_t *o = new_obj(e, key, hash_key(e, key));
+    if (o == NULL) {
+        free(data);
+        return -1;
+    }
+    uint64_t digest = hash_xxh64(data, size, 0);
+
+    pthread_mutex_lock(&lock);
+    cache_obj_t *old = lookup(e, key, o->hash);
+    if (e->cache_retired || (old != NULL && old->state == OBJ_FILLING)) {
+        /* Whoever is filling it will have output at least as fresh, and the
+         * output of a replaced entry won't be looked for.
+         */
+        pthread_mutex_unlock(&lock);
+        free_obj(o);
+        free(data);
+        return 0;
+    }
+    if (old != NULL && old->digest == digest && old->size == size) {
+        /* Nothing changed. Keep the old output, and with it the kernel's
+         * cached pages and the file's mtime.
+         */
+        old->created = time(NULL);
+        stats.unchanged++;
+        pthread_mutex_unlock(&lock);
+        free_obj(o);
+        free(data);
+        return 0;
+    }
+    if (old != NULL) {
+        o->has_prev = 1;
+        o->prev_digest = old->digest;
+        o->prev_size = old->size;
+        o->prev_changed = old->changed;
+        /* Opens already serving the old output keep it until released. */
+        kill_obj(old);
+    }
+    o->next = buckets[o->hash % BUCKETS];
+    buckets[o->hash % BUCKETS] = o;
+    pthread_mutex_unlock(&lock);
+
+    cache_fill(o, data, size);
+    cache_release(o);
+    return 0;
+}
+
+void cache_abort(cache_obj_t *o, int rejected) {
+    assert(o != NULL);
+    pthread_mutex_lock(&lock);
+    assert(o->state == OBJ_FILLING || o->state == OBJ_DEAD);
+    if (rejected) {
+        stats.rejected++;
+    }
+    o->refs--;
+    kill_obj(o);
+    pthread_cond_broadcast(&filled);
+    pthread_mutex_unlock(&lock);
+}
+
+void cache_release(cache_obj_t *o) {
+    if (o == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    assert(o->refs > 0);
+    if (--o->refs == 0 && o->state == OBJ_DEAD) {
+        free_obj(o);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+size_t cache_size(cache_obj_t *o) {
+    assert(o != NULL);
+    return o->size;
+}
+
+time_t cache_mtime(cache_obj_t *o) {
+    assert(o != NULL);
+    return o->changed;
+}
+
+uint64_t cache_digest(cache_obj_t *o) {
+    assert(o != NULL);
+    return o->digest;
+}
+
+ssize_t cache_read(cache_obj_t *o, char *buf, size_t size, off_t offset) {
+    assert(o != NULL);
+    assert(o->state != OBJ_FILLING);
+    /* The data of a referenced object never changes, so no lock needed. */
+    if (o->packed != NULL) {
+        return compressed_read(o->packed, buf, size, offset);
+    }
+    if (offset >= o->size) {
+        return 0;
+    }
+    if (size > o->size - offset) {
+        size = o->size - offset;
+    }
+    if (o->fd != -1) {
+        return pread(o->fd, buf, size, offset);
+    }
+    memcpy(buf, o->data + offset, size);
+    return size;
+}
+
+int cache_fd(cache_obj_t *o) {
+    assert(o != NULL);
+    assert(o->state != OBJ_FILLING);
+    return o->fd;
+}
+
+void cache_flush_entry(entry_t *e) {
+    pthread_mutex_lock(&lock);
+    size_t i;
+    for (i = 0; i < BUCKETS; ++i) {
+        cache_obj_t *o = buckets[i];
+        while (o != NULL) {
+            cache_obj_t *next = o->next;
+            if (same_output(o->entry, e) && o->state == OBJ_READY) {
+                kill_obj(o);
+            }
+            o = next;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Whether e is one of entries. */
+static int among(entry_t *e, entry_t **entries, size_t entries_sz) {
+    size_t i;
+    for (i = 0; i < entries_sz; ++i) {
+        if (entries[i] == e) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+void cache_reload(entry_t **old, size_t old_sz, entry_t **entries,
+        size_t entries_sz) {
+    assert(old != NULL || old_sz == 0);
+    assert(entries != NULL || entries_sz == 0);
+    size_t kept = 0, dropped = 0;
+    pthread_mutex_lock(&lock);
+    size_t i, j;
+    for (i = 0; i < old_sz; ++i) {
+        old[i]->cache_retired = 1;
+    }
+    for (i = 0; i < BUCKETS; ++i) {
+        cache_obj_t *o = buckets[i];
+        while (o != NULL) {
+            cache_obj_t *next = o->next;
+            if (among(o->entry, old, old_sz)) {
+                for (j = 0; j < entries_sz; ++j) {
+                    if (same_output(o->entry, entries[j])) {
+                        break;
+                    }
+                }
+                if (j == entries_sz) {
+                    kill_obj(o);
+                    dropped++;
+                } else {
+                    entry_hold(entries[j]);
+                    entry_release(o->entry);
+                    o->entry = entries[j];
+                    kept++;
+                }
+            }
+            o = next;
+        }
+    }
+    pthread_cond_broadcast(&filled);
+    pthread_mutex_unlock(&lock);
+    if (kept > 0 || dropped > 0) {
+        LOG("Kept %zu cached outputs across the reload, dropped %zu", kept,
+            dropped);
+    }
+}
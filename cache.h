@@ -0,0 +1,120 @@
+#ifndef _EXECFS_CACHE_H_
+#define _EXECFS_CACHE_H_
+
+/* Cache of command output. Entries with a cache policy have their output
+ * captured in full the first time they are opened for reading and later opens
+ * are served from memory. The policy decides which opens may share an output:
+ * an entry whose command depends on who opened it (see spawn.h) is partitioned
+ * by the relevant part of the opener's context so that one user never sees
+ * output generated for another. Entries of different mounts with the same path,
+ * command and caching options share their outputs.
+ *
+ * All partitions of all entries share one memory budget. When it is exceeded
+ * outputs are evicted according to a segmented LRU policy, except for those
+ * of pinned entries. Outputs larger than a configurable limit are not cached
+ * at all, so one huge stream can't flush everything else. Outputs of entries
+ * with a codec are stored compressed (see compress.h) and count against the
+ * budget at their compressed size. Other outputs are kept in memfds where the
+ * kernel supports them, so reads can be spliced straight from their pages.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+#include <time.h>
+
+#include "entry.h"
+
+typedef struct cache_obj cache_obj_t;
+
+/* Default memory budget for all cached output. */
+#define CACHE_DEFAULT_BUDGET (64 * 1024 * 1024) /* 64 MB */
+/* Default size of the largest output that will be cached. */
+#define CACHE_DEFAULT_MAX_OBJECT (8 * 1024 * 1024) /* 8 MB */
+
+void cache_set_budget(size_t bytes);
+void cache_set_max_object(size_t bytes);
+size_t cache_max_object(void);
+
+typedef struct {
+    unsigned long long hits;
+    unsigned long long misses;
+    unsigned long long evictions;
+    unsigned long long rejected; /* Outputs too large to admit. */
+    unsigned long long unchanged; /* Regenerated outputs that were identical. */
+    size_t objects;
+    size_t raw_bytes; /* Size of the outputs before any compression. */
+    size_t used;
+    size_t protected_bytes;
+    size_t budget;
+} cache_stats_t;
+
+void cache_get_stats(cache_stats_t *out);
+
+/* Describe the partition an open by the given process falls into. Returns a
+ * malloced key, or NULL and sets errno: ENOMEM if out of memory, or EIO if
+ * the partition can't be determined, because the process has exited or its
+ * environment can't be read. Such an open must not share any output.
+ */
+char *cache_key(entry_t *e, uid_t uid, gid_t gid, pid_t pid);
+
+/* Look up the output of e for key. If there is none, a placeholder is
+ * returned, *fill is set and the caller must run the command and pass its
+ * output to cache_fill() or give up with cache_abort(). Concurrent lookups of
+ * the same output wait for the first to fill it. The returned object is
+ * referenced until cache_release(). Returns NULL if out of memory.
+ */
+cache_obj_t *cache_acquire(entry_t *e, const char *key, int *fill);
+/* Like cache_acquire(), but returns NULL with errno set to EBUSY rather than
+ * wait for output that someone else is filling.
+ */
+cache_obj_t *cache_try_acquire(entry_t *e, const char *key, int *fill);
+void cache_fill(cache_obj_t *o, char *data, size_t size);
+/* rejected indicates the output was abandoned for exceeding
+ * cache_max_object().
+ */
+void cache_abort(cache_obj_t *o, int rejected);
+void cache_release(cache_obj_t *o);
+
+/* Replace the output of e for key with the malloced data, which the cache
+ * takes ownership of even on failure. Opens already reading the previous output carry on
+ * with it. Returns 0 on success.
+ */
+int cache_store(entry_t *e, const char *key, char *data, size_t size);
+
+/* Like cache_acquire(), but returns NULL instead of a placeholder, or if the
+ * output has expired. Expired output is left for the next cache_acquire() to
+ * compare what replaces it with.
+ */
+cache_obj_t *cache_peek(entry_t *e, const char *key);
+
+/* Whether the output of e for key is being filled right now. */
+int cache_filling(entry_t *e, const char *key);
+
+size_t cache_size(cache_obj_t *o);
+/* When the output last changed. Outputs regenerated byte for byte (after
+ * their ttl expired or on a schedule) keep the time of their predecessor.
+ */
+time_t cache_mtime(cache_obj_t *o);
+/* Hash of the output, equal for identical outputs. */
+uint64_t cache_digest(cache_obj_t *o);
+ssize_t cache_read(cache_obj_t *o, char *buf, size_t size, off_t offset);
+
+/* The sealed memfd holding the output, or -1 if it is held some other way.
+ * Valid until the object is released.
+ */
+int cache_fd(cache_obj_t *o);
+
+/* Drop every cached output of e. */
+void cache_flush_entry(entry_t *e);
+
+/* The entries old are being replaced by entries. Outputs of an old entry
+ * that a new one would produce and keep the same way (same path, command and
+ * caching options) are kept for it, and the rest are dropped. Opens of an old
+ * entry still in progress may be served what is kept, but what they produce
+ * themselves isn't cached.
+ */
+void cache_reload(entry_t **old, size_t old_sz, entry_t **entries,
+        size_t entries_sz);
+
+#endif
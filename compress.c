@@ -0,0 +1,241 @@
+/* Chunked compression of in-memory buffers. */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef EXECFS_LZ4
+#include <lz4.h>
+#endif
+#ifdef EXECFS_ZSTD
+#include <zstd.h>
+#endif
+
+#include "compress.h"
+
+/* Fast levels, as outputs are compressed on the open that fills the cache. */
+#define ZSTD_LEVEL 3
+
+typedef struct {
+    char *data;
+    size_t size;    /* Stored size. */
+    int compressed; /* Zero if stored as is because compression didn't help. */
+} chunk_t;
+
+struct compressed {
+    codec_t codec;
+    size_t size; /* Original size. */
+    chunk_t *chunks;
+    size_t chunks_sz;
+    size_t footprint;
+};
+
+int codec_parse(const char *name, codec_t *codec) {
+    assert(name != NULL);
+    assert(codec != NULL);
+    if (!strcmp(name, "lz4")) {
+#ifdef EXECFS_LZ4
+        *codec = CODEC_LZ4;
+        return 0;
+#endif
+    } else if (!strcmp(name, "zstd")) {
+#ifdef EXECFS_ZSTD
+        *codec = CODEC_ZSTD;
+        return 0;
+#endif
+    } else {
+        errno = EINVAL;
+        return -1;
+    }
+    errno = ENOTSUP;
+    return -1;
+}
+
+const char *codec_name(codec_t codec) {
+    switch (codec) {
+        case CODEC_NONE: return "none";
+        case CODEC_LZ4: return "lz4";
+        case CODEC_ZSTD: return "zstd";
+    }
+    return "unknown";
+}
+
+/* Upper bound on the compressed size of len bytes. */
+static size_t bound(codec_t codec, size_t len) {
+    switch (codec) {
+#ifdef EXECFS_LZ4
+        case CODEC_LZ4: return LZ4_compressBound(len);
+#endif
+#ifdef EXECFS_ZSTD
+        case CODEC_ZSTD: return ZSTD_compressBound(len);
+#endif
+        default: return 0;
+    }
+}
+
+/* Compress len bytes of src into dst of dst_len bytes. Returns the
+ * compressed size or 0 on failure.
+ */
+static size_t encode(codec_t codec, const char *src, size_t len, char *dst,
+        size_t dst_len) {
+    switch (codec) {
+#ifdef EXECFS_LZ4
+        case CODEC_LZ4: {
+            int n = LZ4_compress_default(src, dst, len, dst_len);
+            return n > 0 ? n : 0;
+        }
+#endif
+#ifdef EXECFS_ZSTD
+        case CODEC_ZSTD: {
+            size_t n = ZSTD_compress(dst, dst_len, src, len, ZSTD_LEVEL);
+            return ZSTD_isError(n) ? 0 : n;
+        }
+#endif
+        default: return 0;
+    }
+}
+
+/* Decompress a chunk into dst, which must hold len bytes, the chunk's
+ * original size. Returns 0 on success.
+ */
+static int decode(codec_t codec, const chunk_t *chunk, char *dst, size_t len) {
+    if (!chunk->compressed) {
+        memcpy(dst, chunk->data, len);
+        return 0;
+    }
+    switch (codec) {
+#ifdef EXECFS_LZ4
+        case CODEC_LZ4: {
+            int n = LZ4_decompress_safe(chunk->data, dst, chunk->size, len);
+            return n == (int)len ? 0 : -1;
+        }
+#endif
+#ifdef EXECFS_ZSTD
+        case CODEC_ZSTD: {
+            size_t n = ZSTD_decompress(dst, len, chunk->data, chunk->size);
+            return n == len ? 0 : -1;
+        }
+#endif
+        default: return -1;
+    }
+}
+
+compressed_t *compress_buffer(codec_t codec, const char *data, size_t size) {
+    assert(codec != CODEC_NONE);
+    assert(data != NULL || size == 0);
+    compressed_t *c = calloc(1, sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    c->codec = codec;
+    c->size = size;
+    c->chunks_sz = (size + COMPRESS_CHUNK_SIZE - 1) / COMPRESS_CHUNK_SIZE;
+    c->footprint = sizeof(*c) + c->chunks_sz * sizeof(chunk_t);
+    c->chunks = calloc(c->chunks_sz == 0 ? 1 : c->chunks_sz, sizeof(chunk_t));
+    char *scratch = malloc(bound(codec, COMPRESS_CHUNK_SIZE));
+    if (c->chunks == NULL || scratch == NULL) {
+        goto compress_buffer_fail;
+    }
+
+    size_t i;
+    for (i = 0; i < c->chunks_sz; ++i) {
+        const char *src = data + i * COMPRESS_CHUNK_SIZE;
+        size_t len = size - i * COMPRESS_CHUNK_SIZE;
+        if (len > COMPRESS_CHUNK_SIZE) {
+            len = COMPRESS_CHUNK_SIZE;
+        }
+        chunk_t *chunk = &c->chunks[i];
+        size_t n = encode(codec, src, len, scratch,
+            bound(codec, COMPRESS_CHUNK_SIZE));
+        if (n > 0 && n < len) {
+            chunk->compressed = 1;
+            chunk->size = n;
+            src = scratch;
+        } else {
+            chunk->size = len;
+        }
+        chunk->data = malloc(chunk->size);
+        if (chunk->data == NULL) {
+            goto compress_buffer_fail;
+        }
+        memcpy(chunk->data, src, chunk->size);
+        c->footprint += chunk->size;
+    }
+    free(scratch);
+    return c;
+
+compress_buffer_fail:
+    free(scratch);
+    compressed_free(c);
+    return NULL;
+}
+
+void compressed_free(compressed_t *c) {
+    if (c == NULL) {
+        return;
+    }
+    size_t i;
+    if (c->chunks != NULL) {
+        for (i = 0; i < c->chunks_sz; ++i) {
+            free(c->chunks[i].data);
+        }
+    }
+    free(c->chunks);
+    free(c);
+}
+
+size_t compressed_footprint(compressed_t *c) {
+    assert(c != NULL);
+    return c->footprint;
+}
+
+ssize_t compressed_read(compressed_t *c, char *buf, size_t size,
+        off_t offset) {
+    assert(c != NULL);
+    assert(buf != NULL);
+    if (offset >= c->size) {
+        return 0;
+    }
+    if (size > c->size - offset) {
+        size = c->size - offset;
+    }
+
+    char *scratch = NULL;
+    size_t done = 0;
+    while (done < size) {
+        size_t pos = offset + done;
+        size_t i = pos / COMPRESS_CHUNK_SIZE;
+        size_t start = i * COMPRESS_CHUNK_SIZE;
+        size_t len = c->size - start < COMPRESS_CHUNK_SIZE ?
+            c->size - start : COMPRESS_CHUNK_SIZE;
+        size_t skip = pos - start;
+        size_t n = len - skip < size - done ? len - skip : size - done;
+
+        if (skip == 0 && n == len) {
+            /* The whole chunk is wanted, so decompress it in place. */
+            if (decode(c->codec, &c->chunks[i], buf + done, len) != 0) {
+                goto compressed_read_fail;
+            }
+        } else {
+            if (scratch == NULL) {
+                scratch = malloc(COMPRESS_CHUNK_SIZE);
+                if (scratch == NULL) {
+                    goto compressed_read_fail;
+                }
+            }
+            if (decode(c->codec, &c->chunks[i], scratch, len) != 0) {
+                goto compressed_read_fail;
+            }
+            memcpy(buf + done, scratch + skip, n);
+        }
+        done += n;
+    }
+    free(scratch);
+    return done;
+
+compressed_read_fail:
+    free(scratch);
+    errno = EIO;
+    return -1;
+}
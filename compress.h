@@ -0,0 +1,46 @@
+#ifndef _EXECFS_COMPRESS_H_
+#define _EXECFS_COMPRESS_H_
+
+/* Compressed in-memory buffers. A buffer is split into fixed-size chunks that
+ * are compressed independently, so a read at any offset only has to
+ * decompress the chunks it touches.
+ *
+ * The codecs are optional: LZ4 is built in with EXECFS_LZ4 and zstd with
+ * EXECFS_ZSTD.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef enum {
+    CODEC_NONE,
+    CODEC_LZ4,  /* Fast. */
+    CODEC_ZSTD, /* Better ratio. */
+} codec_t;
+
+/* Uncompressed size of each chunk. */
+#define COMPRESS_CHUNK_SIZE (64 * 1024)
+
+/* Look up a codec by name. Returns -1 and sets errno to EINVAL for an unknown
+ * codec, or ENOTSUP for one that wasn't built in.
+ */
+int codec_parse(const char *name, codec_t *codec);
+const char *codec_name(codec_t codec);
+
+typedef struct compressed compressed_t;
+
+/* Compress size bytes of data. Chunks that don't shrink are kept as they
+ * are. Returns NULL on failure.
+ */
+compressed_t *compress_buffer(codec_t codec, const char *data, size_t size);
+void compressed_free(compressed_t *c);
+
+/* Bytes of memory held by the compressed buffer. */
+size_t compressed_footprint(compressed_t *c);
+
+/* Copy up to size bytes of the original data starting at offset into buf.
+ * Returns the number of bytes copied, or -1 on failure.
+ */
+ssize_t compressed_read(compressed_t *c, char *buf, size_t size, off_t offset);
+
+#endif
@@ -8,8 +8,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "builtin.h"
 #include "config.h"
 #include "entry.h"
+#include "errbuf.h"
+#include "plugin.h"
+#include "reap.h"
+#include "script.h"
+#include "spawn.h"
+#include "standby.h"
 
 #define BIT(n) (1UL << (n))
 #define R BIT(2)
@@ -17,8 +24,13 @@
 #define X BIT(0)
 
 #define DELIMITERS "|"
+#define OPTION_DELIMITERS ","
 #define BUFFER_SIZE 512
 
+/* Defaults for interactive entries. */
+#define DEFAULT_DELIMITER "\n"
+#define DEFAULT_IDLE_MS 100
+
 #define printf_arg int(*debug_printf)(char *format, ...)
 
 #define DPRINTF(args...) \
@@ -79,11 +91,234 @@ static char *readline(FILE *fd, printf_arg) {
     return line;
 }
 
+/* Free an entry and everything it owns. */
+static void free_entry(entry_t *e) {
+    assert(e != NULL);
+    errbuf_forget(e);
+    reap_forget(e);
+    free(e->path);
+    free(e->command);
+    free(e->delimiter);
+    free(e->cache_env);
+    builtin_free(e->builtin);
+    plugin_unload(e->plugin);
+    script_free(e->script);
+    spawn_env_free(e);
+    free(e);
+}
+
+void entry_hold(entry_t *e) {
+    assert(e != NULL);
+    __sync_fetch_and_add(&e->refs, 1);
+}
+
+void entry_release(entry_t *e) {
+    if (e != NULL && __sync_sub_and_fetch(&e->refs, 1) == 0) {
+        free_entry(e);
+    }
+}
+
+/* Expand the escape sequences \n, \t, \r, \\, and \, in place. Returns the
+ * length of the result or PARSE_FAIL on an unknown escape.
+ */
+static size_t unescape(char *s) {
+    char *in, *out;
+    for (in = out = s; *in != '\0'; in++, out++) {
+        if (*in != '\\') {
+            *out = *in;
+            continue;
+        }
+        switch (*++in) {
+            case 'n': *out = '\n'; break;
+            case 't': *out = '\t'; break;
+            case 'r': *out = '\r'; break;
+            case ',': *out = ','; break;
+            case '\\': *out = '\\'; break;
+            default: return PARSE_FAIL;
+        }
+    }
+    *out = '\0';
+    return out - s;
+}
+
+/* Parse the comma-separated options that may follow the permissions field.
+ * Returns 0 on success.
+ */
+static int parse_options(entry_t *e, char *s, printf_arg) {
+    char *opt;
+    /* The last option given that only applies to cached output. */
+    const char *cache_opt = NULL;
+    const char *interactive_opt = NULL;
+    /* strtok() is busy with the enclosing line, so split by hand. Commas can
+     * be escaped inside values, so skip over backslash pairs.
+     */
+    while (s != NULL && *s != '\0') {
+        opt = s;
+        while (*s != '\0' && *s != OPTION_DELIMITERS[0]) {
+            if (*s == '\\' && s[1] != '\0') {
+                s++;
+            }
+            s++;
+        }
+        if (*s != '\0') {
+            *s++ = '\0';
+        }
+
+        char *value = strchr(opt, '=');
+        if (value != NULL) {
+            *value++ = '\0';
+        }
+
+        if (!strcmp(opt, "interactive") && value == NULL) {
+            e->mode = MODE_INTERACTIVE;
+        } else if (!strcmp(opt, "builtin") && value == NULL) {
+            e->kind = KIND_BUILTIN;
+        } else if (!strcmp(opt, "plugin") && value == NULL) {
+            e->kind = KIND_PLUGIN;
+        } else if (!strcmp(opt, "lua") && value == NULL) {
+            e->kind = KIND_SCRIPT;
+        } else if (!strcmp(opt, "cache")) {
+            if (value == NULL || !strcmp(value, "global")) {
+                e->cache_policy = CACHE_GLOBAL;
+            } else if (!strcmp(value, "uid")) {
+                e->cache_policy = CACHE_UID;
+            } else if (!strcmp(value, "gid")) {
+                e->cache_policy = CACHE_GID;
+            } else if (!strcmp(value, "pidtree")) {
+                e->cache_policy = CACHE_PIDTREE;
+            } else if (!strncmp(value, "env:", strlen("env:")) &&
+                    value[strlen("env:")] != '\0') {
+                e->cache_policy = CACHE_ENV;
+                free(e->cache_env);
+                e->cache_env = strdup(value + strlen("env:"));
+                if (e->cache_env == NULL) {
+                    DPRINTF("Out of memory in %s\n", __func__);
+                    return -1;
+                }
+            } else {
+                DPRINTF("Invalid cache policy %s\n", value);
+                errno = EINVAL;
+                return -1;
+            }
+        } else if (!strcmp(opt, "ttl") && value != NULL) {
+            char *end;
+            long ttl = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || ttl < 0) {
+                DPRINTF("Invalid cache time to live %s\n", value);
+                errno = EINVAL;
+                return -1;
+            }
+            e->cache_ttl = ttl;
+            cache_opt = "ttl";
+        } else if (!strcmp(opt, "every") && value != NULL) {
+            char *end;
+            long every = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || every <= 0) {
+                DPRINTF("Invalid schedule interval %s\n", value);
+                errno = EINVAL;
+                return -1;
+            }
+            e->every = every;
+        } else if (!strcmp(opt, "spool") && value == NULL) {
+            e->spool = 1;
+        } else if (!strcmp(opt, "standby") && value != NULL) {
+            char *end;
+            long n = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || n <= 0 || n > STANDBY_MAX) {
+                DPRINTF("Invalid number of standby children %s\n", value);
+                errno = EINVAL;
+                return -1;
+            }
+            e->standby = (int)n;
+        } else if (!strcmp(opt, "sink") && value == NULL) {
+            e->sink = 1;
+        } else if (!strcmp(opt, "pin") && value == NULL) {
+            e->cache_pin = 1;
+            cache_opt = "pin";
+        } else if (!strcmp(opt, "compress") && value != NULL) {
+            if (codec_parse(value, &e->cache_codec) != 0) {
+                DPRINTF("%s compression %s\n", errno == ENOTSUP ?
+                    "This build does not support" : "Unknown", value);
+                return -1;
+            }
+            cache_opt = "compress";
+        } else if (!strcmp(opt, "delim") && value != NULL) {
+            free(e->delimiter);
+            e->delimiter = strdup(value);
+            if (e->delimiter == NULL) {
+                DPRINTF("Out of memory in %s\n", __func__);
+                return -1;
+            }
+            e->delimiter_len = unescape(e->delimiter);
+            if (e->delimiter_len == PARSE_FAIL) {
+                DPRINTF("Invalid escape in delimiter %s\n", value);
+                errno = EINVAL;
+                return -1;
+            }
+            interactive_opt = "delim";
+        } else if (!strcmp(opt, "idle") && value != NULL) {
+            char *end;
+            long ms = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || ms <= 0 || ms > INT_MAX) {
+                DPRINTF("Invalid idle timeout %s\n", value);
+                errno = EINVAL;
+                return -1;
+            }
+            e->idle_ms = e->reply_ms = (int)ms;
+            interactive_opt = "idle";
+        } else {
+            DPRINTF("Unrecognised option %s\n", opt);
+            errno = EINVAL;
+            return -1;
+        }
+    }
+    /* every implies cache. */
+    if (cache_opt != NULL && e->cache_policy == CACHE_NONE && e->every == 0) {
+        DPRINTF("%s only applies to cached entries\n", cache_opt);
+        errno = EINVAL;
+        return -1;
+    }
+    if (interactive_opt != NULL && e->mode != MODE_INTERACTIVE) {
+        DPRINTF("%s only applies to interactive entries\n", interactive_opt);
+        errno = EINVAL;
+        return -1;
+    }
+    return 0;
+}
+
 /* Parse a string into a directory entry. An entry is expected to be in the
  * form:
- *  path/to/file|permissions|command to execute
- * Permissions should be given in chmod numerical form. This function returns
- * NULL on failure.
+ *  path/to/file|permissions[,option...]|command to execute
+ * Permissions should be given in chmod numerical form. The recognised options
+ * are:
+ *  builtin       Evaluate the command in-process as one of the built-ins
+ *                described in builtin.h.
+ *  plugin        Serve the file from the shared-object plugin named by the
+ *                command (see execfs_plugin.h).
+ *  lua           The command is a Lua script, or @file naming one (see
+ *                script.h).
+ *  cache[=POLICY] Capture the command's output and serve later read-only
+ *                opens from memory (see cache.h). POLICY is one of global
+ *                (the default), uid, gid, pidtree or env:NAME.
+ *  ttl=SECONDS   Discard cached output after this long (default never).
+ *                Like pin and compress, only for cached entries.
+ *  every=SECONDS Refresh the cached output on this schedule, regardless of
+ *                reads. Implies cache, which must be global.
+ *  spool         Collect the command's output into a memfd when opened for
+ *                reading, so the file has a real size and can be mapped.
+ *  standby=N     Keep N children started and waiting for read-only opens
+ *                (see standby.h).
+ *  sink          Feed every open for writing into one shared, long-lived run
+ *                of the command (see sink.h).
+ *  pin           Never evict cached output to stay within the cache budget.
+ *  compress=CODEC Keep cached output compressed with lz4 or zstd (see
+ *                compress.h).
+ *  interactive   Drive the command over a socket in request/response turns.
+ *  delim=STRING  End of an interactive response (default "\n").
+ *  idle=MS       Silence that also ends an interactive response (default
+ *                100), and the longest wait for it to begin (default
+ *                forever). Like delim, only for interactive entries.
+ * This function returns NULL on failure.
  */
 static entry_t *parse_entry(char *s, printf_arg) {
     entry_t *e = (entry_t*)malloc(sizeof(entry_t));
@@ -91,7 +326,12 @@ static entry_t *parse_entry(char *s, printf_arg) {
         DPRINTF("Out of memory in %s\n", __func__);
         goto parse_entry_fail;
     }
-    e->path = e->command = NULL;
+    memset(e, 0, sizeof(*e));
+    e->refs = 1;
+    e->kind = KIND_COMMAND;
+    e->mode = MODE_STREAM;
+    e->idle_ms = DEFAULT_IDLE_MS;
+    e->reply_ms = -1;
 
     /* Read the path field. */
     char *next = strtok(s, DELIMITERS);
@@ -114,8 +354,10 @@ static entry_t *parse_entry(char *s, printf_arg) {
         goto parse_entry_fail;
     }
     unsigned int u, g, o;
-    if (sscanf(next, "%1u%1u%1u", &u, &g, &o) != 3 ||
-        u & ~(R|W|X) || g & ~(R|W|X) || o & ~(R|W|X)) {
+    int consumed = 0;
+    if (sscanf(next, "%1u%1u%1u%n", &u, &g, &o, &consumed) != 3 ||
+        u & ~(R|W|X) || g & ~(R|W|X) || o & ~(R|W|X) ||
+        (next[consumed] != '\0' && next[consumed] != OPTION_DELIMITERS[0])) {
         errno = EINVAL;
         DPRINTF("Invalid permissions entry\n");
         goto parse_entry_fail;
@@ -124,6 +366,25 @@ static entry_t *parse_entry(char *s, printf_arg) {
     e->g_r = !!(g & R); e->g_w = !!(g & W); e->g_x = !!(g & X);
     e->o_r = !!(o & R); e->o_w = !!(o & W); e->o_x = !!(o & X);
 
+    if (next[consumed] != '\0' &&
+            parse_options(e, next + consumed + 1, debug_printf) != 0) {
+        DPRINTF("Invalid options in permissions entry\n");
+        goto parse_entry_fail;
+    }
+    if (e->delimiter == NULL) {
+        e->delimiter = strdup(DEFAULT_DELIMITER);
+        if (e->delimiter == NULL) {
+            DPRINTF("Out of memory in %s\n", __func__);
+            goto parse_entry_fail;
+        }
+        e->delimiter_len = strlen(e->delimiter);
+    }
+    if (e->delimiter_len == 0) {
+        DPRINTF("Empty delimiter\n");
+        errno = EINVAL;
+        goto parse_entry_fail;
+    }
+
     /* Read command field. */
     next = strtok(NULL, DELIMITERS);
     if (next == NULL) {
@@ -152,13 +413,60 @@ static entry_t *parse_entry(char *s, printf_arg) {
         strcat(e->command, next);
     }
 
+    if (e->every > 0 && e->cache_policy == CACHE_NONE) {
+        e->cache_policy = CACHE_GLOBAL;
+    }
+    if (e->spool && e->cache_policy != CACHE_NONE) {
+        DPRINTF("Cached output is already held in memory; spool is only for "
+            "uncached entries\n");
+        errno = EINVAL;
+        goto parse_entry_fail;
+    }
+    if (e->standby > 0 && (e->cache_policy != CACHE_NONE || e->spool)) {
+        DPRINTF("Standby children are only for entries streamed to each "
+            "open\n");
+        errno = EINVAL;
+        goto parse_entry_fail;
+    }
+    if (e->every > 0 && e->cache_policy != CACHE_GLOBAL) {
+        DPRINTF("Scheduled entries can only be cached globally\n");
+        errno = EINVAL;
+        goto parse_entry_fail;
+    }
+    if (e->kind != KIND_COMMAND && (e->mode == MODE_INTERACTIVE ||
+            e->cache_policy != CACHE_NONE || e->spool || e->standby > 0 ||
+            e->sink)) {
+        DPRINTF("Only shell commands can be interactive, cached, spooled, "
+            "kept on standby or shared sinks\n");
+        errno = EINVAL;
+        goto parse_entry_fail;
+    }
+    if (e->kind == KIND_BUILTIN) {
+        e->builtin = builtin_parse(e->command);
+        if (e->builtin == NULL) {
+            DPRINTF("Unsupported built-in command %s\n", e->command);
+            goto parse_entry_fail;
+        }
+    } else if (e->kind == KIND_PLUGIN) {
+        e->plugin = plugin_load(e->command, debug_printf);
+        if (e->plugin == NULL) {
+            goto parse_entry_fail;
+        }
+    } else if (e->kind == KIND_SCRIPT) {
+        e->script = script_compile(e->command, debug_printf);
+        if (e->script == NULL) {
+            goto parse_entry_fail;
+        }
+    } else if (spawn_env_build(e) != 0) {
+        DPRINTF("Out of memory in %s\n", __func__);
+        goto parse_entry_fail;
+    }
+
     return e;
 
 parse_entry_fail:
     if (e != NULL) {
-        if (e->path != NULL) free(e->path);
-        if (e->command != NULL) free(e->command);
-        free(e);
+        free_entry(e);
     }
     return NULL;
 }
@@ -215,7 +523,7 @@ entry_t **parse_config(size_t *len, char *filename, printf_arg) {
         }
         if (append_entry(&entries, e, *len, debug_printf) != 0) {
             DPRINTF("Line %d: Failed to append entry.\n", line_num);
-            free(e);
+            free_entry(e);
             goto parse_config_fail;
         }
         (*len)++;
@@ -230,9 +538,7 @@ parse_config_fail:
         int i;
         for (i = 0; i < *len; ++i) {
             assert(entries[i] != NULL);
-            free(entries[i]->path);
-            free(entries[i]->command);
-            free(entries[i]);
+            free_entry(entries[i]);
         }
         free(entries);
     }
@@ -12,4 +12,13 @@
 entry_t **parse_config(size_t *len, char *filename,
         int(*debug_printf)(char *format, ...));
 
+/* Entries returned by parse_config() hold one reference each, which belongs
+ * to whoever keeps the array. Anything else that keeps an entry, and may still
+ * be using it after a reload has replaced the array, takes a reference of its
+ * own. The entry is freed, with everything it owns, when the last one is
+ * released. entry_release() accepts NULL.
+ */
+void entry_hold(entry_t *e);
+void entry_release(entry_t *e);
+
 #endif
@@ -0,0 +1,444 @@
+/* Administrative control socket. */
+
+#define _GNU_SOURCE /* open_memstream(), struct ucred */
+
+#include <assert.h>
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "binlog.h"
+#include "cache.h"
+#include "config.h"
+#include "control.h"
+#include "errbuf.h"
+#include "globals.h"
+#include "log.h"
+#include "mount.h"
+#include "prefetch.h"
+#include "reap.h"
+#include "schedule.h"
+#include "standby.h"
+#include "stats.h"
+#include "workq.h"
+
+/* Longest command line accepted. */
+#define CONTROL_MAX_COMMAND 4096
+/* Seconds a client may take to send its command. */
+#define CONTROL_TIMEOUT 5
+/* Most words in a command. */
+#define CONTROL_MAX_ARGS 64
+/* Refreshes run at once. */
+#define CONTROL_REFRESH_WORKERS 2
+
+static int sock = -1;
+static char *sock_path = NULL;
+static mount_t **mounts = NULL;
+static size_t mounts_sz = 0;
+static pthread_t thread;
+static int running = 0;
+/* Runs the commands of refresh in the background, so the one client served
+ * at a time isn't left waiting for them. Started by the first refresh.
+ */
+static workq_t *refreshers = NULL;
+
+int control_open(const char *path, mount_t **m, size_t m_sz) {
+    assert(path != NULL);
+    assert(sock == -1);
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(path) >= sizeof(addr.sun_path)) {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(addr.sun_path, path);
+
+    /* Going into the background changes directory, so remember where it is
+     * for removing it.
+     */
+    if (path[0] == '/') {
+        sock_path = strdup(path);
+    } else {
+        char *cwd = getcwd(NULL, 0);
+        if (cwd != NULL && asprintf(&sock_path, "%s/%s", cwd, path) < 0) {
+            sock_path = NULL;
+        }
+        free(cwd);
+    }
+    if (sock_path == NULL) {
+        return -1;
+    }
+
+    /* Replace a socket left behind by an execfs that didn't exit cleanly,
+     * but not one that another execfs is still listening on.
+     */
+    struct stat st;
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+        int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        if (probe == -1) {
+            goto control_open_fail;
+        }
+        int live = connect(probe, (struct sockaddr*)&addr, sizeof(addr)) == 0;
+        (void)close(probe);
+        if (live) {
+            errno = EADDRINUSE;
+            goto control_open_fail;
+        }
+        (void)unlink(path);
+    }
+
+    sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        goto control_open_fail;
+    }
+    /* Only the owner can connect. */
+    mode_t mask = umask(077);
+    int err = bind(sock, (struct sockaddr*)&addr, sizeof(addr));
+    umask(mask);
+    if (err != 0 || listen(sock, SOMAXCONN) != 0) {
+        goto control_open_fail;
+    }
+    mounts = m;
+    mounts_sz = m_sz;
+    return 0;
+
+control_open_fail:
+    err = errno;
+    if (sock != -1) {
+        (void)close(sock);
+        sock = -1;
+    }
+    free(sock_path);
+    sock_path = NULL;
+    errno = err;
+    return -1;
+}
+
+/* Apply fn to every entry with the given path in any mount. The entries are
+ * held while fn runs rather than the mounts locked, as fn may run a command
+ * and reloads shouldn't wait for it. Returns the number of entries found.
+ */
+static size_t for_each_entry(const char *path, void (*fn)(entry_t *e,
+        FILE *reply), FILE *reply) {
+    if (path != NULL && *path == '/') {
+        path++;
+    }
+    size_t i, j, found = 0;
+    for (i = 0; i < mounts_sz; ++i) {
+        mount_t *m = mounts[i];
+        pthread_rwlock_rdlock(&m->lock);
+        entry_t **held = malloc(sizeof(entry_t*) * (m->entries_sz + 1));
+        size_t held_sz = 0;
+        for (j = 0; held != NULL && j < m->entries_sz; ++j) {
+            if (path == NULL || !strcmp(path, m->entries[j]->path)) {
+                held[held_sz++] = m->entries[j];
+                entry_hold(m->entries[j]);
+            }
+        }
+        pthread_rwlock_unlock(&m->lock);
+        if (held == NULL) {
+            fprintf(reply, "%s: out of memory\n", m->config);
+            continue;
+        }
+        for (j = 0; j < held_sz; ++j) {
+            fn(held[j], reply);
+            entry_release(held[j]);
+        }
+        free(held);
+        found += held_sz;
+    }
+    return found;
+}
+
+static void flush(entry_t *e, FILE *reply) {
+    if (e->cache_policy != CACHE_NONE) {
+        cache_flush_entry(e);
+    }
+}
+
+/* Also how the queue discards refreshes it never ran. */
+static void free_refresh(void *arg) {
+    entry_release(arg);
+}
+
+static void run_refresh(void *arg) {
+    entry_t *e = arg;
+    if (schedule_refresh(e, uid, gid) != 0) {
+        LOG("Failed to refresh %s", e->path);
+    }
+    entry_release(e);
+}
+
+static void refresh(entry_t *e, FILE *reply) {
+    if (e->cache_policy == CACHE_NONE) {
+        fprintf(reply, "%s: not cached\n", e->path);
+    } else if (e->kind == KIND_COMMAND && e->cache_policy == CACHE_GLOBAL) {
+        if (refreshers == NULL) {
+            refreshers = workq_create(CONTROL_REFRESH_WORKERS, 0,
+                free_refresh);
+        }
+        entry_hold(e);
+        if (refreshers == NULL ||
+                workq_submit(refreshers, run_refresh, e) != 0) {
+            entry_release(e);
+            fprintf(reply, "%s: failed\n", e->path);
+        } else {
+            fprintf(reply, "%s: refreshing\n", e->path);
+        }
+    } else {
+        /* Other partitions belong to openers, so regenerate them on demand. */
+        cache_flush_entry(e);
+        fprintf(reply, "%s: flushed\n", e->path);
+    }
+}
+
+/* Parse a decimal number into n. Returns 0 on success. */
+static int number(const char *s, unsigned long long *n) {
+    char *end;
+    errno = 0;
+    *n = strtoull(s, &end, 10);
+    return *s == '\0' || *s == '-' || *end != '\0' || errno != 0 ? -1 : 0;
+}
+
+static const char *set(const char *name, const char *value) {
+    unsigned long long n;
+    if (number(value, &n) != 0) {
+        return "invalid value";
+    }
+    if (!strcmp(name, "backoff") && n <= ULONG_MAX) {
+        reap_set_backoff(n);
+    } else if (!strcmp(name, "cache-size")) {
+        cache_set_budget(n);
+    } else if (!strcmp(name, "cache-max-object")) {
+        cache_set_max_object(n);
+    } else if (!strcmp(name, "prefetch") && n <= UINT_MAX) {
+        prefetch_set_depth(n);
+        if (prefetch_start() != 0) {
+            return "failed to start prefetch threads";
+        }
+    } else if (!strcmp(name, "prefetch-workers") && n > 0 && n <= INT_MAX) {
+        if (prefetch_set_workers(n) != 0) {
+            return "failed to start prefetch threads";
+        }
+    } else if (!strcmp(name, "schedule-workers") && n > 0 && n <= INT_MAX) {
+        if (schedule_set_workers(n) != 0) {
+            return "failed to start schedule threads";
+        }
+    } else {
+        return "unknown limit or value out of range";
+    }
+    LOG("Set %s to %s", name, value);
+    return NULL;
+}
+
+static const char *reload(FILE *reply) {
+    size_t i, failed = 0;
+    for (i = 0; i < mounts_sz; ++i) {
+        if (mount_reload(mounts[i]) != 0) {
+            fprintf(reply, "%s: failed, kept previous entries\n",
+                mounts[i]->config);
+            failed++;
+        } else {
+            fprintf(reply, "%s: %zu entries\n", mounts[i]->config,
+                mounts[i]->entries_sz);
+        }
+    }
+
+    /* Schedules and standby children refer to the entries they were made
+     * for.
+     */
+    schedule_stop();
+    standby_stop();
+    for (i = 0; i < mounts_sz; ++i) {
+        mount_t *m = mounts[i];
+        pthread_rwlock_rdlock(&m->lock);
+        if (schedule_add(m->entries, m->entries_sz, uid, gid) != 0) {
+            LOG("Failed to schedule entries of %s", m->config);
+        }
+        if (standby_add(m->entries, m->entries_sz) != 0) {
+            LOG("Failed to start standby children for %s", m->config);
+        }
+        pthread_rwlock_unlock(&m->lock);
+    }
+    return failed == 0 ? NULL : "some configuration files could not be read";
+}
+
+/* Carry out one command, writing its output to reply. Returns NULL on
+ * success or a reason for failure.
+ */
+static const char *execute(int argc, char **argv, FILE *reply) {
+    if (argc == 0) {
+        return "no command";
+    }
+    const char *cmd = argv[0];
+    int i;
+    if (!strcmp(cmd, "stats") && argc == 1) {
+        size_t len;
+        char *s = stats_format(&len);
+        if (s == NULL) {
+            return "out of memory";
+        }
+        fwrite(s, 1, len, reply);
+        free(s);
+    } else if (!strcmp(cmd, "flush") && argc == 1) {
+        for_each_entry(NULL, flush, reply);
+    } else if (!strcmp(cmd, "flush")) {
+        for (i = 1; i < argc; ++i) {
+            if (for_each_entry(argv[i], flush, reply) == 0) {
+                fprintf(reply, "%s: no such entry\n", argv[i]);
+            }
+        }
+    } else if (!strcmp(cmd, "refresh") && argc > 1) {
+        for (i = 1; i < argc; ++i) {
+            if (for_each_entry(argv[i], refresh, reply) == 0) {
+                fprintf(reply, "%s: no such entry\n", argv[i]);
+            }
+        }
+    } else if (!strcmp(cmd, "stderr") && argc == 2) {
+        size_t len;
+        char *s = errbuf_read(argv[1], &len);
+        if (s == NULL) {
+            return "out of memory";
+        }
+        fwrite(s, 1, len, reply);
+        free(s);
+    } else if (!strcmp(cmd, "log") && argc == 2 &&
+            (!strcmp(argv[1], "on") || !strcmp(argv[1], "off"))) {
+        log_set_enabled(!strcmp(argv[1], "on"));
+        binlog_set_enabled(!strcmp(argv[1], "on"));
+    } else if (!strcmp(cmd, "set") && argc == 3) {
+        return set(argv[1], argv[2]);
+    } else if (!strcmp(cmd, "reload") && argc == 1) {
+        return reload(reply);
+    } else {
+        return "unknown command or wrong arguments";
+    }
+    return NULL;
+}
+
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t sent = send(fd, buf, len, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent <= 0) {
+            return -1;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+static void serve(int fd) {
+    /* Only our own user and root may change things. */
+    struct ucred cred;
+    socklen_t cred_sz = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &cred_sz) != 0 ||
+            (cred.uid != 0 && cred.uid != getuid())) {
+        LOG("Refusing control connection");
+        return;
+    }
+    struct timeval tv = { .tv_sec = CONTROL_TIMEOUT };
+    (void)setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    char line[CONTROL_MAX_COMMAND + 1];
+    size_t len = 0;
+    while (len < CONTROL_MAX_COMMAND && memchr(line, '\n', len) == NULL) {
+        ssize_t got = recv(fd, line + len, CONTROL_MAX_COMMAND - len, 0);
+        if (got < 0 && errno == EINTR) {
+            continue;
+        } else if (got < 0) {
+            return;
+        } else if (got == 0) {
+            break;
+        }
+        len += got;
+    }
+    line[len] = '\0';
+    char *nl = strchr(line, '\n');
+    if (nl != NULL) {
+        *nl = '\0';
+    }
+
+    int argc = 0;
+    char *argv[CONTROL_MAX_ARGS];
+    char *save;
+    char *word = strtok_r(line, " \t\r", &save);
+    while (word != NULL && argc < CONTROL_MAX_ARGS) {
+        argv[argc++] = word;
+        word = strtok_r(NULL, " \t\r", &save);
+    }
+    LOG("Control command %s", argc > 0 ? argv[0] : "(none)");
+
+    char *out = NULL;
+    size_t out_sz = 0;
+    FILE *reply = open_memstream(&out, &out_sz);
+    if (reply == NULL) {
+        return;
+    }
+    const char *err = word != NULL ? "too many arguments" :
+        execute(argc, argv, reply);
+    fclose(reply);
+
+    char status[256];
+    snprintf(status, sizeof(status), err == NULL ? "ok\n" : "error: %s\n",
+        err);
+    if (send_all(fd, status, strlen(status)) == 0) {
+        (void)send_all(fd, out, out_sz);
+    }
+    free(out);
+}
+
+static void *control_main(void *arg) {
+    while (1) {
+        int fd = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+        if (fd == -1 && (errno == EINTR || errno == ECONNABORTED)) {
+            continue;
+        } else if (fd == -1) {
+            /* control_stop() shut the socket down. */
+            break;
+        }
+        serve(fd);
+        (void)close(fd);
+    }
+    return NULL;
+}
+
+int control_start(void) {
+    if (sock == -1 || running) {
+        return 0;
+    }
+    if (pthread_create(&thread, NULL, control_main, NULL) != 0) {
+        return -1;
+    }
+    running = 1;
+    return 0;
+}
+
+void control_stop(void) {
+    if (sock == -1) {
+        return;
+    }
+    /* Wakes the thread from accept(). */
+    (void)shutdown(sock, SHUT_RDWR);
+    if (running) {
+        pthread_join(thread, NULL);
+        running = 0;
+    }
+    /* Lets refreshes in progress finish. */
+    workq_destroy(refreshers);
+    refreshers = NULL;
+    (void)close(sock);
+    sock = -1;
+    (void)unlink(sock_path);
+    free(sock_path);
+    sock_path = NULL;
+}
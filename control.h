@@ -0,0 +1,37 @@
+#ifndef _EXECFS_CONTROL_H_
+#define _EXECFS_CONTROL_H_
+
+/* A unix-domain socket through which a running execfs can be inspected and
+ * tuned (see tools/execfsctl.c). Each connection carries one command line and
+ * gets one reply, whose first line is "ok" or "error: REASON". Commands:
+ *  stats                Statistics, as reported by the stats built-in.
+ *  flush [PATH...]      Drop the cached output of the given entries, or of
+ *                       every entry.
+ *  refresh PATH...      Run the commands of globally cached entries in the
+ *                       background and replace their output. Other cached
+ *                       entries are flushed.
+ *  log on|off           Resume or pause logging.
+ *  set NAME VALUE       Change a limit: cache-size, cache-max-object,
+ *                       prefetch, prefetch-workers or schedule-workers.
+ *  reload               Read every configuration file again.
+ * PATH is an entry's path as written in its configuration file, and applies
+ * to that entry in every mount. Only the owner of the process and root may
+ * connect.
+ */
+
+#include <stddef.h>
+
+#include "mount.h"
+
+/* Create the socket at path for the given mounts, replacing any stale socket
+ * left there. Returns 0 on success.
+ */
+int control_open(const char *path, mount_t **mounts, size_t mounts_sz);
+
+/* Start and stop answering commands. control_start() does nothing if
+ * control_open() wasn't called. control_stop() also removes the socket.
+ */
+int control_start(void);
+void control_stop(void);
+
+#endif
@@ -2,9 +2,56 @@
 #define _EXECFS_ENTRY_H_
 
 #include <stddef.h>
+#include <stdint.h>
+#include <time.h>
 #include <unistd.h>
 
+#include "compress.h"
+
+/* How the command behind an entry is connected to the file. */
+typedef enum {
+    /* Plain pipes. Reads return whatever the command has emitted so far. */
+    MODE_STREAM,
+    /* A single socket for read/write opens. Each write is a request and the
+     * following read returns the command's complete response.
+     */
+    MODE_INTERACTIVE,
+} entry_mode_t;
+
+/* What produces the contents of an entry. */
+typedef enum {
+    /* command is run by the shell. */
+    KIND_COMMAND,
+    /* command is one of the built-ins in builtin.h, evaluated in-process. */
+    KIND_BUILTIN,
+    /* command names a shared-object plugin (see execfs_plugin.h). */
+    KIND_PLUGIN,
+    /* command is a Lua script (see script.h). */
+    KIND_SCRIPT,
+} entry_kind_t;
+
+/* Which opens may share cached output of an entry (see cache.h). */
+typedef enum {
+    CACHE_NONE,    /* Output isn't cached. */
+    CACHE_GLOBAL,  /* Every open shares one output. */
+    CACHE_UID,     /* Partitioned by the opener's uid. */
+    CACHE_GID,     /* Partitioned by the opener's gid. */
+    CACHE_PIDTREE, /* Partitioned by the opener's session. */
+    CACHE_ENV,     /* Partitioned by an environment variable of the opener. */
+} cache_policy_t;
+
+struct builtin;
+struct plugin;
+struct profile_totals;
+struct script;
+
 typedef struct {
+    /* References held by the mount's entry table and by everything that may
+     * outlive its place there: open files, cached output, running commands
+     * and background jobs. Updated atomically (see config.h).
+     */
+    unsigned int refs;
+
     char *path;
     int u_r : 1;
     int u_w : 1;
@@ -16,6 +63,82 @@ typedef struct {
     int o_w : 1;
     int o_x : 1;
     char *command;
+
+    entry_kind_t kind;
+    struct builtin *builtin; /* Parsed command of KIND_BUILTIN entries. */
+    struct plugin *plugin; /* Loaded plugin of KIND_PLUGIN entries. */
+    struct script *script; /* Compiled script of KIND_SCRIPT entries. */
+    /* Environment template for KIND_COMMAND entries (see spawn.h). */
+    char **envp;
+    size_t envp_sz;
+
+    cache_policy_t cache_policy;
+    char *cache_env; /* Variable partitioning CACHE_ENV entries. */
+    time_t cache_ttl; /* Seconds before cached output is stale, 0 for never. */
+    int cache_pin; /* Never evict cached output to make room. */
+    codec_t cache_codec; /* How cached output is stored. */
+    /* Set once a reload has replaced the entry. Opens that found it before
+     * then no longer share output. Protected by the cache.
+     */
+    int cache_retired;
+    /* Seconds between scheduled runs refreshing the cached output, 0 for
+     * none (see schedule.h).
+     */
+    time_t every;
+    /* Digest of the output the kernel may hold pages of, for CACHE_GLOBAL
+     * entries.
+     */
+    uint64_t page_digest;
+
+    /* Spool output into a memfd at open instead of streaming it. */
+    int spool;
+    /* Size of the most recently spooled output, reported by getattr. */
+    size_t spool_size;
+
+    /* Children to keep started and waiting for read-only opens (see
+     * standby.h).
+     */
+    int standby;
+    /* Feed every open for writing into one shared child (see sink.h). */
+    int sink;
+
+    /* Failed runs of the command, how many of them since the last success,
+     * the last one's exit status and, in monotonic milliseconds, when opens
+     * stop being refused. Protected by the reaper (see reap.h).
+     */
+    unsigned long long failures;
+    unsigned int fail_streak;
+    int fail_status;
+    uint64_t fail_until;
+    /* When the command was last started, in nanoseconds since the epoch,
+     * and the status of the last run to exit, if exits is nonzero. Also
+     * protected by the reaper.
+     */
+    uint64_t last_run_ns;
+    unsigned long long exits;
+    int last_status;
+    /* Successful opens and the total time they took, updated atomically
+     * (see xattr.h).
+     */
+    unsigned long long opens;
+    unsigned long long open_ns;
+    /* Totals of operations on the entry with --profile (see profile.h). */
+    struct profile_totals *profile;
+    /* Id of the entry in the binary log, or 0 until it first appears there
+     * (see binlog.h). Protected by the log.
+     */
+    uint32_t log_id;
+
+    entry_mode_t mode;
+    /* Interactive mode only. A response is complete when the command has
+     * emitted delimiter or has been silent for idle_ms milliseconds. The first
+     * byte of a response is waited for indefinitely, unless idle was given
+     * explicitly, in which case reply_ms is also idle_ms.
+     */
+    char *delimiter;
+    size_t delimiter_len;
+    int idle_ms;
+    int reply_ms;
 } entry_t;
 
 #endif
@@ -0,0 +1,207 @@
+/* Captured stderr of commands. */
+
+#define _GNU_SOURCE /* pipe2() */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "entry.h"
+#include "errbuf.h"
+#include "log.h"
+#include "poller.h"
+
+/* Most bytes read from one pipe each time it is ready, so a command spewing
+ * errors can't hold up the poller's other watches.
+ */
+#define DRAIN_CHUNK 4096
+#define DRAIN_MAX ERRBUF_SIZE
+
+typedef struct {
+    entry_t *entry;
+    char data[ERRBUF_SIZE];
+    size_t start; /* Offset of the oldest byte. */
+    size_t used;
+    /* Whether anything has been overwritten, in which case the oldest line
+     * is probably cut short.
+     */
+    int wrapped;
+} ring_t;
+
+/* Protects everything below. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static ring_t **rings = NULL;
+static size_t rings_sz = 0;
+static errbuf_stats_t stats;
+
+int errbuf_pipe(int fds[2]) {
+    if (!poller_running() || pipe2(fds, O_CLOEXEC) != 0) {
+        return -1;
+    }
+    /* Only our end. The child's stderr must block as usual. */
+    (void)fcntl(fds[0], F_SETFL, O_NONBLOCK);
+    return 0;
+}
+
+/* Called with lock held. Returns NULL if out of memory. */
+static ring_t *find_ring(entry_t *e) {
+    size_t i;
+    for (i = 0; i < rings_sz; ++i) {
+        if (rings[i]->entry == e) {
+            return rings[i];
+        }
+    }
+    ring_t **tmp = realloc(rings, sizeof(ring_t*) * (rings_sz + 1));
+    if (tmp == NULL) {
+        return NULL;
+    }
+    rings = tmp;
+    ring_t *r = calloc(1, sizeof(*r));
+    if (r == NULL) {
+        return NULL;
+    }
+    r->entry = e;
+    rings[rings_sz++] = r;
+    stats.entries++;
+    return r;
+}
+
+static void append(entry_t *e, const char *buf, size_t size) {
+    pthread_mutex_lock(&lock);
+    stats.bytes += size;
+    ring_t *r = find_ring(e);
+    if (r == NULL) {
+        stats.dropped += size;
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    if (size > ERRBUF_SIZE) {
+        stats.dropped += size - ERRBUF_SIZE;
+        buf += size - ERRBUF_SIZE;
+        size = ERRBUF_SIZE;
+        r->wrapped = 1;
+    }
+    if (r->used + size > ERRBUF_SIZE) {
+        /* Make room by dropping the oldest bytes. */
+        size_t drop = r->used + size - ERRBUF_SIZE;
+        r->start = (r->start + drop) % ERRBUF_SIZE;
+        r->used -= drop;
+        r->wrapped = 1;
+        stats.dropped += drop;
+    }
+    size_t end = (r->start + r->used) % ERRBUF_SIZE;
+    size_t first = ERRBUF_SIZE - end < size ? ERRBUF_SIZE - end : size;
+    memcpy(r->data + end, buf, first);
+    memcpy(r->data, buf + first, size - first);
+    r->used += size;
+    pthread_mutex_unlock(&lock);
+}
+
+static void drain(int fd, short revents, void *arg) {
+    entry_t *e = arg;
+    if (revents == 0) {
+        /* The poller is stopping. */
+        close(fd);
+        entry_release(e);
+        return;
+    }
+    char buf[DRAIN_CHUNK];
+    size_t total = 0;
+    ssize_t sz = 0;
+    while (total < DRAIN_MAX && (sz = read(fd, buf, sizeof(buf))) > 0) {
+        append(e, buf, sz);
+        total += sz;
+    }
+    if ((sz > 0 || (sz == -1 && (errno == EAGAIN || errno == EINTR))) &&
+            poller_watch(fd, POLLIN, drain, e) == 0) {
+        return;
+    }
+    /* The child and any of its own children have closed stderr. */
+    close(fd);
+    entry_release(e);
+}
+
+void errbuf_watch(entry_t *e, int fd) {
+    assert(e != NULL);
+    entry_hold(e);
+    if (poller_watch(fd, POLLIN, drain, e) != 0) {
+        LOG("Failed to capture stderr of %s", e->command);
+        close(fd);
+        entry_release(e);
+    }
+}
+
+void errbuf_forget(entry_t *e) {
+    assert(e != NULL);
+    pthread_mutex_lock(&lock);
+    size_t i;
+    for (i = 0; i < rings_sz; ++i) {
+        if (rings[i]->entry == e) {
+            free(rings[i]);
+            rings[i] = rings[--rings_sz];
+            stats.entries--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Copy r into out, dropping a line cut short by wrapping. Called with lock
+ * held. Returns the number of bytes copied.
+ */
+static size_t copy_ring(ring_t *r, char *out) {
+    size_t first = ERRBUF_SIZE - r->start < r->used ?
+        ERRBUF_SIZE - r->start : r->used;
+    memcpy(out, r->data + r->start, first);
+    memcpy(out + first, r->data, r->used - first);
+    size_t len = r->used;
+    char *nl = r->wrapped ? memchr(out, '\n', len) : NULL;
+    if (nl != NULL) {
+        len -= nl + 1 - out;
+        memmove(out, nl + 1, len);
+    }
+    return len;
+}
+
+char *errbuf_read(const char *path, size_t *len) {
+    assert(path != NULL);
+    assert(len != NULL);
+    if (*path == '/') {
+        path++;
+    }
+    pthread_mutex_lock(&lock);
+    size_t i, total = 0;
+    for (i = 0; i < rings_sz; ++i) {
+        if (!strcmp(rings[i]->entry->path, path)) {
+            total += rings[i]->used;
+        }
+    }
+    /* Never empty, so NULL only means out of memory. */
+    char *out = malloc(total + 1);
+    if (out == NULL) {
+        pthread_mutex_unlock(&lock);
+        return NULL;
+    }
+    *len = 0;
+    for (i = 0; i < rings_sz; ++i) {
+        if (!strcmp(rings[i]->entry->path, path)) {
+            *len += copy_ring(rings[i], out + *len);
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return out;
+}
+
+void errbuf_get_stats(errbuf_stats_t *out) {
+    assert(out != NULL);
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
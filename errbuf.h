@@ -0,0 +1,47 @@
+#ifndef _EXECFS_ERRBUF_H_
+#define _EXECFS_ERRBUF_H_
+
+/* Captured stderr of commands. Instead of inheriting execfs's stderr, which
+ * is /dev/null once it daemonises, each command writes its stderr into a pipe
+ * that the poller thread drains into a ring buffer belonging to the command's
+ * entry. Only the last ERRBUF_SIZE bytes of each entry are kept, and nothing
+ * is allocated for entries whose commands never write to stderr. The stderr
+ * built-in and the control socket show what was captured.
+ */
+
+#include <stddef.h>
+
+#include "entry.h"
+
+/* Bytes of stderr kept per entry. */
+#define ERRBUF_SIZE (16 * 1024)
+
+/* Create a pipe for a child's stderr, readable end first. Returns -1 if
+ * stderr can't be captured at the moment, such as before the poller has
+ * started, in which case the child should keep ours.
+ */
+int errbuf_pipe(int fds[2]);
+
+/* Drain fd, the readable end of a pipe from errbuf_pipe(), into e's ring
+ * until the child closes its end. Takes ownership of fd, and holds a
+ * reference to e until then.
+ */
+void errbuf_watch(entry_t *e, int fd);
+
+/* Free e's ring, as e is being freed. */
+void errbuf_forget(entry_t *e);
+
+/* Copy the stderr captured from the commands of every entry at path, oldest
+ * first, into a malloced buffer. Returns NULL if out of memory.
+ */
+char *errbuf_read(const char *path, size_t *len);
+
+typedef struct {
+    unsigned long long bytes;   /* Captured in total. */
+    unsigned long long dropped; /* Overwritten by newer output. */
+    size_t entries;             /* Entries with a ring. */
+} errbuf_stats_t;
+
+void errbuf_get_stats(errbuf_stats_t *out);
+
+#endif
@@ -0,0 +1,40 @@
+#ifndef _EXECFS_PLUGIN_H_
+#define _EXECFS_PLUGIN_H_
+
+/* Interface implemented by shared-object plugins. A plugin entry looks like
+ *  path|444,plugin|/path/to/library.so:symbol optional arguments
+ * where symbol names an execfs_plugin_t in the library. The library is loaded
+ * when the configuration is read and its functions are called directly from
+ * FUSE worker threads, possibly concurrently for different opens, so they
+ * need to be thread-safe.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* Bump when the layout of execfs_plugin_t changes. */
+#define EXECFS_PLUGIN_ABI 1
+
+typedef struct {
+    /* Must be EXECFS_PLUGIN_ABI. */
+    int abi;
+
+    /* Called for each open of the entry. args is everything after the symbol
+     * name in the configuration (possibly ""), path is the entry's path in
+     * the mount point and flags are the open flags. Store any per-open state
+     * in *ctx. Return 0 on success or a negative errno.
+     */
+    int (*open)(const char *args, const char *path, int flags, void **ctx);
+
+    /* Read or write at offset. Return the number of bytes transferred (0 for
+     * end of file) or a negative errno. Either may be NULL, in which case
+     * opening the entry in that direction fails.
+     */
+    ssize_t (*read)(void *ctx, char *buf, size_t size, off_t offset);
+    ssize_t (*write)(void *ctx, const char *buf, size_t size, off_t offset);
+
+    /* Called when the file is closed. May be NULL. */
+    void (*release)(void *ctx);
+} execfs_plugin_t;
+
+#endif
@@ -1,21 +1,46 @@
 /* Implementations of all the FUSE operations for this file system. */
 
+/* For memmem(). */
+#define _GNU_SOURCE
+
 /* Use newer version of FUSE API. */
 #define FUSE_USE_VERSION 26
 #include <fuse.h>
 
 #include <errno.h>
 #include <limits.h>
+#include <poll.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/socket.h>
 #include <sys/stat.h>
 #include <time.h>
 
+#include "binlog.h"
+#include "builtin.h"
+#include "control.h"
+#include "cache.h"
+#include "config.h"
 #include "entry.h"
 #include "fileops.h"
 #include "globals.h"
+#include "handle.h"
 #include "log.h"
+#include "mount.h"
+#include "plugin.h"
+#include "poller.h"
+#include "prefetch.h"
+#include "profile.h"
+#include "reap.h"
+#include "schedule.h"
+#include "script.h"
+#include "sink.h"
+#include "spawn.h"
+#include "standby.h"
+#include "trace.h"
+#include "xattr.h"
 
 /* All the functions in this file are invoked as FUSE callbacks, which results
  * in assertion failures being invisible to the user. To provide meaningful
@@ -41,9 +66,6 @@
 
 #define RIGHTS_MASK 0x3
 
-/* Shell to use when opening a file read/write. */
-#define SHELL "/bin/sh"
-
 /* Whether this path is the root of the mount point. */
 static int is_root(const char *path) {
     return !strcmp("/", path);
@@ -53,6 +75,9 @@ static int is_root(const char *path) {
  * implementing a file system that will be under heavy load, but we assume that
  * there will be few entries in the file system and these will not be accessed
  * frequently.
+ *
+ * Returns the entry held (see config.h), as a reload may replace it at any
+ * moment, or NULL if there is none.
  */
 static entry_t *find_entry(const char *path) {
     if (path[0] != '/') {
@@ -60,13 +85,26 @@ static entry_t *find_entry(const char *path) {
         return NULL;
     }
 
-    int i;
-    for (i = 0; i < entries_sz; ++i) {
-        if (!strcmp(path + 1, entries[i]->path)) {
-            return entries[i];
+    mount_t *m = mount_current();
+    entry_t *e = NULL;
+    size_t i;
+    pthread_rwlock_rdlock(&m->lock);
+    for (i = 0; i < m->entries_sz; ++i) {
+        if (!strcmp(path + 1, m->entries[i]->path)) {
+            e = m->entries[i];
+            entry_hold(e);
+            break;
         }
     }
-    return NULL;
+    pthread_rwlock_unlock(&m->lock);
+    return e;
+}
+
+/* Whether there is an entry at path. */
+static int exists(const char *path) {
+    entry_t *e = find_entry(path);
+    entry_release(e);
+    return e != NULL;
 }
 
 /* Determine the permissions of a given file in the context of the user
@@ -92,10 +130,69 @@ static unsigned int access_rights(entry_t *entry) {
     return rights;
 }
 
+/* Mounts that have been initialised but not yet destroyed. */
+static pthread_mutex_t mounted_lock = PTHREAD_MUTEX_INITIALIZER;
+static int mounted = 0;
+
+/* Called when the file system is mounted. Threads are started here rather than
+ * in main() because FUSE forks when it daemonises and only the calling thread
+ * survives that.
+ */
+static void *exec_init(struct fuse_conn_info *conn) {
+    mount_t *m = mount_current();
+    LOG("init called (mounting %s)", m->config);
+    /* Let FUSE splice file-backed replies (see exec_read_buf()). */
+    conn->want |= conn->capable & FUSE_CAP_SPLICE_WRITE;
+
+    /* The threads are shared by every mount in the process. */
+    pthread_mutex_lock(&mounted_lock);
+    if (mounted++ == 0) {
+        if (reap_start() != 0) {
+            LOG("Failed to start reaper thread");
+        }
+        if (poller_start() != 0) {
+            /* Not fatal. poll() will just report files as always ready. */
+            LOG("Failed to start poller thread");
+        }
+        if (prefetch_start() != 0) {
+            LOG("Failed to start prefetch threads");
+        }
+        if (control_start() != 0) {
+            LOG("Failed to start control thread");
+        }
+    }
+    pthread_mutex_unlock(&mounted_lock);
+    if (schedule_add(m->entries, m->entries_sz, uid, gid) != 0) {
+        LOG("Failed to start schedule thread");
+    }
+    if (standby_add(m->entries, m->entries_sz) != 0) {
+        LOG("Failed to start standby thread");
+    }
+    /* The kernel holds back the mount's requests until this returns. */
+    prefetch_prewarm(m->entries, m->entries_sz, uid, gid);
+    /* Becomes the private data of every request to this mount. */
+    return m;
+}
+
 /* Called when the file system is unmounted. */
 static void exec_destroy(void *private_data) {
-    LOG("destroy called (unmounting file system)");
-    log_close();
+    mount_t *m = private_data;
+    LOG("destroy called (unmounting %s)", m->config);
+    pthread_mutex_lock(&mounted_lock);
+    if (--mounted == 0) {
+        control_stop();
+        standby_stop();
+        sink_stop();
+        schedule_stop();
+        prefetch_stop();
+        poller_stop();
+        reap_stop();
+        profile_dump();
+        trace_stop();
+        binlog_close();
+        log_close();
+    }
+    pthread_mutex_unlock(&mounted_lock);
 }
 
 static int exec_flush(const char *path, struct fuse_file_info *fi) {
@@ -104,8 +201,7 @@ static int exec_flush(const char *path, struct fuse_file_info *fi) {
         return 0;
     }
 
-    entry_t *e = find_entry(path);
-    if (e == NULL) {
+    if (!exists(path)) {
         return -ENOENT;
     }
 
@@ -121,8 +217,7 @@ static int exec_fsync(const char *path, int datasync, struct fuse_file_info *fi)
         return 0;
     }
 
-    entry_t *e = find_entry(path);
-    if (e == NULL) {
+    if (!exists(path)) {
         return -ENOENT;
     }
 
@@ -181,79 +276,164 @@ static int exec_getattr(const char *path, struct stat *stbuf) {
             | (e->o_w ? S_IWOTH : 0)
             | (e->o_x ? S_IXOTH : 0);
         stbuf->st_size = size;
+        if (e->spool && e->spool_size > 0) {
+            /* Our best guess until the file is opened. */
+            stbuf->st_size = e->spool_size;
+        }
+
+        /* If everyone is served the same cached output, we know exactly how
+         * big the file is. The kernel keeps one set of attributes per file,
+         * so the output of a partitioned entry mustn't show through here:
+         * the next caller would be told the size of someone else's.
+         */
+        if (e->cache_policy == CACHE_GLOBAL) {
+            struct fuse_context *context = fuse_get_context();
+            char *key = cache_key(e, context->uid, context->gid, context->pid);
+            cache_obj_t *o = key == NULL ? NULL : cache_peek(e, key);
+            if (o != NULL) {
+                stbuf->st_size = cache_size(o);
+                stbuf->st_mtime = stbuf->st_ctime = cache_mtime(o);
+                cache_release(o);
+            }
+            free(key);
+        }
         stbuf->st_nlink = 1;
+        entry_release(e);
     }
 
     return 0;
 }
 
-/* Basically popen(path, "rw"), but popen doesn't let you do this. */
-static int popen_rw(const char *path, uint64_t *handle) {
-    /* What we're going to do is create two pipes that we'll use as the read
-     * and write file descriptors. Stdout and stdin, repsectively, in the
-     * opened process need to connect to these pipes.
-     */
-    int input[2], output[2];
-    if (pipe(input) != 0 || pipe(output) != 0) {
-        return -1;
+/* Like exec_getattr(), but for an open file, so the size reported can be that
+ * of the output this open is actually reading. This is what lets programs
+ * fstat() a spooled file and then map all of it.
+ */
+static int exec_fgetattr(const char *path, struct stat *stbuf, struct fuse_file_info *fi) {
+    assert(fi != NULL);
+    int err = exec_getattr(path, stbuf);
+    if (err != 0 || is_root(path)) {
+        return err;
     }
+    handle_t *h = HANDLE(fi);
+    if (h == NULL) {
+        return 0;
+    }
+    if (h->spoolfd != -1) {
+        stbuf->st_size = h->spool_sz;
+    } else if (h->cached != NULL && h->entry->cache_policy == CACHE_GLOBAL) {
+        stbuf->st_size = cache_size(h->cached);
+        stbuf->st_mtime = stbuf->st_ctime = cache_mtime(h->cached);
+    } else if (h->builtin != NULL) {
+        stbuf->st_size = builtin_size(h->builtin);
+    } else if (h->entry->kind == KIND_SCRIPT) {
+        stbuf->st_size = h->output_sz;
+    }
+    return 0;
+}
 
-    /* Flush standard streams to avoid aberrations after forking. This
-     * shouldn't really be required as we aren't using any of these anyway.
-     */
-    fflush(stdout); fflush(stderr); fflush(stdin);
-
-    pid_t pid = fork();
-    if (pid == -1) {
-        LOG("Failed to fork");
-        close(input[0]);
-        close(input[1]);
-        close(output[0]);
-        close(output[1]);
-        return -1;
-    } else if (pid == 0) {
-        /* We are the child. */
-
-        /* Close the ends of the pipe we don't need. */
-        close(input[1]); close(output[0]);
-
-        /* Overwrite our stdin and stdout such that they connect to the pipes.
-         */
-        if (dup2(input[0], STDIN_FILENO) < 0 || dup2(output[1], STDOUT_FILENO) < 0) {
-            LOG("Failed to overwrite stdin/stdout after forking");
-            exit(1);
+/* Read one response from an interactive command. The first byte is waited for
+ * up to reply_ms, after which the response ends at the first occurrence of the
+ * entry's delimiter, after idle_ms of silence, when the command exits or when
+ * buf is full. Output beyond the delimiter is left in the socket for the next
+ * read.
+ */
+static ssize_t read_response(entry_t *e, int fd, char *buf, size_t size) {
+    size_t got = 0;
+
+    while (got < size) {
+        struct pollfd p = { .fd = fd, .events = POLLIN };
+        int ready = poll(&p, 1, got == 0 ? e->reply_ms : e->idle_ms);
+        if (ready == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return got > 0 ? (ssize_t)got : -1;
+        } else if (ready == 0) {
+            /* The command went quiet, so assume it has finished answering,
+             * or that it has nothing to say to this request.
+             */
+            break;
+        }
+
+        ssize_t sz = recv(fd, buf + got, size - got, MSG_PEEK);
+        if (sz == -1) {
+            return got > 0 ? (ssize_t)got : -1;
+        } else if (sz == 0) {
+            /* The command exited. */
+            break;
         }
 
-        /* Overwrite our image with the command to execute. Note that exec will
-         * only return if it fails.
+        /* Look for the delimiter, including any part of it that straddles
+         * what we had already consumed.
          */
-        (void)execl(SHELL, "sh", "-c", path, NULL);
-        LOG("Exec failed");
-        exit(1);
-    } else {
-        /* We are the parent. */
-        LOG("Forked off child %d to run %s", pid, path);
+        size_t start = got >= e->delimiter_len - 1 ?
+            got - (e->delimiter_len - 1) : 0;
+        char *match = memmem(buf + start, got + sz - start, e->delimiter,
+            e->delimiter_len);
+        size_t want = match == NULL ? (size_t)sz :
+            (size_t)(match - buf) + e->delimiter_len - got;
 
-        /* Close the ends of the pipe we don't need. */
-        close(input[0]); close(output[1]);
+        sz = recv(fd, buf + got, want, 0);
+        if (sz == -1) {
+            return got > 0 ? (ssize_t)got : -1;
+        }
+        got += sz;
+        if (match != NULL && (size_t)sz == want) {
+            break;
+        }
+    }
+    return got;
+}
 
-        /* Pack the file descriptors we do need into the handle. */
-        assert(handle != NULL);
-        *handle = (((uint64_t)input[1]) << 32) | (uint64_t)output[0];
-        return 0;
+/* Warm the cache for the entries following e in readdir order, which a reader
+ * scanning the directory is likely to open next.
+ */
+static void prefetch_after(entry_t *e) {
+    unsigned int n = prefetch_depth();
+    if (n == 0) {
+        return;
+    }
+    struct fuse_context *context = fuse_get_context();
+    spawn_context_t sc = {
+        .uid = context->uid,
+        .gid = context->gid,
+        .pid = context->pid,
+        .flags = O_RDONLY,
+    };
+    mount_t *m = mount_current();
+    size_t i = 0;
+    pthread_rwlock_rdlock(&m->lock);
+    while (i < m->entries_sz && m->entries[i] != e) {
+        i++;
     }
-    assert(!"Unreachable");
+    for (++i; i < m->entries_sz && n > 0; ++i) {
+        entry_t *next = m->entries[i];
+        if (prefetch_eligible(next) && (access_rights(next) & R)) {
+            prefetch_queue(next, &sc);
+            n--;
+        }
+    }
+    pthread_rwlock_unlock(&m->lock);
 }
 
-static int exec_open(const char *path, struct fuse_file_info *fi) {
-    assert(fi != NULL);
-    LOG("open called on %s with flags %d", path, fi->flags);
-    entry_t *e = find_entry(path);
-    if (e == NULL) {
-        return -ENOENT;
+/* Whether an open must not run e's command because it has been failing. */
+static int refused(entry_t *e, const char *path) {
+    if (!reap_refuse(e)) {
+        return 0;
     }
+    LOG("Refusing to open %s while its command backs off", path);
+    return 1;
+}
 
+/* Open e, found at path. On success the handle takes over the caller's hold
+ * on e.
+ */
+static int open_entry(entry_t *e, const char *path, struct fuse_file_info *fi,
+        trace_request_t *t) {
+    assert(e != NULL);
+    assert(fi != NULL);
     unsigned int entry_rights = access_rights(e);
+    trace_phase(t, TRACE_PERMISSION);
     unsigned int rights = fi->flags & RIGHTS_MASK;
 
     if (((rights == O_RDONLY || rights == O_RDWR) && !(entry_rights & R)) ||
@@ -261,69 +441,511 @@ static int exec_open(const char *path, struct fuse_file_info *fi) {
         return -EACCES;
     }
 
+    prefetch_after(e);
+
     LOG("Opening %s (%s) for %s", path, e->command,
         rights == O_RDONLY ? "read" :
         rights == O_WRONLY ? "write" : "read/write");
 
-/* We're about to pack two file descriptors (ints) into a uint64_t, so let's
- * check (at compile time) that they'll actually fit.
- */
-typedef char _two_ints_fit_in_a_uint64_t
-    [sizeof(uint64_t) >= 2 * sizeof(int) ? 1 : -1];
-
-    /* Open the pipe and put the file descriptor in the low 32 bits of fi->fh
-     * if it's open for reading and the high 32 bits if it's open for writing.
-     * The reason for this is because we'll need two separate file descriptors
-     * to do a read/write pipe, in which case we can pack them both into
-     * fi->fh. Kind of handy that FUSE gives us 64 bits for a handle.
-     */
-    FILE *f;
-    if (rights == O_RDONLY) {
-        f = popen(e->command, "r");
-        if (f == NULL) {
-            LOG("Failed to popen %s for reading", e->command);
-            return -EBADF;
-        }
-        fi->fh = (uint64_t)fileno(f); /* Low 32 bits. */
-    } else if (rights == O_WRONLY) {
-        f = popen(e->command, "w");
-        if (f == NULL) {
-            LOG("Failed to popen %s for writing", e->command);
-            return -EBADF;
-        }
-        fi->fh = ((uint64_t)fileno(f)) << 32; /* High 32 bits */
-    } else {
-        /* Opening a file for read/write is a bit more complicated because
-         * popen doesn't let us do this directly.
-         */
-        if (popen_rw(e->command, &(fi->fh)) != 0) {
-            LOG("Failed to open %s for read/write", e->command);
-            return -EBADF;
+    handle_t *h = malloc(sizeof(*h));
+    if (h == NULL) {
+        return -ENOMEM;
+    }
+    h->entry = e;
+    h->readfd = h->writefd = -1;
+    h->pid = -1;
+    h->builtin = NULL;
+    h->cached = NULL;
+    h->spoolfd = -1;
+    h->spool_sz = 0;
+    h->plugin_ctx = NULL;
+    h->sink = NULL;
+    h->output = NULL;
+    h->output_sz = 0;
+    h->waiter = NULL;
+    h->trace = t;
+
+    if (e->kind == KIND_BUILTIN) {
+        if (rights != O_RDONLY) {
+            free(h);
+            return -EACCES;
+        }
+        h->builtin = builtin_open(e->builtin);
+        if (h->builtin == NULL) {
+            LOG("Failed to evaluate built-in %s", e->command);
+            free(h);
+            return -errno;
+        }
+        LOG("Built-in %s produced %zu bytes", e->command,
+            builtin_size(h->builtin));
+        fi->fh = (uint64_t)(uintptr_t)h;
+        return 0;
+    } else if (e->kind == KIND_PLUGIN) {
+        int err = plugin_open(e->plugin, path, fi->flags, &h->plugin_ctx);
+        if (err != 0) {
+            LOG("Plugin %s failed to open with error %d", e->command, -err);
+            free(h);
+            return err;
+        }
+        fi->fh = (uint64_t)(uintptr_t)h;
+        return 0;
+    } else if (e->kind == KIND_SCRIPT) {
+        if (rights != O_RDONLY) {
+            free(h);
+            return -EACCES;
+        }
+        struct fuse_context *context = fuse_get_context();
+        int err = script_run(e->script, path, context->uid, context->gid,
+            context->pid, &h->output, &h->output_sz);
+        if (err != 0) {
+            free(h);
+            return err;
+        }
+        LOG("Script for %s produced %zu bytes", path, h->output_sz);
+        fi->fh = (uint64_t)(uintptr_t)h;
+        return 0;
+    }
+
+    struct fuse_context *context = fuse_get_context();
+    spawn_context_t sc = {
+        .uid = context->uid,
+        .gid = context->gid,
+        .pid = context->pid,
+        .flags = fi->flags,
+    };
+    char *key = NULL;
+    if (e->cache_policy != CACHE_NONE && rights == O_RDONLY) {
+        key = cache_key(e, sc.uid, sc.gid, sc.pid);
+        if (key == NULL && errno == ENOMEM) {
+            free(h);
+            return -ENOMEM;
+        } else if (key == NULL) {
+            /* Nobody else's output can be served to this opener, nor its
+             * output to anybody else, so run the command just for it.
+             */
+            LOG("Can't tell which output of %s to serve, not caching", path);
+            fi->direct_io = 1;
+        }
+    }
+    if (key != NULL) {
+        int fill = 0;
+        h->cached = cache_acquire(e, key, &fill);
+        trace_phase(t, TRACE_CACHE);
+        if (h->cached == NULL) {
+            free(key);
+            free(h);
+            return -ENOMEM;
+        }
+        if (fill && refused(e, path)) {
+            cache_abort(h->cached, 0);
+            free(key);
+            free(h);
+            return -EIO;
+        } else if (fill) {
+            char *data;
+            size_t data_sz;
+            int rest;
+            trace_skip(t);
+            int err = spawn_capture(e, &sc, cache_max_object(), &data,
+                &data_sz, &rest);
+            if (err != -1) {
+                trace_phase(t, TRACE_EXEC);
+            }
+            if (err == -1) {
+                LOG("Failed to capture output of %s", e->command);
+                cache_abort(h->cached, 0);
+                free(key);
+                free(h);
+                return -EIO;
+            } else if (err == 1) {
+                /* Too big to admit. Serve what we have, then the rest
+                 * straight from the command.
+                 */
+                LOG("Output of %s (%s) too large to cache", path, key);
+                cache_abort(h->cached, 1);
+                h->cached = NULL;
+                h->output = data;
+                h->output_sz = data_sz;
+                h->readfd = rest;
+            } else {
+                LOG("Cached %zu bytes of output of %s (%s)", data_sz, path,
+                    key);
+                cache_fill(h->cached, data, data_sz);
+            }
+        } else {
+            LOG("Serving %s (%s) from cache", path, key);
+        }
+        if (e->cache_policy != CACHE_GLOBAL) {
+            /* The kernel caches pages per file, not per partition, so reads
+             * of partitioned output must bypass them altogether. Otherwise
+             * the next opener could be served what this one reads.
+             */
+            fi->direct_io = 1;
+        } else if (h->cached != NULL) {
+            /* Keep the kernel's pages if they hold the very same output,
+             * which is the common case after a refresh that changed nothing.
+             */
+            uint64_t digest = cache_digest(h->cached);
+            uint64_t old = __sync_lock_test_and_set(&e->page_digest, digest);
+            fi->keep_cache = old == digest;
+        }
+        free(key);
+        fi->fh = (uint64_t)(uintptr_t)h;
+        return 0;
+    }
+
+    if (e->sink && rights == O_WRONLY) {
+        if (refused(e, path)) {
+            free(h);
+            return -EIO;
+        }
+        h->sink = sink_open(e);
+        if (h->sink == NULL) {
+            free(h);
+            return -ENOMEM;
+        }
+        LOG("Writing to shared sink of %s", path);
+        fi->fh = (uint64_t)(uintptr_t)h;
+        return 0;
+    }
+
+    if (refused(e, path)) {
+        free(h);
+        return -EIO;
+    }
+
+    if (e->spool && rights == O_RDONLY) {
+        trace_skip(t);
+        h->spoolfd = spawn_spool(e, &sc);
+        struct stat st;
+        if (h->spoolfd == -1 || fstat(h->spoolfd, &st) != 0) {
+            if (h->spoolfd != -1) {
+                close(h->spoolfd);
+            }
+            free(h);
+            return -EIO;
+        }
+        trace_phase(t, TRACE_EXEC);
+        h->spool_sz = st.st_size;
+        e->spool_size = h->spool_sz;
+        if (!mount_current()->fresh_attrs) {
+            /* The entry became spooled by a reload, so the kernel may go on
+             * using a size it cached before this run. Have reads come to us
+             * rather than stop at that size.
+             */
+            fi->direct_io = 1;
         }
+        LOG("Spooled %zu bytes of output of %s", h->spool_sz, path);
+        fi->fh = (uint64_t)(uintptr_t)h;
+        return 0;
+    }
+
+    trace_skip(t);
+    if (e->standby > 0 && rights == O_RDONLY) {
+        h->pid = standby_take(e, &sc, &h->readfd);
+        if (h->pid != -1) {
+            trace_phase(t, TRACE_SPAWN);
+        }
+    }
+    if (h->pid == -1) {
+        h->pid = spawn_command(e, rights, &sc, &h->readfd, &h->writefd);
+    }
+    if (h->pid == -1) {
+        LOG("Failed to run %s", e->command);
+        free(h);
+        return -EBADF;
+    }
+    if (rights == O_RDWR && e->mode == MODE_INTERACTIVE) {
+        /* Each read() needs to reach us so it can be framed as one response,
+         * rather than being rounded up into page-sized readahead.
+         */
+        fi->direct_io = 1;
+        fi->nonseekable = 1;
     }
-    LOG("Handle %llu returned from popen", fi->fh);
+    fi->fh = (uint64_t)(uintptr_t)h;
+    LOG("Handle %llu (fds %d/%d) returned for child %d", fi->fh, h->readfd,
+        h->writefd, h->pid);
 
     return 0;
 }
 
+static int exec_open(const char *path, struct fuse_file_info *fi) {
+    assert(fi != NULL);
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    trace_request_t *t = trace_start();
+    LOG("open called on %s with flags %d", path, fi->flags);
+    entry_t *e = find_entry(path);
+    trace_phase(t, TRACE_LOOKUP);
+    int err = e == NULL ? -ENOENT : open_entry(e, path, fi, t);
+    if (err == 0) {
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        xattr_opened(e, (end.tv_sec - start.tv_sec) * 1000000000ULL +
+            end.tv_nsec - start.tv_nsec);
+        trace_detach(t);
+        return 0;
+    }
+    if (t != NULL) {
+        trace_finish(t, e == NULL ? NULL : e->path);
+    }
+    entry_release(e);
+    return err;
+}
+
 static int exec_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi) {
     assert(fi != NULL);
     LOG("read of %d bytes from %s with handle %llu", size, path, fi->fh);
 
-    /* 0 is actually a valid file descriptor, but we know it's stdin so there's
-     * no way it can be the one we're about to read from.
-     */
-    assert(fi->fh != 0);
+    handle_t *h = HANDLE(fi);
+    assert(h != NULL);
     assert(size <= SSIZE_MAX); /* read() is undefined when passed >SSIZE_MAX */
-    ssize_t sz = read((int)(fi->fh & ((1ULL << 32) - 1)), buf, size);
+    ssize_t sz;
+    if (h->builtin != NULL) {
+        sz = builtin_read(h->builtin, buf, size, offset);
+    } else if (h->entry->kind == KIND_PLUGIN) {
+        sz = plugin_read(h->entry->plugin, h->plugin_ctx, buf, size, offset);
+        if (sz < 0) {
+            errno = -sz;
+            sz = -1;
+        }
+    } else if (h->cached != NULL) {
+        sz = cache_read(h->cached, buf, size, offset);
+    } else if (h->spoolfd != -1) {
+        sz = pread(h->spoolfd, buf, size, offset);
+    } else if (h->entry->kind == KIND_SCRIPT) {
+        sz = 0;
+        if (offset < h->output_sz) {
+            sz = h->output_sz - offset < size ? h->output_sz - offset : size;
+            memcpy(buf, h->output + offset, sz);
+        }
+    } else if (offset < h->output_sz) {
+        /* Output captured before the command turned out to be too large
+         * to cache.
+         */
+        sz = h->output_sz - offset < size ? h->output_sz - offset : size;
+        memcpy(buf, h->output + offset, sz);
+    } else if (h->readfd == -1) {
+        return -EBADF;
+    } else if (h->entry->mode == MODE_INTERACTIVE && h->readfd == h->writefd) {
+        sz = read_response(h->entry, h->readfd, buf, size);
+    } else {
+        sz = read(h->readfd, buf, size);
+    }
     if (sz == -1) {
-        LOG("read from %s failed with error %d", path, errno);
+        int err = errno;
+        LOG("read from %s failed with error %d", path, err);
+        return -err;
     } else {
         LOG("read from %s returned %d bytes", path, sz);
     }
+    if (sz > 0) {
+        trace_output(h->trace);
+    }
     return sz;
 }
 
+/* Called by FUSE in preference to exec_read(). Built-in output can then hand
+ * its source files over by descriptor, and cached and spooled output their
+ * memfds, so their contents are spliced into the kernel. Everything else is
+ * read into memory as before.
+ */
+static int exec_read_buf(const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset, struct fuse_file_info *fi) {
+    assert(fi != NULL);
+    assert(bufp != NULL);
+    handle_t *h = HANDLE(fi);
+    assert(h != NULL);
+    if (h->builtin != NULL) {
+        LOG("read_buf of %d bytes from %s at offset %lld", size, path,
+            (long long)offset);
+        int err = builtin_read_buf(h->builtin, bufp, size, offset);
+        size_t i;
+        for (i = 0; err == 0 && i < (*bufp)->count; ++i) {
+            if ((*bufp)->buf[i].size > 0) {
+                trace_output(h->trace);
+                break;
+            }
+        }
+        return err;
+    }
+    int fd = -1;
+    size_t total = 0;
+    if (h->cached != NULL && cache_fd(h->cached) != -1) {
+        fd = cache_fd(h->cached);
+        total = cache_size(h->cached);
+    } else if (h->spoolfd != -1) {
+        fd = h->spoolfd;
+        total = h->spool_sz;
+    }
+    if (fd != -1) {
+        /* Let FUSE splice the reply from the memfd's pages. */
+        size_t len = offset >= total ? 0 : total - offset;
+        struct fuse_bufvec *v = malloc(sizeof(*v));
+        if (v == NULL) {
+            return -ENOMEM;
+        }
+        *v = FUSE_BUFVEC_INIT(len < size ? len : size);
+        v->buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+        v->buf[0].fd = fd;
+        v->buf[0].pos = offset;
+        *bufp = v;
+        if (len > 0) {
+            trace_output(h->trace);
+        }
+        return 0;
+    }
+
+    struct fuse_bufvec *v = malloc(sizeof(*v));
+    if (v == NULL) {
+        return -ENOMEM;
+    }
+    *v = FUSE_BUFVEC_INIT(size);
+    v->buf[0].mem = malloc(size);
+    if (v->buf[0].mem == NULL) {
+        free(v);
+        return -ENOMEM;
+    }
+    int sz = exec_read(path, v->buf[0].mem, size, offset, fi);
+    if (sz < 0) {
+        free(v->buf[0].mem);
+        free(v);
+        return sz;
+    }
+    v->buf[0].size = sz;
+    *bufp = v;
+    return 0;
+}
+
+/* A poll() caller waiting to be told that one of a handle's pipes is ready.
+ * A read/write handle has two pipes, so the waiter is shared between two
+ * watches and whichever fires first sends the notification. The handle holds
+ * the last reference, until the next poll() replaces the waiter or the file
+ * is released.
+ */
+typedef struct poll_waiter {
+    struct fuse_pollhandle *ph;
+    int refs;
+    int notified;
+} poll_waiter_t;
+
+/* Protects the waiter of every handle, as poll() may be called concurrently
+ * on the same file.
+ */
+static pthread_mutex_t poll_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void put_waiter(poll_waiter_t *w) {
+    if (__sync_sub_and_fetch(&w->refs, 1) == 0) {
+        fuse_pollhandle_destroy(w->ph);
+        free(w);
+    }
+}
+
+/* Invoked from the poller thread when a child pipe becomes ready, or when the
+ * watch is cancelled.
+ */
+static void notify_poll(int fd, short revents, void *arg) {
+    poll_waiter_t *w = arg;
+    if (revents != 0 && __sync_bool_compare_and_swap(&w->notified, 0, 1)) {
+        LOG("Notifying poll waiter on fd %d (events %#x)", fd, revents);
+        (void)fuse_notify_poll(w->ph);
+    }
+    put_waiter(w);
+}
+
+static int exec_poll(const char *path, struct fuse_file_info *fi, struct fuse_pollhandle *ph, unsigned *reventsp) {
+    assert(fi != NULL);
+    assert(reventsp != NULL);
+    LOG("poll called on %s with handle %llu", path, fi->fh);
+
+    handle_t *h = HANDLE(fi);
+    assert(h != NULL);
+    if (h->builtin != NULL || h->cached != NULL || h->spoolfd != -1 ||
+            h->sink != NULL || h->entry->kind == KIND_PLUGIN ||
+            h->entry->kind == KIND_SCRIPT) {
+        /* Output is produced on demand, so never blocks on a child. Sinks
+         * block writers in write() instead.
+         */
+        *reventsp = POLLIN | POLLOUT;
+        if (ph != NULL) {
+            fuse_pollhandle_destroy(ph);
+        }
+        return 0;
+    }
+
+    struct pollfd p[2];
+    nfds_t n = 0;
+    if (h->readfd != -1) {
+        p[n].fd = h->readfd;
+        p[n++].events = POLLIN;
+    }
+    if (h->writefd != -1) {
+        /* An interactive handle uses the same socket in both directions. */
+        if (n > 0 && p[0].fd == h->writefd) {
+            p[0].events |= POLLOUT;
+        } else {
+            p[n].fd = h->writefd;
+            p[n++].events = POLLOUT;
+        }
+    }
+    assert(n > 0);
+
+    while (poll(p, n, 0) == -1) {
+        if (errno != EINTR) {
+            LOG("poll of %s failed with error %d", path, errno);
+            return -errno;
+        }
+    }
+    unsigned int revents = 0;
+    nfds_t i;
+    for (i = 0; i < n; ++i) {
+        revents |= p[i].revents;
+    }
+    *reventsp = revents;
+
+    if (ph != NULL) {
+        pthread_mutex_lock(&poll_lock);
+        if (h->waiter != NULL) {
+            /* The kernel only wakes callers through the newest poll handle,
+             * so cancel the watches set up for the previous one.
+             */
+            for (i = 0; i < n; ++i) {
+                poller_unwatch(p[i].fd);
+            }
+            put_waiter(h->waiter);
+            h->waiter = NULL;
+        }
+        poll_waiter_t *w = NULL;
+        if (revents == 0) {
+            w = malloc(sizeof(*w));
+        }
+        if (w == NULL) {
+            /* Either already ready, so the caller won't be waiting for a
+             * notification, or we can't arrange one. In the latter case claim
+             * readiness and let the subsequent read/write block instead of
+             * leaving the caller asleep forever.
+             */
+            pthread_mutex_unlock(&poll_lock);
+            if (revents == 0) {
+                LOG("Failed to watch %s for readiness", path);
+                *reventsp = p[0].events;
+            }
+            fuse_pollhandle_destroy(ph);
+            return 0;
+        }
+        w->ph = ph;
+        w->notified = 0;
+        w->refs = n + 1; /* One per watch, plus the handle's. */
+        for (i = 0; i < n; ++i) {
+            if (poller_watch(p[i].fd, p[i].events, notify_poll, w) != 0) {
+                LOG("Failed to watch %s for readiness", path);
+                notify_poll(p[i].fd, p[i].events, w);
+            }
+        }
+        h->waiter = w;
+        pthread_mutex_unlock(&poll_lock);
+    }
+    return 0;
+}
+
 static int exec_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off_t offset, struct fuse_file_info *fi) {
     LOG("readdir called on %s", path);
     if (!is_root(path)) {
@@ -331,28 +953,51 @@ static int exec_readdir(const char *path, void *buf, fuse_fill_dir_t filler, off
         return -EBADF;
     }
 
-    int i;
-    for (i = offset; i < entries_sz; ++i) {
-        if (filler(buf, entries[i]->path, NULL, i + 1) != 0) {
-            return 0;
+    mount_t *m = mount_current();
+    size_t i;
+    pthread_rwlock_rdlock(&m->lock);
+    for (i = offset; i < m->entries_sz; ++i) {
+        if (filler(buf, m->entries[i]->path, NULL, i + 1) != 0) {
+            break;
         }
     }
+    pthread_rwlock_unlock(&m->lock);
     return 0;
 }
 
 static int exec_release(const char *path, struct fuse_file_info *fi) {
     assert(fi != NULL);
     LOG("Releasing %s with handle %llu", path, fi->fh);
-    assert(is_root(path) || find_entry(path) != NULL);
-    assert(fi->fh != 0);
-    int readfd = (int)(fi->fh & ((1ULL << 32) - 1));
-    int writefd = (int)(fi->fh >> 32);
-    if (readfd != 0) { /* File was opened for reading. */
-        (void)close(readfd);
+    /* The entry may have been replaced by a reload since the file was opened,
+     * but the handle still holds the one it was opened with.
+     */
+    handle_t *h = HANDLE(fi);
+    assert(h != NULL);
+    if (h->readfd != -1) { /* File was opened for reading. */
+        poller_unwatch(h->readfd);
+        (void)close(h->readfd);
+    }
+    if (h->writefd != -1 && h->writefd != h->readfd) { /* File was opened for writing. */
+        poller_unwatch(h->writefd);
+        (void)close(h->writefd);
+    }
+    if (h->waiter != NULL) {
+        /* Its watches were cancelled above. */
+        put_waiter(h->waiter);
     }
-    if (writefd != 0) { /* File was opened for writing. */
-        (void)close(writefd);
+    if (h->spoolfd != -1) {
+        (void)close(h->spoolfd);
     }
+    builtin_close(h->builtin);
+    cache_release(h->cached);
+    sink_close(h->sink);
+    free(h->output);
+    if (h->entry->kind == KIND_PLUGIN) {
+        plugin_release(h->entry->plugin, h->plugin_ctx);
+    }
+    trace_finish(h->trace, h->entry->path);
+    entry_release(h->entry);
+    free(h);
     return 0;
 }
 
@@ -360,17 +1005,71 @@ static int exec_write(const char *path, const char *buf, size_t size, off_t offs
     assert(fi != NULL);
     LOG("write of %d bytes to %s with handle %llu", size, path, fi->fh);
 
-    assert(fi->fh != 0);
+    handle_t *h = HANDLE(fi);
+    assert(h != NULL);
     assert(size <= SSIZE_MAX); /* write() is undefined when passed >SSIZE_MAX */
-    ssize_t sz = write((int)(fi->fh >> 32), buf, size);
+    ssize_t sz;
+    if (h->entry->kind == KIND_PLUGIN) {
+        sz = plugin_write(h->entry->plugin, h->plugin_ctx, buf, size, offset);
+        if (sz < 0) {
+            errno = -sz;
+            sz = -1;
+        }
+    } else if (h->sink != NULL) {
+        sz = sink_write(h->sink, buf, size);
+        if (sz < 0) {
+            errno = -sz;
+            sz = -1;
+        }
+    } else if (h->writefd == -1) {
+        return -EBADF;
+    } else {
+        sz = write(h->writefd, buf, size);
+    }
     if (sz == -1) {
-        LOG("write to %s failed with error %d", path, errno);
+        int err = errno;
+        LOG("write to %s failed with error %d", path, err);
+        return -err;
     } else {
         LOG("write to %s of %d bytes", path, sz);
     }
     return sz;
 }
 
+static int exec_getxattr(const char *path, const char *name, char *value, size_t size) {
+    /* The kernel asks for security.capability before every write. */
+    if (strncmp(name, XATTR_PREFIX, strlen(XATTR_PREFIX)) != 0) {
+        return -ENODATA;
+    }
+    if (is_root(path)) {
+        return -ENODATA;
+    }
+    entry_t *e = find_entry(path);
+    if (e == NULL) {
+        return -ENOENT;
+    }
+    struct fuse_context *context = fuse_get_context();
+    int ret = xattr_get(e, context->uid, context->gid, context->pid, name,
+        value, size);
+    entry_release(e);
+    return ret;
+}
+
+static int exec_listxattr(const char *path, char *list, size_t size) {
+    if (is_root(path)) {
+        return 0;
+    }
+    entry_t *e = find_entry(path);
+    if (e == NULL) {
+        return -ENOENT;
+    }
+    struct fuse_context *context = fuse_get_context();
+    int ret = xattr_list(e, context->uid, context->gid, context->pid, list,
+        size);
+    entry_release(e);
+    return ret;
+}
+
 /* Stub out all the irrelevant functions. */
 #define FAIL_STUB(func, args...) \
     static int exec_ ## func(const char *path , ## args) { \
@@ -380,7 +1079,7 @@ static int exec_write(const char *path, const char *buf, size_t size, off_t offs
 #define NOP_STUB(func, args...) \
     static int exec_ ## func(const char *path , ## args) { \
         LOG("No-op stubbed function %s called on %s", __func__, path); \
-        if (!is_root(path) && find_entry(path) == NULL) { \
+        if (!is_root(path) && !exists(path)) { \
             return -ENOENT; \
         } \
         return 0; \
@@ -415,24 +1114,25 @@ struct fuse_operations ops = {
     OP(chown),
     /* No need to implement create as open gets be called instead. */
     OP(destroy),
-    // TODO fgetattr
+    OP(fgetattr),
     OP(flush),
     /* No need to implement ftruncate as truncate gets called instead. */
     OP(fsync),
     OP(fsyncdir),
     OP(getattr),
-    // TODO getxattr
-    // TODO init
+    OP(getxattr),
+    OP(init),
     // TODO ioctl
     OP(link),
-    // TODO listxattr
+    OP(listxattr),
     /* No need to implement lock. Let the kernel handle flocking. */
     OP(mkdir),
     OP(mknod),
     OP(open),
     // TODO opendir
-    // TODO poll
+    OP(poll),
     OP(read),
+    OP(read_buf),
     OP(readdir),
     OP(readlink),
     OP(release),
@@ -450,3 +1150,75 @@ struct fuse_operations ops = {
     OP(write),
 };
 #undef OP
+
+/* Wrap an operation to measure it. The entry is looked up beforehand, so that
+ * only the operation itself is counted.
+ */
+#define MEASURED(func, op, params, args, fh, size) \
+    static int measure_ ## func params { \
+        entry_t *e = is_root(path) ? NULL : find_entry(path); \
+        profile_sample_t s; \
+        binlog_sample_t b; \
+        profile_begin(&s); \
+        binlog_begin(&b); \
+        int ret = exec_ ## func args; \
+        profile_end(&s, PROFILE_ ## op, e); \
+        binlog_end(&b, BINLOG_ ## op, e, fh, size, ret); \
+        entry_release(e); \
+        return ret; \
+    }
+MEASURED(getattr, GETATTR,
+    (const char *path, struct stat *stbuf), (path, stbuf), 0, 0)
+MEASURED(fgetattr, FGETATTR,
+    (const char *path, struct stat *stbuf, struct fuse_file_info *fi),
+    (path, stbuf, fi), fi->fh, 0)
+MEASURED(open, OPEN,
+    (const char *path, struct fuse_file_info *fi), (path, fi),
+    ret == 0 ? fi->fh : 0, 0)
+MEASURED(read, READ,
+    (const char *path, char *buf, size_t size, off_t offset,
+        struct fuse_file_info *fi),
+    (path, buf, size, offset, fi), fi->fh, size)
+MEASURED(read_buf, READ_BUF,
+    (const char *path, struct fuse_bufvec **bufp, size_t size, off_t offset,
+        struct fuse_file_info *fi),
+    (path, bufp, size, offset, fi), fi->fh, size)
+MEASURED(write, WRITE,
+    (const char *path, const char *buf, size_t size, off_t offset,
+        struct fuse_file_info *fi),
+    (path, buf, size, offset, fi), fi->fh, size)
+MEASURED(poll, POLL,
+    (const char *path, struct fuse_file_info *fi, struct fuse_pollhandle *ph,
+        unsigned *reventsp),
+    (path, fi, ph, reventsp), fi->fh, 0)
+MEASURED(flush, FLUSH,
+    (const char *path, struct fuse_file_info *fi), (path, fi), fi->fh, 0)
+MEASURED(release, RELEASE,
+    (const char *path, struct fuse_file_info *fi), (path, fi), fi->fh, 0)
+MEASURED(readdir, READDIR,
+    (const char *path, void *buf, fuse_fill_dir_t filler, off_t offset,
+        struct fuse_file_info *fi),
+    (path, buf, filler, offset, fi), 0, 0)
+MEASURED(getxattr, GETXATTR,
+    (const char *path, const char *name, char *value, size_t size),
+    (path, name, value, size), 0, 0)
+MEASURED(listxattr, LISTXATTR,
+    (const char *path, char *list, size_t size), (path, list, size), 0, 0)
+#undef MEASURED
+
+void fileops_measure(void) {
+#define MEASURE(func) ops.func = &measure_ ## func
+    MEASURE(getattr);
+    MEASURE(fgetattr);
+    MEASURE(open);
+    MEASURE(read);
+    MEASURE(read_buf);
+    MEASURE(write);
+    MEASURE(poll);
+    MEASURE(flush);
+    MEASURE(release);
+    MEASURE(readdir);
+    MEASURE(getxattr);
+    MEASURE(listxattr);
+#undef MEASURE
+}
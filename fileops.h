@@ -7,4 +7,9 @@
 
 extern struct fuse_operations ops;
 
+/* Measure every operation in ops for the profile and the binary log (see
+ * profile.h and binlog.h). Call before serving any.
+ */
+void fileops_measure(void);
+
 #endif
@@ -5,11 +5,6 @@
 #include <stdio.h>
 #include <unistd.h>
 
-#include "entry.h"
-
-extern entry_t **entries;
-extern size_t entries_sz;
-
 extern uid_t uid;
 extern gid_t gid;
 
@@ -0,0 +1,51 @@
+#ifndef _EXECFS_HANDLE_H_
+#define _EXECFS_HANDLE_H_
+
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "builtin.h"
+#include "cache.h"
+#include "entry.h"
+#include "sink.h"
+#include "trace.h"
+
+struct poll_waiter;
+
+/* State of one open file, stored in fuse_file_info::fh. */
+typedef struct {
+    entry_t *entry; /* Held until the file is released. */
+    /* Pipes to the command, or -1 if the file isn't open in that direction.
+     * Interactive handles use the same socket for both.
+     */
+    int readfd;
+    int writefd;
+    /* The command's process, or -1 if it isn't a command. */
+    pid_t pid;
+    /* Output of a built-in entry. */
+    builtin_output_t *builtin;
+    /* The plugin's per-open state, for plugin entries. */
+    void *plugin_ctx;
+    /* Cached output serving this open, for cached entries. */
+    cache_obj_t *cached;
+    /* Sealed memfd holding the output of a spooled open, or -1. */
+    int spoolfd;
+    size_t spool_sz;
+    /* This open's share of the entry's sink, for sink entries opened for
+     * writing.
+     */
+    sink_writer_t *sink;
+    /* Output generated in full at open, for script entries. */
+    char *output;
+    size_t output_sz;
+    /* The last poll() caller waiting for the pipes to become ready, or NULL.
+     * Guarded by a lock in fileops.c.
+     */
+    struct poll_waiter *waiter;
+    /* This open, if it is being traced. */
+    trace_request_t *trace;
+} handle_t;
+
+#define HANDLE(fi) ((handle_t*)(uintptr_t)(fi)->fh)
+
+#endif
@@ -0,0 +1,13 @@
+#ifndef _EXECFS_HASH_H_
+#define _EXECFS_HASH_H_
+
+/* XXH64, a fast non-cryptographic hash, for telling whether regenerated
+ * output differs from what we had before.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+uint64_t hash_xxh64(const void *data, size_t len, uint64_t seed);
+
+#endif
@@ -8,6 +8,7 @@
 #include "globals.h"
 
 FILE *log_file = NULL;
+static int log_enabled = 1;
 
 int log_open(char *filename) {
     if (log_file != NULL) {
@@ -22,8 +23,12 @@ void log_close(void) {
     log_file = NULL;
 }
 
+void log_set_enabled(int enabled) {
+    log_enabled = enabled;
+}
+
 void log_write(char *format, ...) {
-    if (log_file != NULL) {
+    if (log_file != NULL && log_enabled) {
         /* Print timestamp */
         time_t tt = time(NULL);
         struct tm *t = localtime(&tt);
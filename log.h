@@ -3,6 +3,8 @@
 
 int log_open(char *filename);
 void log_close(void);
+/* Pause or resume writing to the log file, if there is one. */
+void log_set_enabled(int enabled);
 void log_write(char *format, ...);
 
 /* Swap the comments below to switch log information between standard logging
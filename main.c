@@ -5,29 +5,43 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <limits.h>
 #include <stdarg.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
-#include <sys/wait.h>
 
+#include "binlog.h"
+#include "cache.h"
 #include "config.h"
+#include "control.h"
 #include "entry.h"
 #include "fileops.h"
 #include "globals.h"
 #include "log.h"
+#include "mount.h"
+#include "prefetch.h"
+#include "profile.h"
+#include "reap.h"
+#include "trace.h"
 
 /* Configuration file to read. */
 static char *config_filename = NULL;
 
+/* Control socket to create, if any. */
+static char *control_path = NULL;
+
 /* Debugging enabled. */
 static int debug = 0;
 
-/* Entries to present to the user in the mount point. */
-entry_t **entries = NULL;
-size_t entries_sz = 0;
+/* Commands to run at once when filling caches before serving, or 0 not to. */
+#define PREWARM_MAX_JOBS 256
+
+/* Configuration files and where to present them, from --mount. */
+static mount_t **mounts = NULL;
+static size_t mounts_sz = 0;
 
 /* Identity of the mounter. This will become the owner of all entries in the
  * mount point.
@@ -40,16 +54,23 @@ gid_t gid;
 size_t size = DEFAULT_SIZE;
 
 /* Debugging functions. */
-static void debug_dump_entries(void) {
+static void debug_dump_entries(mount_t *m) {
+    entry_t **entries = m->entries;
+    size_t entries_sz = m->entries_sz;
     assert(entries_sz != PARSE_FAIL);
     size_t i;
-    fprintf(stderr, "Entries table has %u entries:\n", (unsigned int)entries_sz);
+    fprintf(stderr, "Entries table of %s has %u entries:\n", m->config,
+        (unsigned int)entries_sz);
     for (i = 0; i < entries_sz; ++i) {
-        fprintf(stderr, " Path: %s; -%c%c%c%c%c%c%c%c%c; Exec: %s\n", entries[i]->path, 
+        fprintf(stderr, " Path: %s; -%c%c%c%c%c%c%c%c%c; Exec: %s%s\n", entries[i]->path, 
             entries[i]->u_r?'r':'-', entries[i]->u_w?'w':'-', entries[i]->u_x?'x':'-',
             entries[i]->g_r?'r':'-', entries[i]->g_w?'w':'-', entries[i]->g_x?'x':'-',
             entries[i]->o_r?'r':'-', entries[i]->o_w?'w':'-', entries[i]->o_x?'x':'-',
-            entries[i]->command);
+            entries[i]->command,
+            entries[i]->kind == KIND_BUILTIN ? " (built-in)" :
+            entries[i]->kind == KIND_PLUGIN ? " (plugin)" :
+            entries[i]->kind == KIND_SCRIPT ? " (lua)" :
+            entries[i]->mode == MODE_INTERACTIVE ? " (interactive)" : "");
     }
 }
 static int debug_printf(char *format, ...) {
@@ -62,35 +83,33 @@ static int debug_printf(char *format, ...) {
     return result;
 }
 
-/* Signal handling functions. */
-static void handle_sigchld(int signal) {
-    /* Collect any zombie children. */
-    pid_t pid;
-    do {
-        pid = waitpid(-1, NULL, WNOHANG);
-    } while (pid > 0);
-}
-
-static void install_signal_handlers(void) {
-    signal(SIGCHLD, handle_sigchld);
-}
-
 /* Parse command line arguments. Returns 0 on success, non-zero on failure. */
 static int parse_args(int argc, char **argv, int *last) {
     static struct option options[] = {
         {"debug", no_argument, &debug, 1},
+        {"backoff", required_argument, 0, 'B'},
+        {"binlog", required_argument, 0, 'L'},
+        {"cache-max-object", required_argument, 0, 'M'},
+        {"cache-size", required_argument, 0, 'C'},
         {"config", required_argument, 0, 'c'},
+        {"control", required_argument, 0, 'S'},
         {"fuse", no_argument, 0, 'f'},
         {"help", no_argument, 0, '?'},
         {"log", required_argument, 0, 'l'},
+        {"mount", required_argument, 0, 'm'},
+        {"prefetch", required_argument, 0, 'P'},
+        {"prewarm", required_argument, 0, 'W'},
+        {"profile", required_argument, 0, 'p'},
         {"size", required_argument, 0, 's'},
+        {"trace", required_argument, 0, 't'},
+        {"trace-sample", required_argument, 0, 'T'},
         {"version", no_argument, 0, 'v'},
         {0, 0, 0, 0},
     };
     int index;
     int c;
 
-    while ((c = getopt_long(argc, argv, "dc:f?", options, &index)) != -1) {
+    while ((c = getopt_long(argc, argv, "dc:fm:?", options, &index)) != -1) {
         switch (c) {
             case 0: {
                 /* This should have set a flag. */
@@ -108,6 +127,102 @@ static int parse_args(int argc, char **argv, int *last) {
                     return -1;
                 }
                 break;
+            } case 'S': {
+                free(control_path);
+                control_path = strdup(optarg);
+                if (control_path == NULL) {
+                    /* Out of memory. */
+                    return -1;
+                }
+                break;
+            } case 'C': {
+                char *end;
+                unsigned long long sz = strtoull(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0') {
+                    fprintf(stderr, "Invalid cache size %s passed\n", optarg);
+                    errno = EINVAL;
+                    return -1;
+                }
+                cache_set_budget(sz);
+                break;
+            } case 'M': {
+                char *end;
+                unsigned long long sz = strtoull(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0') {
+                    fprintf(stderr, "Invalid maximum cached object size %s "
+                        "passed\n", optarg);
+                    errno = EINVAL;
+                    return -1;
+                }
+                cache_set_max_object(sz);
+                break;
+            } case 'B': {
+                char *end;
+                unsigned long n = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *optarg == '-' || *end != '\0') {
+                    fprintf(stderr, "Invalid backoff %s passed\n", optarg);
+                    errno = EINVAL;
+                    return -1;
+                }
+                reap_set_backoff(n);
+                break;
+            } case 'P': {
+                char *end;
+                unsigned long n = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || n > UINT_MAX) {
+                    fprintf(stderr, "Invalid prefetch depth %s passed\n",
+                        optarg);
+                    errno = EINVAL;
+                    return -1;
+                }
+                prefetch_set_depth(n);
+                break;
+            } case 'p': {
+                if (profile_enable(optarg) != 0) {
+                    perror("Failed to enable profiling");
+                    return -1;
+                }
+                fileops_measure();
+                break;
+            } case 'L': {
+                if (binlog_open(optarg) != 0) {
+                    fprintf(stderr, "Failed to open binary log file %s\n",
+                        optarg);
+                    errno = EINVAL;
+                    return -1;
+                }
+                fileops_measure();
+                break;
+            } case 't': {
+                if (trace_enable(optarg) != 0) {
+                    perror("Failed to open trace file");
+                    return -1;
+                }
+                break;
+            } case 'T': {
+                char *end;
+                unsigned long n = strtoul(optarg, &end, 10);
+                if (*optarg == '\0' || *optarg == '-' || *end != '\0' ||
+                        n < 1 || n > UINT_MAX) {
+                    fprintf(stderr, "Invalid trace sample %s passed\n",
+                        optarg);
+                    errno = EINVAL;
+                    return -1;
+                }
+                trace_set_sample(n);
+                break;
+            } case 'W': {
+                char *end;
+                long n = strtol(optarg, &end, 10);
+                if (*optarg == '\0' || *end != '\0' || n < 0 ||
+                        n > PREWARM_MAX_JOBS) {
+                    fprintf(stderr, "Invalid number of prewarm jobs %s "
+                        "passed\n", optarg);
+                    errno = EINVAL;
+                    return -1;
+                }
+                prefetch_set_prewarm((int)n);
+                break;
             } case 'd': {
                 debug = 1;
                 break;
@@ -123,6 +238,21 @@ static int parse_args(int argc, char **argv, int *last) {
                     return -1;
                 }
                 break;
+            } case 'm': {
+                mount_t *m = mount_parse(optarg);
+                if (m == NULL) {
+                    fprintf(stderr, "Invalid mount %s passed\n", optarg);
+                    return -1;
+                }
+                mount_t **tmp = realloc(mounts,
+                    sizeof(mount_t*) * (mounts_sz + 1));
+                if (tmp == NULL) {
+                    /* Out of memory. */
+                    return -1;
+                }
+                mounts = tmp;
+                mounts[mounts_sz++] = m;
+                break;
             } case 's': {
                 size_t sz = atoi(optarg);
                 if (sz == 0) {
@@ -137,22 +267,57 @@ static int parse_args(int argc, char **argv, int *last) {
                 exit(0);
             } case '?': {
                 printf("Usage: %s options -f fuse_options\n"
-                       " -c, --config FILE     Read configuration from the given file. This argument\n"
-                       "                       is required.\n"
+                       "     --backoff MS      After a command exits with an error, refuse opens of\n"
+                       "                       its file for a while instead of running it again,\n"
+                       "                       doubling the wait after each failure in a row up to\n"
+                       "                       MS milliseconds (default 30000, 0 disables).\n"
+                       "     --binlog FILE     Append a fixed-size binary record of every file system\n"
+                       "                       operation to FILE, which execfs-logdump reads. Much\n"
+                       "                       cheaper than --log.\n"
+                       " -c, --config FILE     Read configuration from the given file. Either this\n"
+                       "                       argument or --mount is required.\n"
+                       "     --cache-max-object SIZE\n"
+                       "                       Largest output in bytes that will be cached. Larger\n"
+                       "                       output is streamed from the command (default 8MB).\n"
+                       "     --cache-size SIZE Memory in bytes to use for cached command output\n"
+                       "                       across all entries (default 64MB).\n"
+                       "     --control SOCKET  Accept commands from execfsctl on a unix socket at\n"
+                       "                       SOCKET, to inspect and tune execfs while it runs.\n"
                        " -d, --debug           Enable debugging output on startup.\n"
                        " -f, --fuse            Any arguments following this are interpreted as\n"
                        "                       arguments to be passed through to FUSE. This argument\n"
-                       "                       must be used to terminate your execfs argument list.\n"
+                       "                       must be used to terminate your execfs argument list,\n"
+                       "                       but is optional with --mount.\n"
                        " -?, --help            Print this usage information.\n"
                        " -l, --log FILE        Write logging information to FILE. Without this\n"
                        "                       argument no logging is performed.\n"
+                       " -m, --mount CONFIG:MOUNTPOINT\n"
+                       "                       Present the configuration file CONFIG at MOUNTPOINT.\n"
+                       "                       May be repeated to serve several mounts from one\n"
+                       "                       process, sharing threads and caches. The FUSE\n"
+                       "                       options apply to every mount and must not include a\n"
+                       "                       mount point.\n"
+                       "     --prefetch COUNT  After a file is opened, fill the cache for up to COUNT\n"
+                       "                       of the cached entries listed after it, in the\n"
+                       "                       background (default 0, disabled).\n"
+                       "     --prewarm JOBS    Fill the cache of every cached entry before the file\n"
+                       "                       system serves its first request, running up to JOBS\n"
+                       "                       commands at once (default 0, disabled).\n"
+                       "     --profile FILE    Measure every file system operation with the CPU's\n"
+                       "                       performance counters where available, adding totals\n"
+                       "                       per operation and per file to the statistics and\n"
+                       "                       writing a summary to FILE on unmount.\n"
                        " -s, --size SIZE       A size in bytes to report each file entry as having\n"
                        "                       (default 10). The argument exists because some programs\n"
                        "                       will stat a file before reading it and only read as\n"
                        "                       many bytes as its reported size. Increase this value if\n"
                        "                       you find the output of your executed commands is being\n"
-                       "                       truncated when read.\n",
-                       argv[0]);
+                       "                       truncated when read.\n"
+                       "     --trace FILE      Follow sampled opens through each phase of serving them,\n"
+                       "                       from looking up the entry to releasing the file, and\n"
+                       "                       write the timings to FILE as Chrome trace-event JSON.\n"
+                       "     --trace-sample N  Trace one open in every N (default %d).\n",
+                       argv[0], TRACE_SAMPLE);
                 exit(0);
             } default: {
                 fprintf(stderr, "Unrecognised argument: %c\n", optopt);
@@ -162,7 +327,14 @@ static int parse_args(int argc, char **argv, int *last) {
         }
     }
 
-    /* If we reached here, then we never found a -f/--fuse argument. */
+    /* If we reached here, then we never found a -f/--fuse argument. Mounts
+     * passed with --mount say where they go, so FUSE needs no arguments.
+     */
+    if (mounts_sz > 0) {
+        assert(last != NULL);
+        *last = optind;
+        return 0;
+    }
     fprintf(stderr, "No -f/--fuse argument provided.\n");
     errno = EINVAL;
     return -1;
@@ -175,32 +347,54 @@ int main(int argc, char **argv) {
         return -1;
     }
 
-    if (config_filename == NULL) {
-        fprintf(stderr, "No configuration file specified.\n");
+    if (config_filename != NULL && mounts_sz > 0) {
+        fprintf(stderr, "--config and --mount can't be used together.\n");
         return -1;
-    }
-
-    entries = parse_config(&entries_sz, config_filename, debug ? &debug_printf : NULL);
-    if (entries_sz == PARSE_FAIL) {
-        perror("Failed to parse configuration file");
+    } else if (config_filename != NULL) {
+        /* FUSE is told where to mount it. */
+        mounts = calloc(1, sizeof(mount_t*));
+        if (mounts == NULL ||
+                (mounts[0] = mount_new(config_filename, NULL)) == NULL) {
+            perror("Failed to read configuration file");
+            return -1;
+        }
+        free(config_filename);
+        config_filename = NULL;
+        mounts_sz = 1;
+    } else if (mounts_sz == 0) {
+        fprintf(stderr, "No configuration file specified.\n");
         return -1;
     }
 
-    /* We don't need the configuration file any more. */
-    free(config_filename);
-    config_filename = NULL;
-
-    if (debug) {
-        debug_dump_entries();
+    size_t i;
+    for (i = 0; i < mounts_sz; ++i) {
+        mount_t *m = mounts[i];
+        m->entries = parse_config(&m->entries_sz, m->config,
+            debug ? &debug_printf : NULL);
+        if (m->entries_sz == PARSE_FAIL) {
+            fprintf(stderr, "%s: ", m->config);
+            perror("Failed to parse configuration file");
+            return -1;
+        }
+        if (debug) {
+            debug_dump_entries(m);
+        }
     }
 
-    /* Install our signal handlers now. */
-    install_signal_handlers();
-
     /* Set the owner of the mount point entries. */
     uid = geteuid();
     gid = getegid();
 
+    if (control_path != NULL) {
+        if (control_open(control_path, mounts, mounts_sz) != 0) {
+            fprintf(stderr, "%s: ", control_path);
+            perror("Failed to create control socket");
+            return -1;
+        }
+        free(control_path);
+        control_path = NULL;
+    }
+
     /* Adjust arguments to hide any that we handled from FUSE. */
     --last_arg;
     assert(last_arg > 0);
@@ -211,11 +405,27 @@ int main(int argc, char **argv) {
     assert(argv[argc] == NULL);
     if (debug) {
         fprintf(stderr, "Altered argument parameters:\n");
-        int i;
-        for (i = 0; i < argc; ++i) {
-            fprintf(stderr, "%d: %s\n", i, argv[i]);
+        int j;
+        for (j = 0; j < argc; ++j) {
+            fprintf(stderr, "%d: %s\n", j, argv[j]);
         }
     }
 
-    return fuse_main(argc, argv, &ops, NULL);
+    if (mounts[0]->mountpoint == NULL) {
+        struct fuse_args args = FUSE_ARGS_INIT(0, NULL);
+        int j;
+        for (j = 0; j < argc; ++j) {
+            if (fuse_opt_add_arg(&args, argv[j]) != 0) {
+                break;
+            }
+        }
+        if (j < argc || mount_options(mounts[0], &args) != 0) {
+            perror("Failed to add FUSE options");
+            return -1;
+        }
+        int ret = fuse_main(args.argc, args.argv, &ops, mounts[0]);
+        fuse_opt_free_args(&args);
+        return ret;
+    }
+    return mount_serve(mounts, mounts_sz, argc, argv);
 }
@@ -0,0 +1,249 @@
+/* Serving several mounts from one process. */
+
+#include <assert.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "config.h"
+#include "fileops.h"
+#include "log.h"
+#include "mount.h"
+
+/* Mounts whose session loop is still running. */
+static int live = 0;
+/* Serve each mount from one thread, as asked for by FUSE's -s option. */
+static int single_threaded = 0;
+
+mount_t *mount_new(const char *config, const char *mountpoint) {
+    assert(config != NULL);
+    mount_t *m = calloc(1, sizeof(*m));
+    if (m == NULL) {
+        return NULL;
+    }
+    /* Going into the background changes directory, so resolve both now. */
+    m->config = realpath(config, NULL);
+    if (m->config == NULL) {
+        goto mount_new_fail;
+    }
+    if (mountpoint != NULL) {
+        m->mountpoint = realpath(mountpoint, NULL);
+        if (m->mountpoint == NULL) {
+            goto mount_new_fail;
+        }
+    }
+    if (pthread_rwlock_init(&m->lock, NULL) != 0) {
+        goto mount_new_fail;
+    }
+    return m;
+
+mount_new_fail:
+    free(m->config);
+    free(m->mountpoint);
+    free(m);
+    return NULL;
+}
+
+mount_t *mount_parse(const char *spec) {
+    assert(spec != NULL);
+    /* Split at the last colon, so only the mount point can't contain one. */
+    const char *colon = strrchr(spec, ':');
+    if (colon == NULL || colon == spec || colon[1] == '\0') {
+        errno = EINVAL;
+        return NULL;
+    }
+    char *config = strndup(spec, colon - spec);
+    if (config == NULL) {
+        return NULL;
+    }
+    mount_t *m = mount_new(config, colon + 1);
+    free(config);
+    return m;
+}
+
+int mount_reload(mount_t *m) {
+    assert(m != NULL);
+    size_t entries_sz;
+    entry_t **entries = parse_config(&entries_sz, m->config, NULL);
+    if (entries_sz == PARSE_FAIL) {
+        LOG("Failed to reload %s", m->config);
+        return -1;
+    }
+    pthread_rwlock_wrlock(&m->lock);
+    entry_t **old = m->entries;
+    size_t old_sz = m->entries_sz;
+    m->entries = entries;
+    m->entries_sz = entries_sz;
+    pthread_rwlock_unlock(&m->lock);
+    LOG("Reloaded %zu entries from %s", entries_sz, m->config);
+
+    /* Whatever still uses an old entry holds it, and it is freed when the
+     * last of them lets go.
+     */
+    cache_reload(old, old_sz, entries, entries_sz);
+    size_t i;
+    for (i = 0; i < old_sz; ++i) {
+        entry_release(old[i]);
+    }
+    free(old);
+    return 0;
+}
+
+int mount_options(mount_t *m, struct fuse_args *args) {
+    assert(m != NULL);
+    assert(args != NULL);
+    size_t i;
+    for (i = 0; i < m->entries_sz; ++i) {
+        if (m->entries[i]->spool) {
+            m->fresh_attrs = 1;
+            return fuse_opt_add_arg(args, "-oattr_timeout=0");
+        }
+    }
+    return 0;
+}
+
+mount_t *mount_current(void) {
+    return fuse_get_context()->private_data;
+}
+
+static void *loop_main(void *arg) {
+    mount_t *m = arg;
+    if ((single_threaded ? fuse_loop(m->fuse) : fuse_loop_mt(m->fuse)) != 0) {
+        LOG("Serving %s failed", m->mountpoint);
+    }
+    LOG("Stopped serving %s", m->mountpoint);
+    if (__sync_sub_and_fetch(&live, 1) == 0) {
+        /* Nothing left to serve, so wake up mount_serve(). */
+        kill(getpid(), SIGTERM);
+    }
+    return NULL;
+}
+
+/* Detach a mount point so that its session sees the device go away and
+ * finishes, the same way fusermount -uz would.
+ */
+static void detach(const char *mountpoint) {
+    if (umount2(mountpoint, MNT_DETACH) == 0 || errno == EINVAL) {
+        return;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+        execlp("fusermount", "fusermount", "-u", "-z", "-q", "--",
+            mountpoint, (char*)NULL);
+        _exit(1);
+    } else if (pid > 0) {
+        (void)waitpid(pid, NULL, 0);
+    }
+}
+
+int mount_serve(mount_t **mounts, size_t mounts_sz, int argc, char **argv) {
+    assert(mounts != NULL);
+    assert(mounts_sz > 0);
+    struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    char *mountpoint = NULL;
+    int multithreaded, foreground;
+    if (fuse_parse_cmdline(&args, &mountpoint, &multithreaded,
+            &foreground) != 0) {
+        return -1;
+    }
+    single_threaded = !multithreaded;
+    if (mountpoint != NULL) {
+        fprintf(stderr, "Mount points are given with --mount, not as a FUSE "
+            "argument (%s)\n", mountpoint);
+        free(mountpoint);
+        fuse_opt_free_args(&args);
+        return -1;
+    }
+
+    size_t i, j, mounted = 0;
+    for (i = 0; i < mounts_sz; ++i, ++mounted) {
+        mount_t *m = mounts[i];
+        /* Each mount consumes its own copy of the options. */
+        struct fuse_args margs = FUSE_ARGS_INIT(0, NULL);
+        for (j = 0; j < args.argc; ++j) {
+            if (fuse_opt_add_arg(&margs, args.argv[j]) != 0) {
+                break;
+            }
+        }
+        if (j == args.argc && mount_options(m, &margs) != 0) {
+            j = 0;
+        }
+        m->chan = j == args.argc ? fuse_mount(m->mountpoint, &margs) : NULL;
+        if (m->chan != NULL) {
+            m->fuse = fuse_new(m->chan, &margs, &ops, sizeof(ops), m);
+            if (m->fuse == NULL) {
+                fuse_unmount(m->mountpoint, m->chan);
+            }
+        }
+        fuse_opt_free_args(&margs);
+        if (m->chan == NULL || m->fuse == NULL) {
+            fprintf(stderr, "Failed to mount %s at %s\n", m->config,
+                m->mountpoint);
+            goto mount_serve_fail;
+        }
+    }
+    fuse_opt_free_args(&args);
+
+    if (fuse_daemonize(foreground) != 0) {
+        goto mount_serve_fail;
+    }
+
+    /* Termination signals are collected below rather than interrupting
+     * whichever thread they happen to land on.
+     */
+    sigset_t signals;
+    sigemptyset(&signals);
+    sigaddset(&signals, SIGINT);
+    sigaddset(&signals, SIGTERM);
+    sigaddset(&signals, SIGHUP);
+    pthread_sigmask(SIG_BLOCK, &signals, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    size_t started;
+    live = mounts_sz;
+    for (started = 0; started < mounts_sz; ++started) {
+        if (pthread_create(&mounts[started]->thread, NULL, loop_main,
+                mounts[started]) != 0) {
+            LOG("Failed to start serving %s", mounts[started]->mountpoint);
+            __sync_sub_and_fetch(&live, mounts_sz - started);
+            break;
+        }
+    }
+
+    int sig = 0;
+    if (started == mounts_sz) {
+        sigwait(&signals, &sig);
+        LOG("Received signal %d, unmounting", sig);
+    }
+
+    for (i = 0; i < mounts_sz; ++i) {
+        fuse_exit(mounts[i]->fuse);
+        detach(mounts[i]->mountpoint);
+    }
+    for (i = 0; i < started; ++i) {
+        pthread_join(mounts[i]->thread, NULL);
+    }
+    for (i = 0; i < mounts_sz; ++i) {
+        fuse_unmount(mounts[i]->mountpoint, mounts[i]->chan);
+        fuse_destroy(mounts[i]->fuse);
+        mounts[i]->chan = NULL;
+        mounts[i]->fuse = NULL;
+    }
+    return started == mounts_sz ? 0 : -1;
+
+mount_serve_fail:
+    for (i = 0; i < mounted; ++i) {
+        fuse_unmount(mounts[i]->mountpoint, mounts[i]->chan);
+        fuse_destroy(mounts[i]->fuse);
+        mounts[i]->chan = NULL;
+        mounts[i]->fuse = NULL;
+    }
+    fuse_opt_free_args(&args);
+    return -1;
+}
@@ -0,0 +1,73 @@
+#ifndef _EXECFS_MOUNT_H_
+#define _EXECFS_MOUNT_H_
+
+/* A configuration file presented at a mount point. One execfs process can
+ * serve several, each with its own FUSE session and the pool of worker threads
+ * libfuse 2 runs for it, while sharing everything else: background threads,
+ * the output cache and child process handling. Entries of different mounts
+ * with the same path, command and caching options share cached output.
+ */
+
+#define FUSE_USE_VERSION 26
+#include <fuse.h>
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "entry.h"
+
+typedef struct {
+    char *config;
+    char *mountpoint; /* NULL when mounted through fuse_main(). */
+    /* Replaced by mount_reload(), so read them with lock held, and hold an
+     * entry (see config.h) to go on using it after unlocking.
+     */
+    pthread_rwlock_t lock;
+    entry_t **entries;
+    size_t entries_sz;
+    /* Whether the kernel was told not to cache attributes (see
+     * mount_options()).
+     */
+    int fresh_attrs;
+
+    /* FUSE state while served by mount_serve(). */
+    struct fuse_chan *chan;
+    struct fuse *fuse;
+    pthread_t thread;
+} mount_t;
+
+/* A mount of config at mountpoint, which may be NULL if FUSE is told where
+ * to mount it. Both must exist. Its entries are not read yet. Returns NULL
+ * and sets errno on failure.
+ */
+mount_t *mount_new(const char *config, const char *mountpoint);
+
+/* Parse a CONFIG:MOUNTPOINT pair with mount_new(). */
+mount_t *mount_parse(const char *spec);
+
+/* Read the configuration file again and replace the entries with its
+ * contents. The old entries are kept if it can't be parsed. Otherwise they
+ * are released, and cached output is kept only for new entries that would
+ * produce and keep it the same way (see cache_reload()). Returns 0 on success.
+ */
+int mount_reload(mount_t *m);
+
+/* Add the FUSE options m needs to args. The size of spooled output is only
+ * known once it is opened, so with spool entries the kernel is told not to
+ * cache attributes and asks for the size again when a read or mmap reaches
+ * the end of what it last heard. Options can't change once mounted, so opens
+ * of entries made spooled by a later reload use direct I/O instead. Returns 0
+ * on success.
+ */
+int mount_options(mount_t *m, struct fuse_args *args);
+
+/* The mount the current FUSE request is for. */
+mount_t *mount_current(void);
+
+/* Mount each of mounts, passing them the FUSE options in argv, go into the
+ * background unless told otherwise and serve requests until interrupted or
+ * every mount has been unmounted. Returns 0 on a clean exit.
+ */
+int mount_serve(mount_t **mounts, size_t mounts_sz, int argc, char **argv);
+
+#endif
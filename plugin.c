@@ -0,0 +1,125 @@
+/* Shared-object plugins run inside the daemon. */
+
+#include <assert.h>
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "execfs_plugin.h"
+#include "plugin.h"
+
+#define DPRINTF(args...) \
+    do { \
+        if (debug_printf != NULL) { \
+            debug_printf(args); \
+        } \
+    } while (0)
+
+struct plugin {
+    void *library;
+    const execfs_plugin_t *ops;
+    char *args;
+};
+
+plugin_t *plugin_load(const char *spec,
+        int(*debug_printf)(char *format, ...)) {
+    assert(spec != NULL);
+    plugin_t *p = calloc(1, sizeof(*p));
+    char *copy = strdup(spec);
+    if (p == NULL || copy == NULL) {
+        DPRINTF("Out of memory in %s\n", __func__);
+        goto plugin_load_fail;
+    }
+
+    /* Split "library:symbol args". */
+    char *args = copy + strcspn(copy, " \t");
+    if (*args != '\0') {
+        *args++ = '\0';
+        args += strspn(args, " \t");
+    }
+    char *symbol = strrchr(copy, ':');
+    if (symbol == NULL || symbol == copy || symbol[1] == '\0') {
+        DPRINTF("Plugin %s is not of the form library:symbol\n", spec);
+        errno = EINVAL;
+        goto plugin_load_fail;
+    }
+    *symbol++ = '\0';
+    p->args = strdup(args);
+    if (p->args == NULL) {
+        DPRINTF("Out of memory in %s\n", __func__);
+        goto plugin_load_fail;
+    }
+
+    p->library = dlopen(copy, RTLD_NOW|RTLD_LOCAL);
+    if (p->library == NULL) {
+        DPRINTF("Failed to load %s: %s\n", copy, dlerror());
+        errno = ENOENT;
+        goto plugin_load_fail;
+    }
+    p->ops = dlsym(p->library, symbol);
+    if (p->ops == NULL) {
+        DPRINTF("Failed to find %s in %s: %s\n", symbol, copy, dlerror());
+        errno = ENOENT;
+        goto plugin_load_fail;
+    }
+    if (p->ops->abi != EXECFS_PLUGIN_ABI || p->ops->open == NULL) {
+        DPRINTF("%s in %s is not a version %d execfs plugin\n", symbol, copy,
+            EXECFS_PLUGIN_ABI);
+        errno = EINVAL;
+        goto plugin_load_fail;
+    }
+
+    free(copy);
+    return p;
+
+plugin_load_fail:
+    free(copy);
+    plugin_unload(p);
+    return NULL;
+}
+
+void plugin_unload(plugin_t *p) {
+    if (p == NULL) {
+        return;
+    }
+    if (p->library != NULL) {
+        dlclose(p->library);
+    }
+    free(p->args);
+    free(p);
+}
+
+int plugin_open(plugin_t *p, const char *path, int flags, void **ctx) {
+    assert(p != NULL);
+    int rights = flags & O_ACCMODE;
+    if (((rights == O_RDONLY || rights == O_RDWR) && p->ops->read == NULL) ||
+        ((rights == O_WRONLY || rights == O_RDWR) && p->ops->write == NULL)) {
+        return -EACCES;
+    }
+    *ctx = NULL;
+    return p->ops->open(p->args, path, flags, ctx);
+}
+
+ssize_t plugin_read(plugin_t *p, void *ctx, char *buf, size_t size,
+        off_t offset) {
+    assert(p != NULL);
+    return p->ops->read == NULL ? -EBADF :
+        p->ops->read(ctx, buf, size, offset);
+}
+
+ssize_t plugin_write(plugin_t *p, void *ctx, const char *buf, size_t size,
+        off_t offset) {
+    assert(p != NULL);
+    return p->ops->write == NULL ? -EBADF :
+        p->ops->write(ctx, buf, size, offset);
+}
+
+void plugin_release(plugin_t *p, void *ctx) {
+    assert(p != NULL);
+    if (p->ops->release != NULL) {
+        p->ops->release(ctx);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef _EXECFS_PLUGIN_LOADER_H_
+#define _EXECFS_PLUGIN_LOADER_H_
+
+/* Loading of shared-object plugins. See execfs_plugin.h for the interface the
+ * plugins themselves implement.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct plugin plugin_t;
+
+/* Load the plugin described by spec, of the form "library.so:symbol args".
+ * Returns NULL on failure, after explaining why through debug_printf.
+ */
+plugin_t *plugin_load(const char *spec,
+        int(*debug_printf)(char *format, ...));
+void plugin_unload(plugin_t *p);
+
+/* Wrappers around the plugin's functions. These return negative errnos on
+ * failure, including when the plugin doesn't support the operation.
+ */
+int plugin_open(plugin_t *p, const char *path, int flags, void **ctx);
+ssize_t plugin_read(plugin_t *p, void *ctx, char *buf, size_t size,
+        off_t offset);
+ssize_t plugin_write(plugin_t *p, void *ctx, const char *buf, size_t size,
+        off_t offset);
+void plugin_release(plugin_t *p, void *ctx);
+
+#endif
@@ -0,0 +1,209 @@
+/* Readiness notifications for child pipes. */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "poller.h"
+
+typedef struct {
+    int fd;
+    short events;
+    poller_fn_t fn;
+    void *arg;
+} watch_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static int running = 0;
+
+/* Watches currently registered. Protected by lock. */
+static watch_t *watches = NULL;
+static size_t watches_sz = 0, watches_cap = 0;
+
+/* Self-pipe used to interrupt poll() when the watch list changes. */
+static int wakeup[2] = { -1, -1 };
+
+static void poke(void) {
+    char c = 0;
+    /* The pipe is non-blocking. If it is full the thread is already due to
+     * wake up, so a failed write is harmless.
+     */
+    (void)!write(wakeup[1], &c, 1);
+}
+
+static void *poller_main(void *arg) {
+    struct pollfd *fds = NULL;
+    size_t fds_cap = 0;
+
+    while (1) {
+        pthread_mutex_lock(&lock);
+        if (!running) {
+            pthread_mutex_unlock(&lock);
+            break;
+        }
+        size_t n = watches_sz;
+        if (n + 1 > fds_cap) {
+            struct pollfd *tmp = realloc(fds, sizeof(*fds) * (n + 1));
+            if (tmp == NULL) {
+                pthread_mutex_unlock(&lock);
+                LOG("Out of memory in poller; retrying");
+                sleep(1);
+                continue;
+            }
+            fds = tmp;
+            fds_cap = n + 1;
+        }
+        fds[0].fd = wakeup[0];
+        fds[0].events = POLLIN;
+        size_t i;
+        for (i = 0; i < n; ++i) {
+            fds[i + 1].fd = watches[i].fd;
+            fds[i + 1].events = watches[i].events;
+        }
+        pthread_mutex_unlock(&lock);
+
+        if (poll(fds, n + 1, -1) == -1) {
+            if (errno != EINTR) {
+                LOG("poll failed with error %d", errno);
+            }
+            continue;
+        }
+
+        if (fds[0].revents & POLLIN) {
+            char buf[64];
+            while (read(wakeup[0], buf, sizeof(buf)) > 0);
+        }
+
+        /* Fire the watches that became ready. The list may have changed while
+         * we were polling, so match on fd rather than position.
+         */
+        for (i = 1; i <= n; ++i) {
+            if (fds[i].revents == 0) {
+                continue;
+            }
+            pthread_mutex_lock(&lock);
+            size_t j;
+            for (j = 0; j < watches_sz; ++j) {
+                if (watches[j].fd == fds[i].fd &&
+                        (watches[j].events & fds[i].events) != 0) {
+                    break;
+                }
+            }
+            if (j == watches_sz) {
+                /* Cancelled in the meantime. */
+                pthread_mutex_unlock(&lock);
+                continue;
+            }
+            watch_t w = watches[j];
+            watches[j] = watches[--watches_sz];
+            pthread_mutex_unlock(&lock);
+
+            /* POLLERR/POLLHUP are reported whether asked for or not, and
+             * count as ready because a read/write will no longer block.
+             */
+            w.fn(w.fd, fds[i].revents, w.arg);
+        }
+    }
+
+    free(fds);
+    return NULL;
+}
+
+int poller_start(void) {
+    assert(!running);
+    if (pipe(wakeup) != 0) {
+        return -1;
+    }
+    (void)fcntl(wakeup[0], F_SETFL, O_NONBLOCK);
+    (void)fcntl(wakeup[1], F_SETFL, O_NONBLOCK);
+    (void)fcntl(wakeup[0], F_SETFD, FD_CLOEXEC);
+    (void)fcntl(wakeup[1], F_SETFD, FD_CLOEXEC);
+    running = 1;
+    if (pthread_create(&thread, NULL, poller_main, NULL) != 0) {
+        running = 0;
+        close(wakeup[0]);
+        close(wakeup[1]);
+        return -1;
+    }
+    return 0;
+}
+
+void poller_stop(void) {
+    if (!running) {
+        return;
+    }
+    pthread_mutex_lock(&lock);
+    running = 0;
+    poke();
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+
+    size_t i;
+    for (i = 0; i < watches_sz; ++i) {
+        watches[i].fn(watches[i].fd, 0, watches[i].arg);
+    }
+    free(watches);
+    watches = NULL;
+    watches_sz = watches_cap = 0;
+    close(wakeup[0]);
+    close(wakeup[1]);
+}
+
+int poller_running(void) {
+    pthread_mutex_lock(&lock);
+    int r = running;
+    pthread_mutex_unlock(&lock);
+    return r;
+}
+
+int poller_watch(int fd, short events, poller_fn_t fn, void *arg) {
+    assert(fn != NULL);
+    pthread_mutex_lock(&lock);
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        errno = ESRCH;
+        return -1;
+    }
+    if (watches_sz == watches_cap) {
+        size_t cap = watches_cap == 0 ? 16 : watches_cap * 2;
+        watch_t *tmp = realloc(watches, sizeof(*watches) * cap);
+        if (tmp == NULL) {
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        watches = tmp;
+        watches_cap = cap;
+    }
+    watches[watches_sz].fd = fd;
+    watches[watches_sz].events = events;
+    watches[watches_sz].fn = fn;
+    watches[watches_sz].arg = arg;
+    watches_sz++;
+    poke();
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+void poller_unwatch(int fd) {
+    pthread_mutex_lock(&lock);
+    size_t i = 0;
+    while (i < watches_sz) {
+        if (watches[i].fd == fd) {
+            watch_t w = watches[i];
+            watches[i] = watches[--watches_sz];
+            w.fn(w.fd, 0, w.arg);
+        } else {
+            ++i;
+        }
+    }
+    poke();
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,25 @@
+#ifndef _EXECFS_POLLER_H_
+#define _EXECFS_POLLER_H_
+
+/* A single background thread that waits for file descriptors to become ready
+ * and runs a callback when they do. Watches are one-shot.
+ */
+
+/* Called from the poller thread with the events that fired. revents is 0 if
+ * the watch was cancelled by poller_unwatch() or poller_stop() instead, in
+ * which case the callback should only release arg.
+ */
+typedef void (*poller_fn_t)(int fd, short revents, void *arg);
+
+int poller_start(void);
+void poller_stop(void);
+/* Whether the thread is running, so that watches can be added. */
+int poller_running(void);
+
+/* Call fn once fd reports any of events. Returns 0 on success. */
+int poller_watch(int fd, short events, poller_fn_t fn, void *arg);
+
+/* Cancel every watch on fd. Call this before closing fd. */
+void poller_unwatch(int fd);
+
+#endif
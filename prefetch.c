@@ -0,0 +1,272 @@
+/* Background warming of the output cache. */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "config.h"
+#include "entry.h"
+#include "log.h"
+#include "prefetch.h"
+#include "reap.h"
+#include "spawn.h"
+#include "workq.h"
+
+/* Default for the commands run concurrently on behalf of the prefetcher. */
+#define PREFETCH_WORKERS 4
+/* Requests allowed to wait for a worker before new ones are dropped. */
+#define PREFETCH_BACKLOG 64
+
+typedef struct {
+    entry_t *entry; /* Held. */
+    spawn_context_t context;
+} job_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static unsigned int depth = 0;
+static workq_t *workers = NULL;
+static int workers_sz = PREFETCH_WORKERS;
+static int prewarm_jobs = 0;
+static prefetch_stats_t stats;
+
+static job_t *new_job(entry_t *e) {
+    job_t *j = malloc(sizeof(*j));
+    if (j != NULL) {
+        j->entry = e;
+        entry_hold(e);
+    }
+    return j;
+}
+
+/* Also how queues discard jobs they never ran. */
+static void free_job(void *arg) {
+    job_t *j = arg;
+    if (j != NULL) {
+        entry_release(j->entry);
+        free(j);
+    }
+}
+
+void prefetch_set_depth(unsigned int d) {
+    pthread_mutex_lock(&lock);
+    depth = d;
+    pthread_mutex_unlock(&lock);
+}
+
+unsigned int prefetch_depth(void) {
+    pthread_mutex_lock(&lock);
+    unsigned int d = workers == NULL ? 0 : depth;
+    pthread_mutex_unlock(&lock);
+    return d;
+}
+
+int prefetch_start(void) {
+    pthread_mutex_lock(&lock);
+    if (depth > 0 && workers == NULL) {
+        workers = workq_create(workers_sz, PREFETCH_BACKLOG, free_job);
+    }
+    int err = depth > 0 && workers == NULL ? -1 : 0;
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+int prefetch_set_workers(int n) {
+    assert(n > 0);
+    pthread_mutex_lock(&lock);
+    workers_sz = n;
+    int err = workers == NULL ? 0 : workq_set_threads(workers, n);
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+void prefetch_set_prewarm(int jobs) {
+    assert(jobs >= 0);
+    pthread_mutex_lock(&lock);
+    prewarm_jobs = jobs;
+    pthread_mutex_unlock(&lock);
+}
+
+void prefetch_stop(void) {
+    pthread_mutex_lock(&lock);
+    workq_t *q = workers;
+    workers = NULL;
+    pthread_mutex_unlock(&lock);
+    /* Outside the lock, as running jobs update the statistics. */
+    workq_destroy(q);
+}
+
+int prefetch_eligible(entry_t *e) {
+    assert(e != NULL);
+    return e->kind == KIND_COMMAND && (e->cache_policy == CACHE_GLOBAL ||
+        e->cache_policy == CACHE_UID || e->cache_policy == CACHE_GID);
+}
+
+int prefetch_warm(entry_t *e, const spawn_context_t *context) {
+    assert(e != NULL);
+    assert(context != NULL);
+    if (reap_refuse(e)) {
+        LOG("Not warming output of %s while its command backs off", e->path);
+        return -1;
+    }
+    char *key = cache_key(e, context->uid, context->gid, context->pid);
+    int fill = 0;
+    /* Whoever is filling the output already will do, and there is no point in
+     * tying up a worker waiting for them.
+     */
+    cache_obj_t *o = key == NULL ? NULL : cache_try_acquire(e, key, &fill);
+    if (o == NULL) {
+        int busy = key != NULL && errno == EBUSY;
+        free(key);
+        return busy ? 0 : -1;
+    }
+    if (!fill) {
+        cache_release(o);
+        free(key);
+        return 0;
+    }
+
+    char *data;
+    size_t data_sz;
+    int rest;
+    int err = spawn_capture(e, context, cache_max_object(), &data, &data_sz,
+        &rest);
+    if (err == -1) {
+        LOG("Failed to warm output of %s (%s)", e->path, key);
+        cache_abort(o, 0);
+    } else if (err == 1) {
+        LOG("Output of %s (%s) too large to cache", e->path, key);
+        close(rest);
+        free(data);
+        cache_abort(o, 1);
+    } else {
+        LOG("Warmed %zu bytes of output of %s (%s)", data_sz, e->path, key);
+        cache_fill(o, data, data_sz);
+    }
+    cache_release(o);
+    free(key);
+    return err == -1 ? -1 : 0;
+}
+
+static void run(void *arg) {
+    job_t *j = arg;
+    int err = prefetch_warm(j->entry, &j->context);
+    pthread_mutex_lock(&lock);
+    if (err == 0) {
+        stats.filled++;
+    } else {
+        stats.failed++;
+    }
+    pthread_mutex_unlock(&lock);
+    free_job(j);
+}
+
+void prefetch_queue(entry_t *e, const spawn_context_t *context) {
+    assert(e != NULL);
+    assert(context != NULL);
+    if (!prefetch_eligible(e) || reap_refuse(e)) {
+        return;
+    }
+    /* Skip the job entirely if the output is already there or on its way. */
+    char *key = cache_key(e, context->uid, context->gid, context->pid);
+    if (key == NULL) {
+        return;
+    }
+    cache_obj_t *o = cache_peek(e, key);
+    int filling = o == NULL && cache_filling(e, key);
+    free(key);
+    if (o != NULL) {
+        cache_release(o);
+        return;
+    } else if (filling) {
+        return;
+    }
+
+    job_t *j = new_job(e);
+    if (j == NULL) {
+        return;
+    }
+    j->context = *context;
+
+    pthread_mutex_lock(&lock);
+    if (workers != NULL && workq_submit(workers, run, j) == 0) {
+        stats.queued++;
+        j = NULL;
+    } else {
+        stats.dropped++;
+    }
+    pthread_mutex_unlock(&lock);
+    free_job(j);
+}
+
+static void run_prewarm(void *arg) {
+    job_t *j = arg;
+    if (prefetch_warm(j->entry, &j->context) != 0) {
+        pthread_mutex_lock(&lock);
+        stats.prewarm_failed++;
+        pthread_mutex_unlock(&lock);
+    }
+    free_job(j);
+}
+
+void prefetch_prewarm(entry_t **entries, size_t entries_sz, uid_t uid,
+        gid_t gid) {
+    assert(entries != NULL || entries_sz == 0);
+    pthread_mutex_lock(&lock);
+    int jobs = prewarm_jobs;
+    pthread_mutex_unlock(&lock);
+    if (jobs == 0) {
+        return;
+    }
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    workq_t *q = workq_create(jobs, 0, free_job);
+    if (q == NULL) {
+        LOG("Failed to start prewarm threads");
+        return;
+    }
+    size_t i, queued = 0;
+    for (i = 0; i < entries_sz; ++i) {
+        if (!prefetch_eligible(entries[i])) {
+            continue;
+        }
+        job_t *j = new_job(entries[i]);
+        if (j == NULL) {
+            break;
+        }
+        j->context.uid = uid;
+        j->context.gid = gid;
+        j->context.pid = getpid();
+        j->context.flags = O_RDONLY;
+        if (workq_submit(q, run_prewarm, j) != 0) {
+            free_job(j);
+            break;
+        }
+        queued++;
+    }
+    workq_wait(q);
+    workq_destroy(q);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    pthread_mutex_lock(&lock);
+    double seconds = (end.tv_sec - start.tv_sec) +
+        (end.tv_nsec - start.tv_nsec) / 1e9;
+    stats.prewarm_entries += queued;
+    stats.prewarm_seconds += seconds;
+    LOG("Prewarmed %zu entries in %.3fs, %zu failed so far", queued, seconds,
+        stats.prewarm_failed);
+    pthread_mutex_unlock(&lock);
+}
+
+void prefetch_get_stats(prefetch_stats_t *out) {
+    assert(out != NULL);
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
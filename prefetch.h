@@ -0,0 +1,77 @@
+#ifndef _EXECFS_PREFETCH_H_
+#define _EXECFS_PREFETCH_H_
+
+/* Background warming of the output cache. Readers tend to open files in the
+ * order readdir() lists them, so after an open the next few cached entries are
+ * filled ahead of time on a small pool of worker threads.
+ *
+ * Only entries cached globally or by uid or gid are prefetched. Their
+ * partition is known from the opener's credentials alone, whereas pidtree and
+ * env partitions depend on a process that may be gone by the time the job
+ * runs.
+ */
+
+#include "entry.h"
+#include "spawn.h"
+
+/* Number of entries to look ahead, or 0 (the default) to disable
+ * prefetching.
+ */
+void prefetch_set_depth(unsigned int depth);
+unsigned int prefetch_depth(void);
+
+/* Start and stop the worker threads. prefetch_start() does nothing when
+ * prefetching is disabled.
+ */
+int prefetch_start(void);
+void prefetch_stop(void);
+
+/* Set the most commands run at once by the prefetcher (default 4). Returns 0
+ * on success.
+ */
+int prefetch_set_workers(int n);
+
+/* Whether the output of e can be warmed on behalf of an opener. */
+int prefetch_eligible(entry_t *e);
+
+/* Warm e's output for context in the background. Requests are dropped when
+ * the workers are too far behind, and skipped when the output is already
+ * there or being filled, or the command is backing off.
+ */
+void prefetch_queue(entry_t *e, const spawn_context_t *context);
+
+/* Fill the cached output of e for context now, unless it is already cached or
+ * being filled. Returns 0 on success, and -1 on failure or while the command
+ * of e backs off after failing (see reap.h).
+ */
+int prefetch_warm(entry_t *e, const spawn_context_t *context);
+
+/* Set the most commands run at once by prefetch_prewarm(), or 0 (the
+ * default) to disable prewarming.
+ */
+void prefetch_set_prewarm(int jobs);
+
+/* Fill the cached output of every eligible entry for the owner of the mount,
+ * running up to the configured number of commands at once, and wait for them
+ * all to finish. Meant to be called as a mount starts, before it serves any
+ * request, so the first readers don't all have to wait. Its children must be
+ * collected (see reap.h), so not before going into the background. The worker
+ * threads have exited again by the time this returns.
+ */
+void prefetch_prewarm(entry_t **entries, size_t entries_sz, uid_t uid,
+        gid_t gid);
+
+typedef struct {
+    unsigned long long queued;
+    unsigned long long dropped; /* Queue was full. */
+    unsigned long long filled;  /* Ran the command. */
+    unsigned long long failed;
+    /* Results of prefetch_prewarm(), over every mount. */
+    size_t prewarm_entries;
+    size_t prewarm_failed;
+    double prewarm_seconds;
+} prefetch_stats_t;
+
+void prefetch_get_stats(prefetch_stats_t *out);
+
+#endif
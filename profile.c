@@ -0,0 +1,360 @@
+/* Self-profiling. */
+
+#define _GNU_SOURCE /* asprintf(), syscall() */
+
+#include <assert.h>
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "entry.h"
+#include "log.h"
+#include "profile.h"
+
+typedef struct profile_totals {
+    /* The entry's path, NULL for operations. Entries reloaded with the same
+     * path carry on with the same totals.
+     */
+    char *path;
+    unsigned long long calls;
+    unsigned long long counts[PROFILE_COUNTERS];
+} totals_t;
+
+/* A thread's counters, opened as one group so they are read together. */
+typedef struct {
+    int leader; /* -1 if none could be opened. */
+    int fds[PROFILE_COUNTERS];
+    /* Position of each counter in a group read, or -1 if it isn't open. */
+    int index[PROFILE_COUNTERS];
+    int opened;
+} counters_t;
+
+static const char *op_names[PROFILE_OPS] = {
+    [PROFILE_GETATTR] = "getattr",
+    [PROFILE_FGETATTR] = "fgetattr",
+    [PROFILE_OPEN] = "open",
+    [PROFILE_READ] = "read",
+    [PROFILE_READ_BUF] = "read_buf",
+    [PROFILE_WRITE] = "write",
+    [PROFILE_POLL] = "poll",
+    [PROFILE_FLUSH] = "flush",
+    [PROFILE_RELEASE] = "release",
+    [PROFILE_READDIR] = "readdir",
+    [PROFILE_GETXATTR] = "getxattr",
+    [PROFILE_LISTXATTR] = "listxattr",
+};
+
+static const char *counter_names[PROFILE_COUNTERS] = {
+    [PROFILE_NS] = "ns",
+    [PROFILE_CYCLES] = "cycles",
+    [PROFILE_INSTRUCTIONS] = "instructions",
+    [PROFILE_CONTEXT_SWITCHES] = "context_switches",
+};
+
+static int enabled = 0;
+static char *dump_path = NULL;
+
+static pthread_key_t counters_key;
+static pthread_once_t counters_once = PTHREAD_ONCE_INIT;
+
+/* Updated atomically. */
+static totals_t ops[PROFILE_OPS];
+/* Entries that have been profiled, for reporting. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static totals_t **entries = NULL;
+static size_t entries_sz = 0;
+
+static void close_counters(void *arg) {
+    counters_t *c = arg;
+    int i;
+    for (i = 0; i < PROFILE_COUNTERS; ++i) {
+        if (c->fds[i] != -1) {
+            close(c->fds[i]);
+        }
+    }
+    free(c);
+}
+
+static void create_key(void) {
+    if (pthread_key_create(&counters_key, close_counters) != 0) {
+        LOG("Failed to create profile counters key");
+    }
+}
+
+static int open_counter(uint32_t type, uint64_t config, int group,
+        int exclude_kernel) {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.read_format = PERF_FORMAT_GROUP;
+    attr.exclude_kernel = exclude_kernel;
+    attr.exclude_hv = 1;
+    attr.disabled = group == -1;
+    /* This thread, on any CPU. */
+    return syscall(SYS_perf_event_open, &attr, 0, -1, group,
+        PERF_FLAG_FD_CLOEXEC);
+}
+
+/* Get this thread's counters, opening them if necessary. */
+static counters_t *thread_counters(void) {
+    (void)pthread_once(&counters_once, create_key);
+    counters_t *c = pthread_getspecific(counters_key);
+    if (c != NULL) {
+        return c;
+    }
+    c = malloc(sizeof(*c));
+    if (c == NULL) {
+        return NULL;
+    }
+    static const struct {
+        profile_counter_t counter;
+        uint32_t type;
+        uint64_t config;
+    } events[] = {
+        { PROFILE_CYCLES, PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PROFILE_INSTRUCTIONS, PERF_TYPE_HARDWARE,
+            PERF_COUNT_HW_INSTRUCTIONS },
+        { PROFILE_CONTEXT_SWITCHES, PERF_TYPE_SOFTWARE,
+            PERF_COUNT_SW_CONTEXT_SWITCHES },
+    };
+    /* Count time in the kernel too where we are allowed to, as much of
+     * serving a request is spent there.
+     */
+    int exclude_kernel;
+    for (exclude_kernel = 0; exclude_kernel <= 1; ++exclude_kernel) {
+        c->leader = -1;
+        c->opened = 0;
+        size_t i;
+        for (i = 0; i < PROFILE_COUNTERS; ++i) {
+            c->fds[i] = -1;
+            c->index[i] = -1;
+        }
+        for (i = 0; i < sizeof(events) / sizeof(events[0]); ++i) {
+            int fd = open_counter(events[i].type, events[i].config, c->leader,
+                exclude_kernel);
+            if (fd == -1) {
+                continue;
+            }
+            if (c->leader == -1) {
+                c->leader = fd;
+            }
+            c->fds[events[i].counter] = fd;
+            c->index[events[i].counter] = c->opened++;
+        }
+        if (c->leader != -1 || errno != EACCES) {
+            break;
+        }
+    }
+    if (c->leader != -1) {
+        ioctl(c->leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    } else {
+        LOG("No performance counters available, only timing operations");
+    }
+    if (pthread_setspecific(counters_key, c) != 0) {
+        close_counters(c);
+        return NULL;
+    }
+    return c;
+}
+
+/* Read the current counter values into values. */
+static void read_counters(unsigned long long values[PROFILE_COUNTERS]) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    memset(values, 0, sizeof(unsigned long long) * PROFILE_COUNTERS);
+    values[PROFILE_NS] = (unsigned long long)ts.tv_sec * 1000000000 +
+        ts.tv_nsec;
+
+    counters_t *c = thread_counters();
+    if (c == NULL || c->leader == -1) {
+        return;
+    }
+    uint64_t buf[1 + PROFILE_COUNTERS];
+    ssize_t sz = read(c->leader, buf, sizeof(uint64_t) * (1 + c->opened));
+    if (sz != (ssize_t)(sizeof(uint64_t) * (1 + c->opened))) {
+        return;
+    }
+    int i;
+    for (i = 0; i < PROFILE_COUNTERS; ++i) {
+        if (c->index[i] != -1) {
+            values[i] = buf[1 + c->index[i]];
+        }
+    }
+}
+
+int profile_enable(const char *path) {
+    free(dump_path);
+    dump_path = NULL;
+    if (path != NULL && *path == '/') {
+        dump_path = strdup(path);
+    } else if (path != NULL) {
+        /* Relative to where we started, not where we are when unmounting, as
+         * daemonising changes directory.
+         */
+        char *cwd = getcwd(NULL, 0);
+        if (cwd == NULL || asprintf(&dump_path, "%s/%s", cwd, path) == -1) {
+            dump_path = NULL;
+        }
+        free(cwd);
+    }
+    if (path != NULL && dump_path == NULL) {
+        return -1;
+    }
+    enabled = 1;
+    return 0;
+}
+
+int profile_enabled(void) {
+    return enabled;
+}
+
+void profile_begin(profile_sample_t *s) {
+    assert(s != NULL);
+    s->active = enabled;
+    if (s->active) {
+        read_counters(s->start);
+    }
+}
+
+static void add(totals_t *t,
+        const unsigned long long delta[PROFILE_COUNTERS]) {
+    __sync_fetch_and_add(&t->calls, 1);
+    int i;
+    for (i = 0; i < PROFILE_COUNTERS; ++i) {
+        __sync_fetch_and_add(&t->counts[i], delta[i]);
+    }
+}
+
+/* Get e's totals, creating them if necessary. */
+static totals_t *entry_totals(entry_t *e) {
+    totals_t *t = e->profile;
+    if (t != NULL) {
+        return t;
+    }
+    pthread_mutex_lock(&lock);
+    t = e->profile;
+    size_t i;
+    for (i = 0; t == NULL && i < entries_sz; ++i) {
+        if (!strcmp(entries[i]->path, e->path)) {
+            t = entries[i];
+            e->profile = t;
+        }
+    }
+    if (t == NULL) {
+        totals_t **tmp = realloc(entries,
+            sizeof(totals_t*) * (entries_sz + 1));
+        t = tmp == NULL ? NULL : calloc(1, sizeof(*t));
+        if (tmp != NULL) {
+            entries = tmp;
+        }
+        if (t != NULL && (t->path = strdup(e->path)) == NULL) {
+            free(t);
+            t = NULL;
+        }
+        if (t != NULL) {
+            entries[entries_sz++] = t;
+            __sync_synchronize();
+            e->profile = t;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return t;
+}
+
+void profile_end(profile_sample_t *s, profile_op_t op, entry_t *e) {
+    assert(s != NULL);
+    assert(op < PROFILE_OPS);
+    if (!s->active) {
+        return;
+    }
+    unsigned long long delta[PROFILE_COUNTERS];
+    read_counters(delta);
+    int i;
+    for (i = 0; i < PROFILE_COUNTERS; ++i) {
+        delta[i] -= s->start[i];
+    }
+    add(&ops[op], delta);
+    totals_t *t = e == NULL ? NULL : entry_totals(e);
+    if (t != NULL) {
+        add(t, delta);
+    }
+}
+
+static void format_totals(FILE *f, const char *prefix, const char *name,
+        totals_t *t) {
+    fprintf(f, "profile.%s.%s.calls %llu\n", prefix, name, t->calls);
+    int i;
+    for (i = 0; i < PROFILE_COUNTERS; ++i) {
+        fprintf(f, "profile.%s.%s.%s %llu\n", prefix, name, counter_names[i],
+            t->counts[i]);
+    }
+}
+
+void profile_format(FILE *f) {
+    assert(f != NULL);
+    if (!enabled) {
+        return;
+    }
+    int op;
+    for (op = 0; op < PROFILE_OPS; ++op) {
+        if (ops[op].calls > 0) {
+            format_totals(f, "op", op_names[op], &ops[op]);
+        }
+    }
+    pthread_mutex_lock(&lock);
+    size_t i;
+    for (i = 0; i < entries_sz; ++i) {
+        format_totals(f, "entry", entries[i]->path, entries[i]);
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+/* Write one row of the summary table, with means per call. */
+static void dump_row(FILE *f, const char *name, totals_t *t) {
+    double calls = t->calls == 0 ? 1 : t->calls;
+    fprintf(f, "%-24s %10llu %12.0f %12.0f %12.0f %10.3f\n", name, t->calls,
+        t->counts[PROFILE_NS] / calls, t->counts[PROFILE_CYCLES] / calls,
+        t->counts[PROFILE_INSTRUCTIONS] / calls,
+        t->counts[PROFILE_CONTEXT_SWITCHES] / calls);
+}
+
+void profile_dump(void) {
+    if (!enabled || dump_path == NULL) {
+        return;
+    }
+    FILE *f = fopen(dump_path, "w");
+    if (f == NULL) {
+        LOG("Failed to write profile to %s", dump_path);
+        return;
+    }
+    const char *header = "%-24s %10s %12s %12s %12s %10s\n";
+    fprintf(f, header, "operation", "calls", "ns/call", "cycles/call",
+        "insns/call", "cs/call");
+    int op;
+    for (op = 0; op < PROFILE_OPS; ++op) {
+        if (ops[op].calls > 0) {
+            dump_row(f, op_names[op], &ops[op]);
+        }
+    }
+    fprintf(f, "\n");
+    fprintf(f, header, "entry", "calls", "ns/call", "cycles/call",
+        "insns/call", "cs/call");
+    pthread_mutex_lock(&lock);
+    size_t i;
+    for (i = 0; i < entries_sz; ++i) {
+        dump_row(f, entries[i]->path, entries[i]);
+    }
+    pthread_mutex_unlock(&lock);
+    fclose(f);
+    LOG("Wrote profile to %s", dump_path);
+}
@@ -0,0 +1,66 @@
+#ifndef _EXECFS_PROFILE_H_
+#define _EXECFS_PROFILE_H_
+
+/* Self-profiling. With --profile, every FUSE operation is measured with
+ * counters of the thread serving it (see perf_event_open(2)) and the totals
+ * are kept per type of operation and per entry. They appear in the stats and
+ * are written to the profile file when execfs unmounts. Counters the kernel
+ * or hardware won't provide, as in many virtual machines, stay at zero; the
+ * elapsed time is always measured.
+ */
+
+#include <stdio.h>
+
+#include "entry.h"
+
+/* Operations measured. */
+typedef enum {
+    PROFILE_GETATTR,
+    PROFILE_FGETATTR,
+    PROFILE_OPEN,
+    PROFILE_READ,
+    PROFILE_READ_BUF,
+    PROFILE_WRITE,
+    PROFILE_POLL,
+    PROFILE_FLUSH,
+    PROFILE_RELEASE,
+    PROFILE_READDIR,
+    PROFILE_GETXATTR,
+    PROFILE_LISTXATTR,
+    PROFILE_OPS,
+} profile_op_t;
+
+typedef enum {
+    PROFILE_NS,
+    PROFILE_CYCLES,
+    PROFILE_INSTRUCTIONS,
+    PROFILE_CONTEXT_SWITCHES,
+    PROFILE_COUNTERS,
+} profile_counter_t;
+
+/* Counter values at the start of an operation. */
+typedef struct {
+    int active;
+    unsigned long long start[PROFILE_COUNTERS];
+} profile_sample_t;
+
+/* Turn profiling on, writing the summary to path (which may be NULL) when
+ * profile_dump() is called. Must be called before any operation is served.
+ * Returns 0 on success.
+ */
+int profile_enable(const char *path);
+int profile_enabled(void);
+
+void profile_begin(profile_sample_t *s);
+/* Add the counters since profile_begin() to op and e, which may be NULL for
+ * the root directory.
+ */
+void profile_end(profile_sample_t *s, profile_op_t op, entry_t *e);
+
+/* Render the totals as "name value" lines. */
+void profile_format(FILE *f);
+
+/* Write the totals to the profile file. */
+void profile_dump(void);
+
+#endif
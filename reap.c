@@ -0,0 +1,409 @@
+/* Collecting children. */
+
+#define _GNU_SOURCE /* pipe2() */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/pidfd.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "entry.h"
+#include "log.h"
+#include "reap.h"
+
+/* How often children are checked for when one couldn't be given a pidfd. */
+#define SCAN_MS 1000
+
+typedef struct {
+    pid_t pid;
+    /* Becomes readable when the child exits, or -1 if it couldn't be
+     * opened.
+     */
+    int pidfd;
+    entry_t *entry; /* NULL if it isn't running a command yet. Held. */
+} child_t;
+
+/* Protects everything below and the failure fields of entries. Entries are
+ * only released with it unlocked, as freeing one takes it (see reap_forget()).
+ */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t thread;
+static int running = 0;
+/* Written to wake the thread up, for new children and on shutdown. */
+static int wakeup[2] = {-1, -1};
+
+static child_t *children = NULL;
+static size_t children_sz = 0, children_cap = 0;
+/* Entries that have failed, in order of their first failure. */
+static entry_t **failed = NULL;
+static size_t failed_sz = 0;
+static unsigned long backoff_max = REAP_BACKOFF_MAX_MS;
+static reap_stats_t stats;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+void reap_set_backoff(unsigned long ms) {
+    pthread_mutex_lock(&lock);
+    backoff_max = ms;
+    pthread_mutex_unlock(&lock);
+}
+
+unsigned long reap_backoff(void) {
+    pthread_mutex_lock(&lock);
+    unsigned long ms = backoff_max;
+    pthread_mutex_unlock(&lock);
+    return ms;
+}
+
+/* Index of pid in children, or children_sz. Called with lock held. */
+static size_t find(pid_t pid) {
+    size_t i;
+    for (i = 0; i < children_sz && children[i].pid != pid; ++i) {
+    }
+    return i;
+}
+
+static uint64_t wall_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Update e after its command exited with status. Called with lock held. */
+static void account(entry_t *e, pid_t pid, int status) {
+    e->exits++;
+    /* Report a kill by signal the way the shell does. */
+    e->last_status = WIFEXITED(status) ? WEXITSTATUS(status) :
+        128 + WTERMSIG(status);
+    if (!WIFEXITED(status)) {
+        return;
+    }
+    if (WEXITSTATUS(status) == 0) {
+        if (e->fail_streak > 0) {
+            LOG("%s succeeded again after %u failures", e->path,
+                e->fail_streak);
+        }
+        e->fail_streak = 0;
+        e->fail_until = 0;
+        return;
+    }
+
+    if (e->failures == 0) {
+        entry_t **tmp = realloc(failed, sizeof(entry_t*) * (failed_sz + 1));
+        if (tmp != NULL) {
+            failed = tmp;
+            failed[failed_sz++] = e;
+        }
+    }
+    e->failures++;
+    e->fail_status = WEXITSTATUS(status);
+    e->fail_streak++;
+    stats.failures++;
+
+    unsigned int doublings = e->fail_streak - 1 < 20 ? e->fail_streak - 1 : 20;
+    uint64_t ms = (uint64_t)REAP_BACKOFF_MIN_MS << doublings;
+    if (ms > backoff_max) {
+        ms = backoff_max;
+    }
+    e->fail_until = ms == 0 ? 0 : now_ms() + ms;
+    LOG("Child %d running %s exited with %d, refusing opens for %llums",
+        pid, e->path, e->fail_status, (unsigned long long)ms);
+}
+
+/* Wake the thread up. */
+static void poke(void) {
+    (void)write(wakeup[1], "", 1);
+}
+
+/* Collect whichever of our children have exited. Only the pids we forked are
+ * waited for, so children of Lua's io.popen(), a plugin's system() or FUSE's
+ * fusermount are left to whoever started them. Called with lock held.
+ */
+static void collect(void) {
+    size_t i = 0;
+    while (i < children_sz) {
+        int status;
+        pid_t pid = waitpid(children[i].pid, &status, WNOHANG);
+        if (pid == 0 || (pid == -1 && errno == EINTR)) {
+            ++i;
+            continue;
+        }
+        entry_t *e = children[i].entry;
+        if (pid > 0) {
+            stats.exits++;
+            if (e != NULL) {
+                account(e, pid, status);
+            }
+        }
+        /* Otherwise it isn't our child, such as a record inherited across
+         * daemonising, so someone else collects it.
+         */
+        if (children[i].pidfd != -1) {
+            close(children[i].pidfd);
+        }
+        children[i] = children[--children_sz];
+        pthread_mutex_unlock(&lock);
+        entry_release(e);
+        pthread_mutex_lock(&lock);
+    }
+}
+
+static void *reap_main(void *arg) {
+    struct pollfd *p = NULL;
+    size_t p_cap = 0;
+    pthread_mutex_lock(&lock);
+    while (running) {
+        collect();
+
+        /* Wait for a child to exit or for a new one to watch. */
+        if (p_cap < children_sz + 1) {
+            struct pollfd *tmp = realloc(p, sizeof(*p) * (children_sz + 1));
+            if (tmp != NULL) {
+                p = tmp;
+                p_cap = children_sz + 1;
+            }
+        }
+        int timeout = -1;
+        nfds_t n = 0;
+        if (p_cap > 0) {
+            p[n].fd = wakeup[0];
+            p[n++].events = POLLIN;
+        }
+        size_t i;
+        for (i = 0; i < children_sz; ++i) {
+            if (children[i].pidfd == -1 || n == p_cap) {
+                timeout = SCAN_MS;
+            } else {
+                p[n].fd = children[i].pidfd;
+                p[n++].events = POLLIN;
+            }
+        }
+        pthread_mutex_unlock(&lock);
+
+        if (n == 0) {
+            /* Out of memory, so fall back to checking now and then. */
+            usleep(SCAN_MS * 1000);
+        } else if (poll(p, n, timeout) > 0 && p[0].revents != 0) {
+            char buf[64];
+            while (read(wakeup[0], buf, sizeof(buf)) > 0) {
+            }
+        }
+        pthread_mutex_lock(&lock);
+    }
+    pthread_mutex_unlock(&lock);
+    free(p);
+    return NULL;
+}
+
+int reap_start(void) {
+    pthread_mutex_lock(&lock);
+    if (running) {
+        pthread_mutex_unlock(&lock);
+        return 0;
+    }
+    if (pipe2(wakeup, O_CLOEXEC|O_NONBLOCK) != 0) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    running = 1;
+    if (pthread_create(&thread, NULL, reap_main, NULL) != 0) {
+        running = 0;
+        close(wakeup[0]);
+        close(wakeup[1]);
+        wakeup[0] = wakeup[1] = -1;
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+void reap_stop(void) {
+    pthread_mutex_lock(&lock);
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    running = 0;
+    poke();
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+
+    pthread_mutex_lock(&lock);
+    close(wakeup[0]);
+    close(wakeup[1]);
+    wakeup[0] = wakeup[1] = -1;
+    child_t *left = children;
+    size_t left_sz = children_sz, i;
+    children = NULL;
+    children_sz = children_cap = 0;
+    pthread_mutex_unlock(&lock);
+    for (i = 0; i < left_sz; ++i) {
+        if (left[i].pidfd != -1) {
+            close(left[i].pidfd);
+        }
+        entry_release(left[i].entry);
+    }
+    free(left);
+}
+
+pid_t reap_fork(entry_t *e) {
+    /* Hold the lock until the child is recorded, so a stale record of the
+     * same pid can't be taken for it in between. The kernel serialises forks
+     * of one process anyway.
+     */
+    pthread_mutex_lock(&lock);
+    if (children_sz == children_cap) {
+        size_t cap = children_cap == 0 ? 16 : children_cap * 2;
+        child_t *tmp = realloc(children, sizeof(child_t) * cap);
+        if (tmp == NULL) {
+            pthread_mutex_unlock(&lock);
+            errno = ENOMEM;
+            return -1;
+        }
+        children = tmp;
+        children_cap = cap;
+    }
+    entry_t *stale = NULL;
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* Our copy of the lock is never released, but the child only execs
+         * or exits.
+         */
+        return 0;
+    } else if (pid > 0) {
+        /* A stale record of the same pid, such as one inherited across
+         * daemonising, has been collected by someone else.
+         */
+        size_t i = find(pid);
+        if (i == children_sz) {
+            children_sz++;
+        } else {
+            stale = children[i].entry;
+            if (children[i].pidfd != -1) {
+                close(children[i].pidfd);
+            }
+        }
+        children[i].pid = pid;
+        /* Without one the thread checks for the child now and then. */
+        children[i].pidfd = pidfd_open(pid, 0);
+        children[i].entry = e;
+        if (e != NULL) {
+            entry_hold(e);
+            e->last_run_ns = wall_ns();
+        }
+        if (running) {
+            poke();
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    entry_release(stale);
+    return pid;
+}
+
+void reap_assign(pid_t pid, entry_t *e) {
+    entry_t *old = NULL;
+    pthread_mutex_lock(&lock);
+    size_t i = find(pid);
+    if (i < children_sz) {
+        old = children[i].entry;
+        children[i].entry = e;
+        entry_hold(e);
+        e->last_run_ns = wall_ns();
+    }
+    pthread_mutex_unlock(&lock);
+    entry_release(old);
+}
+
+void reap_forget(entry_t *e) {
+    assert(e != NULL);
+    pthread_mutex_lock(&lock);
+    size_t i;
+    for (i = 0; i < failed_sz; ++i) {
+        if (failed[i] == e) {
+            memmove(&failed[i], &failed[i + 1],
+                sizeof(entry_t*) * (failed_sz - i - 1));
+            failed_sz--;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+int reap_refuse(entry_t *e) {
+    assert(e != NULL);
+    pthread_mutex_lock(&lock);
+    int refuse = e->fail_until != 0 && now_ms() < e->fail_until;
+    if (refuse) {
+        stats.refused++;
+    }
+    pthread_mutex_unlock(&lock);
+    return refuse;
+}
+
+void reap_get_last(entry_t *e, reap_last_t *out) {
+    assert(e != NULL);
+    assert(out != NULL);
+    pthread_mutex_lock(&lock);
+    out->started_ns = e->last_run_ns;
+    out->exited = e->exits > 0;
+    out->status = e->last_status;
+    pthread_mutex_unlock(&lock);
+}
+
+void reap_get_stats(reap_stats_t *out) {
+    assert(out != NULL);
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    out->children = children_sz;
+    pthread_mutex_unlock(&lock);
+}
+
+int reap_get_failures(reap_failure_t **out, size_t *out_sz) {
+    assert(out != NULL);
+    assert(out_sz != NULL);
+    pthread_mutex_lock(&lock);
+    *out = malloc(sizeof(reap_failure_t) * (failed_sz + 1));
+    if (*out == NULL) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    size_t i;
+    for (i = 0; i < failed_sz; ++i) {
+        /* Copied, as the entry may be freed once we unlock. */
+        (*out)[i].path = strdup(failed[i]->path);
+        if ((*out)[i].path == NULL) {
+            pthread_mutex_unlock(&lock);
+            reap_free_failures(*out, i);
+            return -1;
+        }
+        (*out)[i].failures = failed[i]->failures;
+        (*out)[i].status = failed[i]->fail_status;
+        (*out)[i].streak = failed[i]->fail_streak;
+    }
+    *out_sz = failed_sz;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+void reap_free_failures(reap_failure_t *failures, size_t failures_sz) {
+    size_t i;
+    for (i = 0; i < failures_sz; ++i) {
+        free(failures[i].path);
+    }
+    free(failures);
+}
@@ -0,0 +1,89 @@
+#ifndef _EXECFS_REAP_H_
+#define _EXECFS_REAP_H_
+
+/* Collecting children. Every command is forked through reap_fork(), which
+ * remembers the entry it runs for, and a background thread waits for them to
+ * exit. Only those children are waited for, so other code in the process can
+ * still wait for the ones it starts. A command that exits with a nonzero status has failed: opens of its
+ * entry are refused with EIO for a while rather than forking it again, for
+ * REAP_BACKOFF_MIN_MS at first and twice as long after each further failure
+ * in a row, up to the limit set by reap_set_backoff(). A successful run ends
+ * the backoff. Commands killed by a signal, as a command whose reader went
+ * away is, haven't failed.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "entry.h"
+
+/* Backoff after the first failure. */
+#define REAP_BACKOFF_MIN_MS 100
+/* Default longest backoff. */
+#define REAP_BACKOFF_MAX_MS 30000
+
+/* Set the longest backoff in milliseconds. 0 disables backing off, though
+ * failures are still counted.
+ */
+void reap_set_backoff(unsigned long ms);
+unsigned long reap_backoff(void);
+
+/* Start the thread collecting children. Children that exit before it runs
+ * are collected once it does. Returns 0 on success.
+ */
+int reap_start(void);
+void reap_stop(void);
+
+/* fork(), recording that the child runs e's command. e may be NULL for a
+ * child that hasn't been given a command yet (see reap_assign()). e is held
+ * until the child is collected. Returns as fork() does.
+ */
+pid_t reap_fork(entry_t *e);
+
+/* Record that the child pid, forked with no entry, now runs e's command. Does
+ * nothing if it has already been collected.
+ */
+void reap_assign(pid_t pid, entry_t *e);
+
+/* Drop e's failures from the list, as e is being freed. */
+void reap_forget(entry_t *e);
+
+/* Whether opens of e should be refused because its command is backing off
+ * after failing.
+ */
+int reap_refuse(entry_t *e);
+
+/* The latest runs of an entry's command. */
+typedef struct {
+    uint64_t started_ns; /* When one last started, 0 if never. */
+    int exited;          /* Whether any has exited yet. */
+    int status;          /* Of the last to exit, 128 + signal if killed. */
+} reap_last_t;
+
+void reap_get_last(entry_t *e, reap_last_t *out);
+
+typedef struct {
+    unsigned long long exits;    /* Children collected. */
+    unsigned long long failures; /* Of those, ones that failed. */
+    unsigned long long refused;  /* Opens refused while backing off. */
+    size_t children;             /* Children running now. */
+} reap_stats_t;
+
+void reap_get_stats(reap_stats_t *out);
+
+/* How the command of an entry has failed. */
+typedef struct {
+    char *path;
+    unsigned long long failures;
+    int status;          /* Exit status of the last failure. */
+    unsigned int streak; /* Failures since the last success. */
+} reap_failure_t;
+
+/* List the entries whose command has ever failed, in an array to be freed
+ * with reap_free_failures(). Returns 0 on success.
+ */
+int reap_get_failures(reap_failure_t **out, size_t *out_sz);
+void reap_free_failures(reap_failure_t *failures, size_t failures_sz);
+
+#endif
@@ -0,0 +1,263 @@
+/* Periodic refreshing of scheduled entries. */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cache.h"
+#include "config.h"
+#include "entry.h"
+#include "log.h"
+#include "schedule.h"
+#include "spawn.h"
+#include "workq.h"
+
+/* Default for the most commands run at once for scheduled entries. */
+#define SCHEDULE_WORKERS 4
+/* Largest random change to an interval, in percent. */
+#define JITTER_PERCENT 10
+
+typedef struct {
+    entry_t *entry;
+    uint64_t due; /* Monotonic milliseconds. */
+    int busy;     /* A run is queued or in progress. */
+} slot_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled on shutdown. Uses the monotonic clock. */
+static pthread_cond_t wake;
+static pthread_t thread;
+static int running = 0;
+
+/* Individually allocated, so running jobs keep their slot when more are
+ * added.
+ */
+static slot_t **slots = NULL;
+static size_t slots_sz = 0;
+static workq_t *workers = NULL;
+static int workers_sz = SCHEDULE_WORKERS;
+static spawn_context_t owner;
+static unsigned int seed;
+static schedule_stats_t stats;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* A random amount of up to JITTER_PERCENT of ms either side of zero. Called
+ * with lock held.
+ */
+static int64_t jitter(uint64_t ms) {
+    int64_t range = ms * JITTER_PERCENT / 100;
+    if (range == 0) {
+        return 0;
+    }
+    return (int64_t)(rand_r(&seed) % (2 * range + 1)) - range;
+}
+
+/* Run the command of e as context and store its output. Returns 0 on
+ * success.
+ */
+static int run(entry_t *e, const spawn_context_t *context) {
+    char *key = cache_key(e, context->uid, context->gid, context->pid);
+    char *data = NULL;
+    size_t data_sz;
+    int rest;
+    int err = key == NULL ? -1 : spawn_capture(e, context, cache_max_object(),
+        &data, &data_sz, &rest);
+    if (err == 0) {
+        LOG("Refreshed %zu bytes of output of %s", data_sz, e->path);
+        err = cache_store(e, key, data, data_sz);
+    } else if (err == 1) {
+        LOG("Output of %s too large to cache", e->path);
+        close(rest);
+        free(data);
+    } else {
+        LOG("Run of %s failed", e->path);
+    }
+    free(key);
+    return err;
+}
+
+static void refresh(void *arg) {
+    slot_t *slot = arg;
+    int err = run(slot->entry, &owner);
+
+    pthread_mutex_lock(&lock);
+    slot->busy = 0;
+    stats.runs++;
+    if (err != 0) {
+        stats.failed++;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+static void *schedule_main(void *arg) {
+    pthread_mutex_lock(&lock);
+    while (running) {
+        uint64_t now = now_ms();
+        uint64_t next = UINT64_MAX;
+        size_t i;
+        for (i = 0; i < slots_sz; ++i) {
+            slot_t *slot = slots[i];
+            if (slot->due <= now) {
+                if (slot->busy) {
+                    LOG("Skipping scheduled run of %s, the last is still "
+                        "going", slot->entry->path);
+                    stats.skipped++;
+                } else if (workq_submit(workers, refresh, slot) == 0) {
+                    slot->busy = 1;
+                }
+                uint64_t every = slot->entry->every * 1000;
+                slot->due = now + every + jitter(every);
+            }
+            if (slot->due < next) {
+                next = slot->due;
+            }
+        }
+
+        struct timespec ts = {
+            .tv_sec = next / 1000,
+            .tv_nsec = (next % 1000) * 1000000,
+        };
+        pthread_cond_timedwait(&wake, &lock, &ts);
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int schedule_add(entry_t **entries, size_t entries_sz, uid_t uid,
+        gid_t gid) {
+    assert(entries != NULL || entries_sz == 0);
+    size_t i, n = 0;
+    for (i = 0; i < entries_sz; ++i) {
+        if (entries[i]->every > 0) {
+            n++;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    slot_t **tmp = realloc(slots, sizeof(slot_t*) * (slots_sz + n));
+    if (tmp == NULL) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    slots = tmp;
+
+    if (!running) {
+        workers = workq_create(workers_sz, 0, NULL);
+        if (workers == NULL) {
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        owner.uid = uid;
+        owner.gid = gid;
+        owner.pid = getpid();
+        owner.flags = O_RDONLY;
+        seed = (unsigned int)time(NULL) ^ (unsigned int)getpid();
+
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&wake, &attr);
+        pthread_condattr_destroy(&attr);
+
+        running = 1;
+        if (pthread_create(&thread, NULL, schedule_main, NULL) != 0) {
+            running = 0;
+            pthread_cond_destroy(&wake);
+            workq_destroy(workers);
+            workers = NULL;
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+    }
+
+    /* Spread the first runs over the first tenth of each interval. */
+    uint64_t now = now_ms();
+    for (i = 0; i < entries_sz; ++i) {
+        if (entries[i]->every == 0) {
+            continue;
+        }
+        slot_t *slot = calloc(1, sizeof(*slot));
+        if (slot == NULL) {
+            break;
+        }
+        uint64_t every = entries[i]->every * 1000;
+        slot->entry = entries[i];
+        entry_hold(slot->entry);
+        slot->due = now + every * JITTER_PERCENT / 100 / 2 +
+            jitter(every) / 2;
+        slots[slots_sz++] = slot;
+    }
+    stats.entries = slots_sz;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    LOG("Scheduled %zu entries", n);
+    return i == entries_sz ? 0 : -1;
+}
+
+int schedule_refresh(entry_t *e, uid_t uid, gid_t gid) {
+    assert(e != NULL);
+    spawn_context_t context = {
+        .uid = uid,
+        .gid = gid,
+        .pid = getpid(),
+        .flags = O_RDONLY,
+    };
+    return run(e, &context) == 0 ? 0 : -1;
+}
+
+int schedule_set_workers(int n) {
+    assert(n > 0);
+    pthread_mutex_lock(&lock);
+    workers_sz = n;
+    int err = workers == NULL ? 0 : workq_set_threads(workers, n);
+    pthread_mutex_unlock(&lock);
+    return err;
+}
+
+void schedule_stop(void) {
+    pthread_mutex_lock(&lock);
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    running = 0;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+
+    /* Runs in progress take the lock as they finish. */
+    workq_destroy(workers);
+    pthread_mutex_lock(&lock);
+    workers = NULL;
+    size_t i;
+    for (i = 0; i < slots_sz; ++i) {
+        entry_release(slots[i]->entry);
+        free(slots[i]);
+    }
+    free(slots);
+    slots = NULL;
+    slots_sz = 0;
+    pthread_cond_destroy(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+void schedule_get_stats(schedule_stats_t *out) {
+    assert(out != NULL);
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,47 @@
+#ifndef _EXECFS_SCHEDULE_H_
+#define _EXECFS_SCHEDULE_H_
+
+/* Periodic refreshing of entries with an every= schedule. One timer thread
+ * tracks when each entry is due and hands the runs to a small worker pool.
+ * The new output replaces the cached one when the command finishes, so
+ * readers are always served from memory and never wait for the command.
+ *
+ * Each interval is randomly stretched or shrunk by up to a tenth, so entries
+ * sharing a schedule drift apart instead of all running at once.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "entry.h"
+
+/* Start refreshing the scheduled entries among entries, running commands as
+ * the mount owner uid/gid. The timer thread is started by the first call
+ * that has anything to schedule and serves every mount. Returns 0 on
+ * success.
+ */
+int schedule_add(entry_t **entries, size_t entries_sz, uid_t uid,
+        gid_t gid);
+/* Stop the timer thread and forget every scheduled entry. */
+void schedule_stop(void);
+
+/* Run the command of the globally cached entry e now, as uid/gid, and replace
+ * its cached output. Returns 0 on success.
+ */
+int schedule_refresh(entry_t *e, uid_t uid, gid_t gid);
+
+/* Set the most commands run at once for scheduled entries (default 4).
+ * Returns 0 on success.
+ */
+int schedule_set_workers(int n);
+
+typedef struct {
+    size_t entries;
+    unsigned long long runs;
+    unsigned long long failed;
+    unsigned long long skipped; /* Previous run was still going. */
+} schedule_stats_t;
+
+void schedule_get_stats(schedule_stats_t *out);
+
+#endif
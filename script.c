@@ -0,0 +1,329 @@
+/* Embedded Lua generators. */
+
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "script.h"
+
+#define DPRINTF(args...) \
+    do { \
+        if (debug_printf != NULL) { \
+            debug_printf(args); \
+        } \
+    } while (0)
+
+#ifdef EXECFS_LUA
+
+#include <pthread.h>
+
+#include <lua.h>
+#include <lauxlib.h>
+#include <lualib.h>
+
+struct script {
+    /* Precompiled bytecode of the script. */
+    char *bytecode;
+    size_t bytecode_sz;
+    char *name;
+    /* Never reused, unlike the script's address, so an interpreter can't
+     * mistake a script compiled by a reload for one it loaded before.
+     */
+    unsigned long long id;
+    struct script *next;
+};
+
+/* Registry keys of each interpreter's table of loaded scripts, keyed by id,
+ * and of the number of frees it last purged that table after.
+ */
+#define SCRIPTS_KEY "execfs.scripts"
+#define FREES_KEY "execfs.frees"
+
+/* Protects live. */
+static pthread_mutex_t live_lock = PTHREAD_MUTEX_INITIALIZER;
+/* Scripts not yet freed. */
+static script_t *live = NULL;
+static unsigned long long next_id = 0;
+/* Scripts freed so far. */
+static unsigned long frees = 0;
+
+/* One interpreter per thread, closed when the thread exits. */
+static pthread_key_t state_key;
+static pthread_once_t state_once = PTHREAD_ONCE_INIT;
+
+static void close_state(void *L) {
+    lua_close(L);
+}
+
+static void create_key(void) {
+    if (pthread_key_create(&state_key, close_state) != 0) {
+        LOG("Failed to create Lua interpreter key");
+    }
+}
+
+/* execfs.readfile(path) */
+static int lua_readfile(lua_State *L) {
+    const char *path = luaL_checkstring(L, 1);
+    FILE *f = fopen(path, "r");
+    if (f == NULL) {
+        lua_pushnil(L);
+        lua_pushstring(L, strerror(errno));
+        return 2;
+    }
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    size_t sz;
+    do {
+        char *p = luaL_prepbuffer(&b);
+        sz = fread(p, 1, LUAL_BUFFERSIZE, f);
+        luaL_addsize(&b, sz);
+    } while (sz == LUAL_BUFFERSIZE);
+    int failed = ferror(f);
+    fclose(f);
+    if (failed) {
+        lua_pushnil(L);
+        lua_pushstring(L, "read error");
+        return 2;
+    }
+    luaL_pushresult(&b);
+    return 1;
+}
+
+/* Get this thread's interpreter, creating it if necessary. */
+static lua_State *thread_state(void) {
+    (void)pthread_once(&state_once, create_key);
+    lua_State *L = pthread_getspecific(state_key);
+    if (L != NULL) {
+        return L;
+    }
+
+    L = luaL_newstate();
+    if (L == NULL) {
+        return NULL;
+    }
+    luaL_openlibs(L);
+    lua_newtable(L);
+    lua_setfield(L, LUA_REGISTRYINDEX, SCRIPTS_KEY);
+    lua_pushinteger(L, __sync_fetch_and_add(&frees, 0));
+    lua_setfield(L, LUA_REGISTRYINDEX, FREES_KEY);
+    lua_newtable(L);
+    lua_pushcfunction(L, lua_readfile);
+    lua_setfield(L, -2, "readfile");
+    lua_setglobal(L, "execfs");
+    if (pthread_setspecific(state_key, L) != 0) {
+        lua_close(L);
+        return NULL;
+    }
+    return L;
+}
+
+static int dump_writer(lua_State *L, const void *p, size_t sz, void *ud) {
+    script_t *s = ud;
+    char *tmp = realloc(s->bytecode, s->bytecode_sz + sz);
+    if (tmp == NULL) {
+        return 1;
+    }
+    memcpy(tmp + s->bytecode_sz, p, sz);
+    s->bytecode = tmp;
+    s->bytecode_sz += sz;
+    return 0;
+}
+
+script_t *script_compile(const char *source,
+        int(*debug_printf)(char *format, ...)) {
+    assert(source != NULL);
+    script_t *s = calloc(1, sizeof(*s));
+    lua_State *L = luaL_newstate();
+    if (s == NULL || L == NULL) {
+        DPRINTF("Out of memory in %s\n", __func__);
+        goto script_compile_fail;
+    }
+
+    int ret;
+    if (source[0] == '@') {
+        s->name = strdup(source);
+        ret = s->name == NULL ? LUA_ERRMEM : luaL_loadfile(L, source + 1);
+    } else {
+        s->name = strdup("=config");
+        ret = s->name == NULL ? LUA_ERRMEM :
+            luaL_loadbuffer(L, source, strlen(source), s->name);
+    }
+    if (ret != LUA_OK) {
+        DPRINTF("Failed to compile Lua script: %s\n",
+            ret == LUA_ERRMEM ? "out of memory" : lua_tostring(L, -1));
+        errno = EINVAL;
+        goto script_compile_fail;
+    }
+    if (lua_dump(L, dump_writer, s, 0) != 0) {
+        DPRINTF("Out of memory in %s\n", __func__);
+        goto script_compile_fail;
+    }
+    lua_close(L);
+    pthread_mutex_lock(&live_lock);
+    s->id = ++next_id;
+    s->next = live;
+    live = s;
+    pthread_mutex_unlock(&live_lock);
+    return s;
+
+script_compile_fail:
+    if (L != NULL) {
+        lua_close(L);
+    }
+    script_free(s);
+    return NULL;
+}
+
+void script_free(script_t *s) {
+    if (s == NULL) {
+        return;
+    }
+    if (s->id != 0) {
+        pthread_mutex_lock(&live_lock);
+        script_t **p = &live;
+        while (*p != s) {
+            p = &(*p)->next;
+        }
+        *p = s->next;
+        pthread_mutex_unlock(&live_lock);
+        __sync_fetch_and_add(&frees, 1);
+    }
+    free(s->bytecode);
+    free(s->name);
+    free(s);
+}
+
+/* Drop the scripts freed since the last purge from the table of loaded
+ * scripts at the top of L's stack, so reloads don't grow it forever.
+ */
+static void purge_scripts(lua_State *L) {
+    unsigned long n = __sync_fetch_and_add(&frees, 0);
+    lua_getfield(L, LUA_REGISTRYINDEX, FREES_KEY);
+    int current = (unsigned long)lua_tointeger(L, -1) == n;
+    lua_pop(L, 1);
+    if (current) {
+        return;
+    }
+
+    pthread_mutex_lock(&live_lock);
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0) {
+        lua_pop(L, 1);
+        unsigned long long id = (unsigned long long)lua_tointeger(L, -1);
+        const script_t *p = live;
+        while (p != NULL && p->id != id) {
+            p = p->next;
+        }
+        if (p == NULL) {
+            /* Clearing fields during traversal is allowed. */
+            lua_pushvalue(L, -1);
+            lua_pushnil(L);
+            lua_rawset(L, -4);
+        }
+    }
+    pthread_mutex_unlock(&live_lock);
+    lua_pushinteger(L, n);
+    lua_setfield(L, LUA_REGISTRYINDEX, FREES_KEY);
+}
+
+/* Push the script's function in this thread's interpreter, loading it on
+ * first use. Each script gets its own global table, backed by the real
+ * globals, which is where it can keep state between runs.
+ */
+static int push_script(lua_State *L, script_t *s) {
+    lua_getfield(L, LUA_REGISTRYINDEX, SCRIPTS_KEY);  /* scripts */
+    if (lua_rawgeti(L, -1, s->id) == LUA_TFUNCTION) {  /* scripts, fn */
+        lua_remove(L, -2);
+        return 0;
+    }
+    lua_pop(L, 1);
+    purge_scripts(L);
+
+    if (luaL_loadbufferx(L, s->bytecode, s->bytecode_sz, s->name, "b") != LUA_OK) {
+        LOG("Failed to load Lua bytecode: %s", lua_tostring(L, -1));
+        lua_pop(L, 2);
+        return -1;
+    }
+    lua_newtable(L);                    /* env */
+    lua_newtable(L);                    /* env, mt */
+    lua_pushglobaltable(L);             /* env, mt, _G */
+    lua_setfield(L, -2, "__index");     /* env, mt */
+    lua_setmetatable(L, -2);            /* env */
+    if (lua_setupvalue(L, -2, 1) == NULL) { /* _ENV is the chunk's only upvalue. */
+        lua_pop(L, 1);
+    }
+    lua_pushvalue(L, -1);               /* scripts, fn, fn */
+    lua_rawseti(L, -3, s->id);          /* scripts, fn */
+    lua_remove(L, -2);
+    return 0;
+}
+
+int script_run(script_t *s, const char *path, uid_t uid, gid_t gid, pid_t pid,
+        char **out, size_t *out_sz) {
+    assert(s != NULL);
+    assert(out != NULL);
+    assert(out_sz != NULL);
+    lua_State *L = thread_state();
+    if (L == NULL) {
+        return -ENOMEM;
+    }
+
+    int top = lua_gettop(L);
+    lua_getglobal(L, "execfs");
+    lua_pushstring(L, path);
+    lua_setfield(L, -2, "path");
+    lua_pushinteger(L, uid);
+    lua_setfield(L, -2, "uid");
+    lua_pushinteger(L, gid);
+    lua_setfield(L, -2, "gid");
+    lua_pushinteger(L, pid);
+    lua_setfield(L, -2, "pid");
+    lua_pop(L, 1);
+
+    if (push_script(L, s) != 0) {
+        return -EIO;
+    }
+    if (lua_pcall(L, 0, 1, 0) != LUA_OK) {
+        LOG("Lua script for %s failed: %s", path, lua_tostring(L, -1));
+        lua_settop(L, top);
+        return -EIO;
+    }
+
+    size_t len = 0;
+    const char *result = "";
+    if (!lua_isnil(L, -1)) {
+        result = luaL_tolstring(L, -1, &len);
+    }
+    *out = malloc(len > 0 ? len : 1);
+    if (*out == NULL) {
+        lua_settop(L, top);
+        return -ENOMEM;
+    }
+    memcpy(*out, result, len);
+    *out_sz = len;
+    lua_settop(L, top);
+    return 0;
+}
+
+#else /* !EXECFS_LUA */
+
+script_t *script_compile(const char *source,
+        int(*debug_printf)(char *format, ...)) {
+    DPRINTF("execfs was built without Lua support (build with LUA=1)\n");
+    errno = ENOTSUP;
+    return NULL;
+}
+
+void script_free(script_t *s) {
+    assert(s == NULL);
+}
+
+int script_run(script_t *s, const char *path, uid_t uid, gid_t gid, pid_t pid,
+        char **out, size_t *out_sz) {
+    return -ENOTSUP;
+}
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _EXECFS_SCRIPT_H_
+#define _EXECFS_SCRIPT_H_
+
+/* Lua scripts run inside execfs. Scripts are compiled once when the
+ * configuration is read. Each FUSE worker thread lazily creates its own Lua
+ * interpreter and loads each script into it the first time it is needed, so
+ * scripts run concurrently without locking and globals a script sets persist
+ * between opens handled by the same thread.
+ *
+ * A script is run on each open of its entry and whatever it returns, converted
+ * to a string, becomes the contents of the file. The table execfs holds path,
+ * uid, gid and pid describing the open, and execfs.readfile(path) returns the
+ * contents of a file (or nil and an error message).
+ *
+ * Lua support is optional. Without it script_compile() always fails.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct script script_t;
+
+/* Compile source, or the file it names if it starts with '@'. Returns NULL on
+ * failure, after explaining why through debug_printf.
+ */
+script_t *script_compile(const char *source,
+        int(*debug_printf)(char *format, ...));
+void script_free(script_t *s);
+
+/* Run a script for an open of path by the given process. On success returns 0
+ * and a malloced buffer of the output in *out. Returns a negative errno on
+ * failure.
+ */
+int script_run(script_t *s, const char *path, uid_t uid, gid_t gid, pid_t pid,
+        char **out, size_t *out_sz);
+
+#endif
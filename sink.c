@@ -0,0 +1,252 @@
+/* Shared sinks. */
+
+#define _GNU_SOURCE /* memrchr() */
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "entry.h"
+#include "log.h"
+#include "reap.h"
+#include "sink.h"
+#include "spawn.h"
+
+typedef struct {
+    entry_t *entry;
+    pthread_mutex_t lock; /* Held while writing to the child. */
+    pid_t pid;
+    int fd; /* The child's stdin, or -1 if it isn't running. */
+} sink_t;
+
+struct sink_writer {
+    sink_t *sink;
+    char *pending; /* Start of the writer's unfinished line. */
+    size_t pending_sz;
+};
+
+/* Protects sinks and stats. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static sink_t **sinks = NULL;
+static size_t sinks_sz = 0;
+static sink_stats_t stats;
+
+/* Whether a and b feed the same child. Like cached output, a sink is shared
+ * by entries of different mounts with the same path and command.
+ */
+static int same_sink(entry_t *a, entry_t *b) {
+    return a == b ||
+        (!strcmp(a->path, b->path) && !strcmp(a->command, b->command));
+}
+
+/* Start the child. Called with s->lock held. Returns 0 on success. */
+static int start(sink_t *s) {
+    /* The child outlives any one writer, so it runs as execfs itself. */
+    spawn_context_t context = {
+        .uid = geteuid(),
+        .gid = getegid(),
+        .pid = getpid(),
+        .flags = O_WRONLY,
+    };
+    if (reap_refuse(s->entry)) {
+        /* It keeps failing, so don't fork it again for every write. */
+        LOG("Not starting sink %s while it backs off", s->entry->command);
+        return -1;
+    }
+    int readfd;
+    s->pid = spawn_command(s->entry, O_WRONLY, &context, &readfd, &s->fd);
+    if (s->pid == -1) {
+        LOG("Failed to start sink %s", s->entry->command);
+        return -1;
+    }
+    LOG("Started sink %s as child %d", s->entry->command, s->pid);
+    pthread_mutex_lock(&lock);
+    stats.started++;
+    pthread_mutex_unlock(&lock);
+    return 0;
+}
+
+/* Write all of iov to the child, starting it if needed and once more if it
+ * has exited. Returns 0 on success or a negative errno.
+ */
+static int emit(sink_t *s, struct iovec *iov, int iov_sz) {
+    size_t total = 0;
+    int i;
+    for (i = 0; i < iov_sz; ++i) {
+        total += iov[i].iov_len;
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    int err = 0, restarts = 0;
+    pthread_mutex_lock(&s->lock);
+    while (iov_sz > 0) {
+        if (s->fd == -1 && start(s) != 0) {
+            err = -EIO;
+            break;
+        }
+        ssize_t sz = writev(s->fd, iov, iov_sz);
+        if (sz == -1 && errno == EINTR) {
+            continue;
+        } else if (sz == -1) {
+            err = -errno;
+            close(s->fd);
+            s->fd = -1;
+            if (err != -EPIPE || restarts++ > 0) {
+                break;
+            }
+            LOG("Sink %s exited, restarting it", s->entry->command);
+            err = 0;
+            continue;
+        }
+        /* Skip what was written. */
+        while (iov_sz > 0 && (size_t)sz >= iov->iov_len) {
+            sz -= iov->iov_len;
+            iov++;
+            iov_sz--;
+        }
+        if (iov_sz > 0) {
+            iov->iov_base = (char*)iov->iov_base + sz;
+            iov->iov_len -= sz;
+        }
+    }
+    pthread_mutex_unlock(&s->lock);
+
+    if (err == 0) {
+        pthread_mutex_lock(&lock);
+        stats.writes++;
+        stats.bytes += total;
+        pthread_mutex_unlock(&lock);
+    }
+    return err;
+}
+
+sink_writer_t *sink_open(entry_t *e) {
+    assert(e != NULL);
+    sink_writer_t *w = calloc(1, sizeof(*w));
+    if (w == NULL) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&lock);
+    size_t i;
+    for (i = 0; i < sinks_sz && w->sink == NULL; ++i) {
+        if (same_sink(sinks[i]->entry, e)) {
+            w->sink = sinks[i];
+        }
+    }
+    if (w->sink == NULL) {
+        sink_t **tmp = realloc(sinks, sizeof(sink_t*) * (sinks_sz + 1));
+        sink_t *s = calloc(1, sizeof(*s));
+        if (tmp != NULL) {
+            sinks = tmp;
+        }
+        if (tmp == NULL || s == NULL) {
+            pthread_mutex_unlock(&lock);
+            free(s);
+            free(w);
+            return NULL;
+        }
+        s->entry = e;
+        entry_hold(e);
+        s->fd = -1;
+        s->pid = -1;
+        pthread_mutex_init(&s->lock, NULL);
+        sinks[sinks_sz++] = s;
+        w->sink = s;
+    }
+    stats.writers++;
+    pthread_mutex_unlock(&lock);
+    return w;
+}
+
+/* Hold back data until the rest of its line arrives. Returns 0 on success. */
+static int hold(sink_writer_t *w, const char *data, size_t size) {
+    if (size == 0) {
+        return 0;
+    }
+    char *tmp = realloc(w->pending, w->pending_sz + size);
+    if (tmp == NULL) {
+        return -1;
+    }
+    w->pending = tmp;
+    memcpy(w->pending + w->pending_sz, data, size);
+    w->pending_sz += size;
+    return 0;
+}
+
+ssize_t sink_write(sink_writer_t *w, const char *buf, size_t size) {
+    assert(w != NULL);
+    assert(buf != NULL || size == 0);
+    const char *nl = memrchr(buf, '\n', size);
+    size_t lines = nl == NULL ? 0 : (size_t)(nl - buf) + 1;
+    size_t rest = size - lines;
+
+    if (lines == 0 && w->pending_sz + size <= SINK_MAX_LINE) {
+        return hold(w, buf, size) == 0 ? (ssize_t)size : -ENOMEM;
+    }
+    if (lines == 0 || rest > SINK_MAX_LINE) {
+        /* Too long to hold back, so pass it all on now. */
+        lines = size;
+        rest = 0;
+    }
+
+    struct iovec iov[] = {
+        { .iov_base = w->pending, .iov_len = w->pending_sz },
+        { .iov_base = (char*)buf, .iov_len = lines },
+    };
+    int err = emit(w->sink, iov, 2);
+    w->pending_sz = 0;
+    if (err != 0) {
+        return err;
+    }
+    return hold(w, buf + lines, rest) == 0 ? (ssize_t)size : -ENOMEM;
+}
+
+void sink_close(sink_writer_t *w) {
+    if (w == NULL) {
+        return;
+    }
+    struct iovec iov = { .iov_base = w->pending, .iov_len = w->pending_sz };
+    if (emit(w->sink, &iov, 1) != 0) {
+        LOG("Lost %zu bytes written to %s", w->pending_sz,
+            w->sink->entry->path);
+    }
+    free(w->pending);
+    free(w);
+    pthread_mutex_lock(&lock);
+    stats.writers--;
+    pthread_mutex_unlock(&lock);
+}
+
+void sink_stop(void) {
+    pthread_mutex_lock(&lock);
+    size_t i;
+    for (i = 0; i < sinks_sz; ++i) {
+        if (sinks[i]->fd != -1) {
+            close(sinks[i]->fd);
+        }
+        pthread_mutex_destroy(&sinks[i]->lock);
+        entry_release(sinks[i]->entry);
+        free(sinks[i]);
+    }
+    free(sinks);
+    sinks = NULL;
+    sinks_sz = 0;
+    pthread_mutex_unlock(&lock);
+}
+
+void sink_get_stats(sink_stats_t *out) {
+    assert(out != NULL);
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
@@ -0,0 +1,52 @@
+#ifndef _EXECFS_SINK_H_
+#define _EXECFS_SINK_H_
+
+/* Shared sinks. Entries marked sink feed every open for writing into one
+ * long-lived run of their command rather than a run per open, so a logger
+ * written to by hundreds of processes costs one child. The child is started
+ * by the first write and runs until execfs exits, being restarted if it dies.
+ * A child that fails backs off like any other command (see reap.h): while it
+ * does, opens for writing and writes fail with EIO instead of forking it again.
+ *
+ * Writes are passed on a line at a time: each writer's partial line is held
+ * back until it is completed, or the file closed, and then written to the
+ * child in one go, so lines of concurrent writers never interleave.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "entry.h"
+
+/* One open of a sink entry for writing. */
+typedef struct sink_writer sink_writer_t;
+
+/* Longest partial line held back for a writer. Longer lines are passed on in
+ * pieces.
+ */
+#define SINK_MAX_LINE (64 * 1024)
+
+/* Returns NULL if out of memory. */
+sink_writer_t *sink_open(entry_t *e);
+
+/* Queue size bytes of buf, passing on any completed lines. Returns size on
+ * success or a negative errno.
+ */
+ssize_t sink_write(sink_writer_t *w, const char *buf, size_t size);
+
+/* Pass on whatever is left of the writer's last line and free it. */
+void sink_close(sink_writer_t *w);
+
+/* Close every child's input, letting them finish. */
+void sink_stop(void);
+
+typedef struct {
+    unsigned long long started; /* Children started, including restarts. */
+    unsigned long long writes;  /* Batches of lines passed on. */
+    unsigned long long bytes;
+    size_t writers;             /* Opens now. */
+} sink_stats_t;
+
+void sink_get_stats(sink_stats_t *out);
+
+#endif
@@ -0,0 +1,449 @@
+/* Running entries' commands. */
+
+/* For pipe2(), splice() and memfd_create(). */
+#define _GNU_SOURCE
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "entry.h"
+#include "errbuf.h"
+#include "log.h"
+#include "reap.h"
+#include "spawn.h"
+#include "trace.h"
+
+/* Shell used to run commands. */
+#define SHELL "/bin/sh"
+
+/* Variables filled in for each spawn. These occupy the first slots of an
+ * entry's environment template.
+ */
+#define ENV_UID 0
+#define ENV_GID 1
+#define ENV_PID 2
+#define ENV_FLAGS 3
+#define ENV_DYNAMIC 4
+
+#define ENV_PREFIX "EXECFS_"
+#define ENV_SLOT_SIZE 32
+
+/* Initial buffer size when capturing output. */
+#define CAPTURE_SIZE 4096
+/* Most bytes to move from a command's pipe into its spool at once. */
+#define SPOOL_CHUNK (1024 * 1024)
+/* memfd names are only for display and are limited to 249 bytes. */
+#define SPOOL_NAME_SIZE 64
+
+/* Descriptor a standby child waits on for the details of its open. */
+#define GATE_FD 3
+/* Run by a standby child before its command. It blocks until the details of
+ * the open arrive on the gate and exits quietly if the gate is closed
+ * instead. The command follows on the next line, so the shell has started
+ * but won't have looked at it yet.
+ */
+#define GATE_PROLOGUE \
+    "read -r " ENV_PREFIX "UID " ENV_PREFIX "GID " ENV_PREFIX "PID " \
+    ENV_PREFIX "FLAGS <&3 || exit 1; exec 3<&-; export " ENV_PREFIX "UID " \
+    ENV_PREFIX "GID " ENV_PREFIX "PID " ENV_PREFIX "FLAGS\n"
+
+extern char **environ;
+
+/* In a child, make target a copy of fd that survives exec. dup2() does
+ * nothing if fd is target already, such as when execfs was started with the
+ * descriptor closed, so the close-on-exec flag must be cleared by hand.
+ */
+static int dup_to(int fd, int target) {
+    if (fd != target) {
+        return dup2(fd, target);
+    }
+    int flags = fcntl(fd, F_GETFD);
+    return flags == -1 ? -1 : fcntl(fd, F_SETFD, flags & ~FD_CLOEXEC);
+}
+
+int spawn_env_build(entry_t *e) {
+    assert(e != NULL);
+    size_t n = 0, i;
+    for (i = 0; environ[i] != NULL; ++i) {
+        n++;
+    }
+
+    /* Dynamic slots, EXECFS_PATH, our environment and a terminator. */
+    e->envp = calloc(ENV_DYNAMIC + 1 + n + 1, sizeof(char*));
+    if (e->envp == NULL) {
+        return -1;
+    }
+    e->envp_sz = ENV_DYNAMIC;
+
+    size_t len = strlen(ENV_PREFIX "PATH=/") + strlen(e->path) + 1;
+    char *path = malloc(len);
+    if (path == NULL) {
+        free(e->envp);
+        e->envp = NULL;
+        return -1;
+    }
+    snprintf(path, len, ENV_PREFIX "PATH=/%s", e->path);
+    e->envp[e->envp_sz++] = path;
+
+    /* Anything we inherited that would clash with our own variables is
+     * dropped so the command sees exactly one of each.
+     */
+    for (i = 0; i < n; ++i) {
+        if (strncmp(environ[i], ENV_PREFIX, strlen(ENV_PREFIX)) != 0) {
+            e->envp[e->envp_sz++] = environ[i];
+        }
+    }
+    e->envp[e->envp_sz] = NULL;
+    return 0;
+}
+
+void spawn_env_free(entry_t *e) {
+    assert(e != NULL);
+    if (e->envp != NULL) {
+        /* Only EXECFS_PATH was allocated by us. */
+        free(e->envp[ENV_DYNAMIC]);
+        free(e->envp);
+        e->envp = NULL;
+    }
+}
+
+pid_t spawn_command(entry_t *e, int rights, const spawn_context_t *context,
+        int *readfd, int *writefd) {
+    assert(e != NULL);
+    assert(e->envp != NULL);
+    assert(context != NULL);
+    assert(readfd != NULL);
+    assert(writefd != NULL);
+
+    /* Copy the template and patch in the details of this open. The strings
+     * only need to live until exec, so they can sit on our stack.
+     */
+    char slots[ENV_DYNAMIC][ENV_SLOT_SIZE];
+    char **envp = malloc(sizeof(char*) * (e->envp_sz + 1));
+    if (envp == NULL) {
+        return -1;
+    }
+    memcpy(envp, e->envp, sizeof(char*) * (e->envp_sz + 1));
+    snprintf(slots[ENV_UID], ENV_SLOT_SIZE, ENV_PREFIX "UID=%u",
+        (unsigned int)context->uid);
+    snprintf(slots[ENV_GID], ENV_SLOT_SIZE, ENV_PREFIX "GID=%u",
+        (unsigned int)context->gid);
+    snprintf(slots[ENV_PID], ENV_SLOT_SIZE, ENV_PREFIX "PID=%d",
+        (int)context->pid);
+    snprintf(slots[ENV_FLAGS], ENV_SLOT_SIZE, ENV_PREFIX "FLAGS=%#o",
+        (unsigned int)context->flags);
+    int i;
+    for (i = 0; i < ENV_DYNAMIC; ++i) {
+        envp[i] = slots[i];
+    }
+
+    /* Create the pipes to the command. In the parent they are all
+     * close-on-exec so that other commands don't inherit them and hold them
+     * open. dup_to() clears the flag on the child's copies.
+     */
+    int input[2] = { -1, -1 }, output[2] = { -1, -1 }, error[2] = { -1, -1 };
+    int ret = 0;
+    if (rights == O_RDWR && e->mode == MODE_INTERACTIVE) {
+        /* One end of a socket is both stdin and stdout of the command. Unlike
+         * a pair of pipes, a socket lets us peek at pending output to find
+         * where a response ends without consuming anything past it.
+         */
+        int sv[2];
+        ret = socketpair(AF_UNIX, SOCK_STREAM|SOCK_CLOEXEC, 0, sv);
+        if (ret == 0) {
+            output[0] = input[1] = sv[0];
+            output[1] = input[0] = sv[1];
+        }
+    } else {
+        if (rights != O_WRONLY) {
+            ret = pipe2(output, O_CLOEXEC);
+        }
+        if (ret == 0 && rights != O_RDONLY) {
+            ret = pipe2(input, O_CLOEXEC);
+        }
+    }
+    if (ret != 0) {
+        LOG("Failed to create pipes for %s", e->command);
+        goto spawn_command_fail;
+    }
+    /* Without one, the command shares our stderr. */
+    (void)errbuf_pipe(error);
+
+    /* Flush standard streams to avoid aberrations after forking. This
+     * shouldn't really be required as we aren't using any of these anyway.
+     */
+    fflush(stdout); fflush(stderr);
+
+    pid_t pid = reap_fork(e);
+    if (pid == -1) {
+        LOG("Failed to fork");
+        goto spawn_command_fail;
+    } else if (pid == 0) {
+        /* We are the child. Overwrite our stdin and/or stdout such that they
+         * connect to the pipes.
+         */
+        if ((input[0] != -1 && dup_to(input[0], STDIN_FILENO) < 0) ||
+                (output[1] != -1 && dup_to(output[1], STDOUT_FILENO) < 0) ||
+                (error[1] != -1 && dup_to(error[1], STDERR_FILENO) < 0)) {
+            LOG("Failed to overwrite stdin/stdout after forking");
+            _exit(1);
+        }
+
+        /* Overwrite our image with the command to execute. Note that exec will
+         * only return if it fails.
+         */
+        char *argv[] = { "sh", "-c", e->command, NULL };
+        (void)execve(SHELL, argv, envp);
+        LOG("Exec failed");
+        _exit(1);
+    }
+
+    /* We are the parent. Close the ends of the pipes we don't need. */
+    LOG("Forked off child %d to run %s", pid, e->command);
+    free(envp);
+    if (input[0] != -1) {
+        close(input[0]);
+    }
+    if (output[1] != -1 && output[1] != input[0]) {
+        close(output[1]);
+    }
+    if (error[0] != -1) {
+        close(error[1]);
+        errbuf_watch(e, error[0]);
+    }
+    trace_phase(trace_current(), TRACE_SPAWN);
+    *readfd = output[0];
+    *writefd = input[1];
+    return pid;
+
+spawn_command_fail:
+    free(envp);
+    int fds[] = { input[0], input[1], output[0], output[1] };
+    size_t j;
+    for (j = 0; j < sizeof(fds) / sizeof(fds[0]); ++j) {
+        /* A socket appears twice. */
+        if (fds[j] != -1 && (j < 2 || (fds[j] != input[0] && fds[j] != input[1]))) {
+            close(fds[j]);
+        }
+    }
+    for (j = 0; j < 2; ++j) {
+        if (error[j] != -1) {
+            close(error[j]);
+        }
+    }
+    return -1;
+}
+
+int spawn_capture(entry_t *e, const spawn_context_t *context, size_t limit,
+        char **out, size_t *out_sz, int *rest) {
+    assert(out != NULL);
+    assert(out_sz != NULL);
+    assert(rest != NULL);
+    *rest = -1;
+    int readfd, writefd;
+    if (spawn_command(e, O_RDONLY, context, &readfd, &writefd) == -1) {
+        return -1;
+    }
+
+    size_t len = 0, cap = CAPTURE_SIZE;
+    char *buf = malloc(cap);
+    while (buf != NULL) {
+        if (len > limit) {
+            *rest = readfd;
+            break;
+        }
+        if (len == cap) {
+            char *tmp = realloc(buf, cap * 2);
+            if (tmp == NULL) {
+                free(buf);
+                buf = NULL;
+                break;
+            }
+            buf = tmp;
+            cap *= 2;
+        }
+        ssize_t sz = read(readfd, buf + len, cap - len);
+        if (sz == -1 && errno == EINTR) {
+            continue;
+        } else if (sz == -1) {
+            LOG("Failed to read output of %s", e->command);
+            free(buf);
+            buf = NULL;
+            break;
+        } else if (sz == 0) {
+            break;
+        }
+        len += sz;
+    }
+    if (buf == NULL) {
+        close(readfd);
+        return -1;
+    }
+    *out = buf;
+    *out_sz = len;
+    if (*rest != -1) {
+        return 1;
+    }
+    close(readfd);
+    return 0;
+}
+
+pid_t spawn_standby(entry_t *e, int *readfd, int *gatefd) {
+    assert(e != NULL);
+    assert(e->envp != NULL);
+    assert(readfd != NULL);
+    assert(gatefd != NULL);
+
+    char *script = malloc(strlen(GATE_PROLOGUE) + strlen(e->command) + 1);
+    if (script == NULL) {
+        return -1;
+    }
+    strcpy(script, GATE_PROLOGUE);
+    strcat(script, e->command);
+
+    int output[2] = { -1, -1 }, gate[2] = { -1, -1 }, error[2] = { -1, -1 };
+    if (pipe2(output, O_CLOEXEC) != 0 || pipe2(gate, O_CLOEXEC) != 0) {
+        LOG("Failed to create pipes for %s", e->command);
+        goto spawn_standby_fail;
+    }
+    (void)errbuf_pipe(error);
+
+    fflush(stdout); fflush(stderr);
+
+    /* Not running the command yet, so its exit says nothing about it. */
+    pid_t pid = reap_fork(NULL);
+    if (pid == -1) {
+        LOG("Failed to fork");
+        goto spawn_standby_fail;
+    } else if (pid == 0) {
+        if (dup_to(output[1], STDOUT_FILENO) < 0 ||
+                dup_to(gate[0], GATE_FD) < 0 ||
+                (error[1] != -1 && dup_to(error[1], STDERR_FILENO) < 0)) {
+            _exit(1);
+        }
+        /* The details of the open are filled in by the prologue. */
+        char *argv[] = { "sh", "-c", script, NULL };
+        (void)execve(SHELL, argv, e->envp + ENV_DYNAMIC);
+        _exit(1);
+    }
+
+    LOG("Forked off standby child %d to run %s", pid, e->command);
+    free(script);
+    close(output[1]);
+    close(gate[0]);
+    if (error[0] != -1) {
+        close(error[1]);
+        errbuf_watch(e, error[0]);
+    }
+    *readfd = output[0];
+    *gatefd = gate[1];
+    return pid;
+
+spawn_standby_fail:
+    free(script);
+    int fds[] = { output[0], output[1], gate[0], gate[1], error[0], error[1] };
+    size_t i;
+    for (i = 0; i < sizeof(fds) / sizeof(fds[0]); ++i) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+        }
+    }
+    return -1;
+}
+
+int spawn_release(int gatefd, const spawn_context_t *context) {
+    assert(context != NULL);
+    char line[ENV_DYNAMIC * ENV_SLOT_SIZE];
+    int len = snprintf(line, sizeof(line), "%u %u %d %#o\n",
+        (unsigned int)context->uid, (unsigned int)context->gid,
+        (int)context->pid, (unsigned int)context->flags);
+    /* Far less than a pipe's buffer, so this never blocks or comes up
+     * short. A child that has died already gives EPIPE.
+     */
+    ssize_t sz;
+    do {
+        sz = write(gatefd, line, len);
+    } while (sz == -1 && errno == EINTR);
+    close(gatefd);
+    return sz == len ? 0 : -1;
+}
+
+/* Move everything from the pipe in into the file out. The kernel moves the
+ * pages across itself where it can, and we copy through a buffer where it
+ * can't. Returns the number of bytes moved or -1 on failure.
+ */
+static ssize_t drain(int in, int out) {
+    size_t total = 0;
+    while (1) {
+        ssize_t sz = splice(in, NULL, out, NULL, SPOOL_CHUNK, SPLICE_F_MOVE);
+        if (sz == -1 && errno == EINTR) {
+            continue;
+        } else if (sz == -1 && errno == EINVAL && total == 0) {
+            break;
+        } else if (sz == -1) {
+            return -1;
+        } else if (sz == 0) {
+            return total;
+        }
+        total += sz;
+    }
+
+    char *buf = malloc(CAPTURE_SIZE);
+    if (buf == NULL) {
+        return -1;
+    }
+    while (1) {
+        ssize_t sz = read(in, buf, CAPTURE_SIZE);
+        if (sz == -1 && errno == EINTR) {
+            continue;
+        } else if (sz <= 0) {
+            free(buf);
+            return sz == 0 ? (ssize_t)total : -1;
+        }
+        ssize_t done = 0;
+        while (done < sz) {
+            ssize_t w = write(out, buf + done, sz - done);
+            if (w == -1 && errno == EINTR) {
+                continue;
+            } else if (w <= 0) {
+                free(buf);
+                return -1;
+            }
+            done += w;
+        }
+        total += sz;
+    }
+}
+
+int spawn_spool(entry_t *e, const spawn_context_t *context) {
+    char name[SPOOL_NAME_SIZE];
+    snprintf(name, sizeof(name), "execfs:%s", e->path);
+    int fd = memfd_create(name, MFD_CLOEXEC|MFD_ALLOW_SEALING);
+    if (fd == -1) {
+        LOG("Failed to create spool for %s", e->path);
+        return -1;
+    }
+
+    int readfd, writefd;
+    if (spawn_command(e, O_RDONLY, context, &readfd, &writefd) == -1) {
+        close(fd);
+        return -1;
+    }
+    ssize_t sz = drain(readfd, fd);
+    close(readfd);
+    if (sz == -1) {
+        LOG("Failed to spool output of %s", e->command);
+        close(fd);
+        return -1;
+    }
+    (void)fcntl(fd, F_ADD_SEALS,
+        F_SEAL_SHRINK|F_SEAL_GROW|F_SEAL_WRITE|F_SEAL_SEAL);
+    return fd;
+}
@@ -0,0 +1,63 @@
+#ifndef _EXECFS_SPAWN_H_
+#define _EXECFS_SPAWN_H_
+
+#include <sys/types.h>
+
+#include "entry.h"
+
+/* The open that caused a command to be run. This is passed to the command in
+ * its environment as EXECFS_UID, EXECFS_GID, EXECFS_PID and EXECFS_FLAGS,
+ * alongside EXECFS_PATH.
+ */
+typedef struct {
+    uid_t uid;
+    gid_t gid;
+    pid_t pid;
+    int flags;
+} spawn_context_t;
+
+/* Build the environment template for an entry's command. This is done once,
+ * when the configuration is read, so that each spawn only has to fill in the
+ * handful of variables describing the open. Returns 0 on success.
+ */
+int spawn_env_build(entry_t *e);
+void spawn_env_free(entry_t *e);
+
+/* Run an entry's command through the shell. rights is one of O_RDONLY,
+ * O_WRONLY or O_RDWR and determines which of the command's stdout and stdin
+ * are connected to *readfd and *writefd respectively. Interactive entries
+ * opened O_RDWR get one socket for both. Unused descriptors are set to -1.
+ * Returns the child's pid, or -1 on failure.
+ */
+pid_t spawn_command(entry_t *e, int rights, const spawn_context_t *context,
+        int *readfd, int *writefd);
+
+/* Start an entry's command for reading ahead of any open. The shell is
+ * started with its stdout connected to *readfd but holds off running the
+ * command until spawn_release() passes it the details of the open through
+ * *gatefd. Closing *gatefd instead makes it exit without running anything.
+ * Returns the child's pid, or -1 on failure.
+ */
+pid_t spawn_standby(entry_t *e, int *readfd, int *gatefd);
+
+/* Let a standby child run its command on behalf of the given open. Closes
+ * gatefd. Returns 0 on success, or -1 if the child has gone.
+ */
+int spawn_release(int gatefd, const spawn_context_t *context);
+
+/* Run an entry's command for reading and collect everything it prints. On
+ * success returns 0 with the output in a malloced buffer. If the output grows
+ * beyond limit bytes, collection stops and 1 is returned with what was read so
+ * far in the buffer and the still open pipe in *rest, for the caller to read
+ * the remainder from. Returns -1 on failure.
+ */
+int spawn_capture(entry_t *e, const spawn_context_t *context, size_t limit,
+        char **out, size_t *out_sz, int *rest);
+
+/* Run an entry's command for reading and spool its output into a sealed
+ * memfd, which lives in page cache and swap rather than our heap. Returns the
+ * memfd, or -1 on failure.
+ */
+int spawn_spool(entry_t *e, const spawn_context_t *context);
+
+#endif
@@ -0,0 +1,252 @@
+/* Children started ahead of opens. */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "entry.h"
+#include "log.h"
+#include "reap.h"
+#include "spawn.h"
+#include "standby.h"
+
+/* Milliseconds to wait before trying again after failing to start a child. */
+#define STANDBY_RETRY_MS 1000
+/* Milliseconds after a child is taken before replacing it, so that forking
+ * the replacement doesn't compete with the command just let go or with more
+ * opens in a burst.
+ */
+#define STANDBY_REFILL_MS 20
+
+typedef struct {
+    pid_t pid;
+    int readfd;
+    int gatefd;
+} child_t;
+
+typedef struct {
+    entry_t *entry;
+    /* Oldest first, as those are the likeliest to have been killed. */
+    child_t children[STANDBY_MAX];
+    size_t ready;
+} pool_t;
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+/* Signalled when a child is taken and on shutdown. Uses the monotonic
+ * clock.
+ */
+static pthread_cond_t wake;
+static pthread_t thread;
+static int running = 0;
+
+/* Individually allocated, so the filler keeps its pool when more are
+ * added.
+ */
+static pool_t **pools = NULL;
+static size_t pools_sz = 0;
+/* When a child was last taken, in monotonic milliseconds. */
+static uint64_t last_take = 0;
+static standby_stats_t stats;
+
+static uint64_t now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Wait for wake until the monotonic time ms. Called with lock held. */
+static void wait_until(uint64_t ms) {
+    struct timespec ts = {
+        .tv_sec = ms / 1000,
+        .tv_nsec = (ms % 1000) * 1000000,
+    };
+    pthread_cond_timedwait(&wake, &lock, &ts);
+}
+
+static void dismiss(child_t *c) {
+    /* The child sees the gate close and exits without running anything. */
+    close(c->gatefd);
+    close(c->readfd);
+}
+
+/* A pool that is short of children. Called with lock held. */
+static pool_t *find_short(void) {
+    size_t i;
+    for (i = 0; i < pools_sz; ++i) {
+        if (pools[i]->ready < (size_t)pools[i]->entry->standby) {
+            return pools[i];
+        }
+    }
+    return NULL;
+}
+
+static void *standby_main(void *arg) {
+    pthread_mutex_lock(&lock);
+    while (running) {
+        pool_t *p = find_short();
+        if (p == NULL) {
+            pthread_cond_wait(&wake, &lock);
+            continue;
+        }
+        uint64_t now = now_ms();
+        if (now < last_take + STANDBY_REFILL_MS) {
+            wait_until(last_take + STANDBY_REFILL_MS);
+            continue;
+        }
+        pthread_mutex_unlock(&lock);
+        child_t c;
+        c.pid = spawn_standby(p->entry, &c.readfd, &c.gatefd);
+        pthread_mutex_lock(&lock);
+
+        if (c.pid == -1) {
+            LOG("Failed to start standby child for %s", p->entry->path);
+            wait_until(now_ms() + STANDBY_RETRY_MS);
+        } else if (!running) {
+            dismiss(&c);
+        } else {
+            p->children[p->ready++] = c;
+            stats.spawned++;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    return NULL;
+}
+
+int standby_add(entry_t **entries, size_t entries_sz) {
+    assert(entries != NULL || entries_sz == 0);
+    size_t i, n = 0;
+    for (i = 0; i < entries_sz; ++i) {
+        if (entries[i]->standby > 0) {
+            n++;
+        }
+    }
+    if (n == 0) {
+        return 0;
+    }
+
+    pthread_mutex_lock(&lock);
+    pool_t **tmp = realloc(pools, sizeof(pool_t*) * (pools_sz + n));
+    if (tmp == NULL) {
+        pthread_mutex_unlock(&lock);
+        return -1;
+    }
+    pools = tmp;
+
+    if (!running) {
+        pthread_condattr_t attr;
+        pthread_condattr_init(&attr);
+        pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+        pthread_cond_init(&wake, &attr);
+        pthread_condattr_destroy(&attr);
+
+        running = 1;
+        if (pthread_create(&thread, NULL, standby_main, NULL) != 0) {
+            running = 0;
+            pthread_cond_destroy(&wake);
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+    }
+
+    for (i = 0; i < entries_sz; ++i) {
+        if (entries[i]->standby == 0) {
+            continue;
+        }
+        pool_t *p = calloc(1, sizeof(*p));
+        if (p == NULL) {
+            break;
+        }
+        assert(entries[i]->standby <= STANDBY_MAX);
+        p->entry = entries[i];
+        entry_hold(p->entry);
+        pools[pools_sz++] = p;
+    }
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    LOG("Keeping children waiting for %zu entries", n);
+    return i == entries_sz ? 0 : -1;
+}
+
+void standby_stop(void) {
+    pthread_mutex_lock(&lock);
+    if (!running) {
+        pthread_mutex_unlock(&lock);
+        return;
+    }
+    running = 0;
+    pthread_cond_signal(&wake);
+    pthread_mutex_unlock(&lock);
+    pthread_join(thread, NULL);
+
+    pthread_mutex_lock(&lock);
+    size_t i, j;
+    for (i = 0; i < pools_sz; ++i) {
+        for (j = 0; j < pools[i]->ready; ++j) {
+            dismiss(&pools[i]->children[j]);
+        }
+        entry_release(pools[i]->entry);
+        free(pools[i]);
+    }
+    free(pools);
+    pools = NULL;
+    pools_sz = 0;
+    pthread_cond_destroy(&wake);
+    pthread_mutex_unlock(&lock);
+}
+
+pid_t standby_take(entry_t *e, const spawn_context_t *context, int *readfd) {
+    assert(e != NULL);
+    assert(context != NULL);
+    assert(readfd != NULL);
+    while (1) {
+        pthread_mutex_lock(&lock);
+        pool_t *p = NULL;
+        size_t i;
+        for (i = 0; running && i < pools_sz && p == NULL; ++i) {
+            if (pools[i]->entry == e) {
+                p = pools[i];
+            }
+        }
+        if (p == NULL || p->ready == 0) {
+            stats.misses++;
+            pthread_mutex_unlock(&lock);
+            return -1;
+        }
+        child_t c = p->children[0];
+        memmove(&p->children[0], &p->children[1],
+            sizeof(child_t) * --p->ready);
+        last_take = now_ms();
+        pthread_cond_signal(&wake);
+        pthread_mutex_unlock(&lock);
+
+        reap_assign(c.pid, e);
+        if (spawn_release(c.gatefd, context) == 0) {
+            pthread_mutex_lock(&lock);
+            stats.hits++;
+            pthread_mutex_unlock(&lock);
+            *readfd = c.readfd;
+            return c.pid;
+        }
+        /* It died while waiting. Try the next. */
+        LOG("Standby child %d of %s has gone", c.pid, e->path);
+        close(c.readfd);
+    }
+}
+
+void standby_get_stats(standby_stats_t *out) {
+    assert(out != NULL);
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    out->ready = 0;
+    size_t i;
+    for (i = 0; i < pools_sz; ++i) {
+        out->ready += pools[i]->ready;
+    }
+    pthread_mutex_unlock(&lock);
+}
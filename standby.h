@@ -0,0 +1,43 @@
+#ifndef _EXECFS_STANDBY_H_
+#define _EXECFS_STANDBY_H_
+
+/* Children started ahead of opens. Entries with standby=N keep N shells
+ * forked, exec'd and waiting for an open (see spawn_standby()), so a
+ * read-only open only has to tell one to go instead of paying for fork and
+ * exec. Every open still gets a fresh run of the command. A background
+ * thread replaces the children handed out.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "entry.h"
+#include "spawn.h"
+
+/* Most children kept waiting for one entry. */
+#define STANDBY_MAX 64
+
+/* Keep children waiting for the entries among entries with a standby count.
+ * The thread filling them is started by the first call that has any.
+ * Returns 0 on success.
+ */
+int standby_add(entry_t **entries, size_t entries_sz);
+
+/* Stop the thread and dismiss every waiting child. */
+void standby_stop(void);
+
+/* Hand a waiting child of e the open described by context. Returns its pid
+ * with its stdout in *readfd, or -1 if none was ready.
+ */
+pid_t standby_take(entry_t *e, const spawn_context_t *context, int *readfd);
+
+typedef struct {
+    unsigned long long hits;   /* Opens served by a waiting child. */
+    unsigned long long misses; /* Opens that found none ready. */
+    unsigned long long spawned;
+    size_t ready;              /* Children waiting now. */
+} standby_stats_t;
+
+void standby_get_stats(standby_stats_t *out);
+
+#endif
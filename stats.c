@@ -0,0 +1,142 @@
+/* Runtime statistics. */
+
+#define _GNU_SOURCE /* open_memstream() */
+
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "binlog.h"
+#include "cache.h"
+#include "errbuf.h"
+#include "prefetch.h"
+#include "profile.h"
+#include "reap.h"
+#include "schedule.h"
+#include "sink.h"
+#include "standby.h"
+#include "stats.h"
+#include "trace.h"
+
+static void format_cache(FILE *f) {
+    cache_stats_t c;
+    cache_get_stats(&c);
+    unsigned long long lookups = c.hits + c.misses;
+    fprintf(f, "cache.hits %llu\n", c.hits);
+    fprintf(f, "cache.misses %llu\n", c.misses);
+    fprintf(f, "cache.hit_ratio %.3f\n",
+        lookups == 0 ? 0.0 : (double)c.hits / lookups);
+    fprintf(f, "cache.evictions %llu\n", c.evictions);
+    fprintf(f, "cache.rejected %llu\n", c.rejected);
+    fprintf(f, "cache.unchanged %llu\n", c.unchanged);
+    fprintf(f, "cache.objects %zu\n", c.objects);
+    fprintf(f, "cache.raw_bytes %zu\n", c.raw_bytes);
+    fprintf(f, "cache.bytes %zu\n", c.used);
+    fprintf(f, "cache.protected_bytes %zu\n", c.protected_bytes);
+    fprintf(f, "cache.budget %zu\n", c.budget);
+    fprintf(f, "cache.max_object %zu\n", cache_max_object());
+}
+
+static void format_prefetch(FILE *f) {
+    prefetch_stats_t p;
+    prefetch_get_stats(&p);
+    fprintf(f, "prefetch.depth %u\n", prefetch_depth());
+    fprintf(f, "prefetch.queued %llu\n", p.queued);
+    fprintf(f, "prefetch.dropped %llu\n", p.dropped);
+    fprintf(f, "prefetch.filled %llu\n", p.filled);
+    fprintf(f, "prefetch.failed %llu\n", p.failed);
+    fprintf(f, "prewarm.entries %zu\n", p.prewarm_entries);
+    fprintf(f, "prewarm.failed %zu\n", p.prewarm_failed);
+    fprintf(f, "prewarm.seconds %.3f\n", p.prewarm_seconds);
+}
+
+static void format_schedule(FILE *f) {
+    schedule_stats_t s;
+    schedule_get_stats(&s);
+    fprintf(f, "schedule.entries %zu\n", s.entries);
+    fprintf(f, "schedule.runs %llu\n", s.runs);
+    fprintf(f, "schedule.failed %llu\n", s.failed);
+    fprintf(f, "schedule.skipped %llu\n", s.skipped);
+}
+
+static void format_standby(FILE *f) {
+    standby_stats_t s;
+    standby_get_stats(&s);
+    fprintf(f, "standby.hits %llu\n", s.hits);
+    fprintf(f, "standby.misses %llu\n", s.misses);
+    fprintf(f, "standby.spawned %llu\n", s.spawned);
+    fprintf(f, "standby.ready %zu\n", s.ready);
+}
+
+static void format_sink(FILE *f) {
+    sink_stats_t s;
+    sink_get_stats(&s);
+    fprintf(f, "sink.started %llu\n", s.started);
+    fprintf(f, "sink.writes %llu\n", s.writes);
+    fprintf(f, "sink.bytes %llu\n", s.bytes);
+    fprintf(f, "sink.writers %zu\n", s.writers);
+}
+
+static void format_reap(FILE *f) {
+    reap_stats_t r;
+    reap_get_stats(&r);
+    fprintf(f, "children.running %zu\n", r.children);
+    fprintf(f, "children.exited %llu\n", r.exits);
+    fprintf(f, "children.failed %llu\n", r.failures);
+    fprintf(f, "children.refused %llu\n", r.refused);
+    fprintf(f, "children.backoff_ms %lu\n", reap_backoff());
+
+    reap_failure_t *failures;
+    size_t failures_sz, i;
+    if (reap_get_failures(&failures, &failures_sz) != 0) {
+        return;
+    }
+    for (i = 0; i < failures_sz; ++i) {
+        fprintf(f, "failed.%s.count %llu\n", failures[i].path,
+            failures[i].failures);
+        fprintf(f, "failed.%s.streak %u\n", failures[i].path,
+            failures[i].streak);
+        fprintf(f, "failed.%s.exit_status %d\n", failures[i].path,
+            failures[i].status);
+    }
+    reap_free_failures(failures, failures_sz);
+}
+
+static void format_trace(FILE *f) {
+    trace_stats_t s;
+    trace_get_stats(&s);
+    fprintf(f, "trace.requests %llu\n", s.requests);
+    fprintf(f, "trace.events %llu\n", s.events);
+}
+
+static void format_errbuf(FILE *f) {
+    errbuf_stats_t s;
+    errbuf_get_stats(&s);
+    fprintf(f, "stderr.bytes %llu\n", s.bytes);
+    fprintf(f, "stderr.dropped %llu\n", s.dropped);
+    fprintf(f, "stderr.entries %zu\n", s.entries);
+}
+
+char *stats_format(size_t *len) {
+    assert(len != NULL);
+    char *s = NULL;
+    FILE *f = open_memstream(&s, len);
+    if (f == NULL) {
+        return NULL;
+    }
+    format_cache(f);
+    format_prefetch(f);
+    format_schedule(f);
+    format_standby(f);
+    format_sink(f);
+    format_reap(f);
+    format_errbuf(f);
+    profile_format(f);
+    format_trace(f);
+    fprintf(f, "binlog.records %llu\n", binlog_records());
+    if (fclose(f) != 0) {
+        free(s);
+        return NULL;
+    }
+    return s;
+}
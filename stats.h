@@ -0,0 +1,15 @@
+#ifndef _EXECFS_STATS_H_
+#define _EXECFS_STATS_H_
+
+/* Runtime statistics gathered from the rest of execfs, for reporting through
+ * the stats built-in.
+ */
+
+#include <stddef.h>
+
+/* Render the current statistics as "name value" lines. Returns a malloced
+ * string with its length in *len, or NULL if out of memory.
+ */
+char *stats_format(size_t *len);
+
+#endif
@@ -0,0 +1,17 @@
+#!/bin/bash
+
+# Test that a file whose command just failed is refused rather than run again.
+
+if [ $# -ne 1 ]; then
+    echo $#
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+# The first open runs the command, which fails once it has been opened.
+cat "$1/file" >/dev/null
+sleep 0.05
+if cat "$1/file" >/dev/null 2>&1; then
+    echo "Command was run again straight after failing." >&2
+    exit 1
+fi
@@ -0,0 +1,28 @@
+#!/bin/bash
+
+# Test that cached output is reused between opens of an execfs file.
+
+if [ $# -ne 1 ]; then
+    echo $#
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+FIRST=`cat "$1/file"`
+if [ $? -ne 0 ]; then
+    echo "Failed to read from file." >&2
+    exit 1
+fi
+SECOND=`cat "$1/file"`
+if [ $? -ne 0 ]; then
+    echo "Failed to read from file again." >&2
+    exit 1
+elif [ "${FIRST}" != "${SECOND}" ]; then
+    echo "Output was not cached." >&2
+    exit 1
+fi
+
+if ! grep -q '^cache.hits 1$' "$1/stats"; then
+    echo "Cache hit was not counted." >&2
+    exit 1
+fi
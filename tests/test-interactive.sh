@@ -0,0 +1,53 @@
+#!/bin/bash
+
+# Test request/response turns on an interactive execfs file. The command
+# echoes whatever it is sent as soon as it arrives, so a request without a
+# newline is only answered once the command has been idle. The quiet file
+# gives no reply to assignments, which must not block the reader forever.
+
+if [ $# -ne 1 ]; then
+    echo $#
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+exec 3<>"$1/file"
+if [ $? -ne 0 ]; then
+    echo "Failed to open file." >&2
+    exit 1
+fi
+for REQUEST in 'hello world\n' 'no newline' 'goodbye world\n'; do
+    printf "${REQUEST}" >&3
+    # One read returns one whole response. Compare bytes, as command
+    # substitution would drop a trailing newline.
+    OUTPUT=`dd bs=4096 count=1 <&3 2>/dev/null | od -An -tx1`
+    if [ $? -ne 0 ]; then
+        echo "Failed to read response." >&2
+        exit 1
+    fi
+    EXPECTED=`printf "${REQUEST}" | od -An -tx1`
+    if [ "${OUTPUT}" != "${EXPECTED}" ]; then
+        echo "Incorrect response received to '${REQUEST}':${OUTPUT}" >&2
+        exit 1
+    fi
+done
+exec 3>&-
+
+exec 3<>"$1/quiet"
+if [ $? -ne 0 ]; then
+    echo "Failed to open quiet." >&2
+    exit 1
+fi
+printf 'x=5\n' >&3
+OUTPUT=`timeout 5 dd bs=4096 count=1 <&3 2>/dev/null; echo "status $?"`
+if [ "${OUTPUT}" != "status 0" ]; then
+    echo "Unanswered request was not ended by the idle timeout:${OUTPUT}" >&2
+    exit 1
+fi
+printf 'x\n' >&3
+OUTPUT=`timeout 5 dd bs=4096 count=1 <&3 2>/dev/null`
+if [ "${OUTPUT}" != "x" ]; then
+    echo "Incorrect response received after an unanswered request: ${OUTPUT}" >&2
+    exit 1
+fi
+exec 3>&-
@@ -0,0 +1,58 @@
+#!/bin/bash
+
+# Test that reloading the configuration replaces the entries: output cached
+# under the old options is dropped and a changed ttl takes effect. The first
+# spool entry added by a reload is read in full although the mount caches
+# attributes.
+
+if [ $# -ne 1 ]; then
+    echo $#
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+FIRST=`cat "$1/file"`
+if [ $? -ne 0 ]; then
+    echo "Failed to read from file." >&2
+    exit 1
+fi
+
+sed -i 's/ttl=1000/ttl=1/' "${CONFIG}"
+if ! execfsctl "${CONTROL}" reload >/dev/null; then
+    echo "Failed to reload." >&2
+    exit 1
+fi
+
+SECOND=`cat "$1/file"`
+if [ $? -ne 0 ]; then
+    echo "Failed to read from file after reloading." >&2
+    exit 1
+elif [ "${FIRST}" == "${SECOND}" ]; then
+    echo "Output cached with the old ttl was kept." >&2
+    exit 1
+fi
+
+sleep 1.2
+THIRD=`cat "$1/file"`
+if [ $? -ne 0 ]; then
+    echo "Failed to read from file again." >&2
+    exit 1
+elif [ "${SECOND}" == "${THIRD}" ]; then
+    echo "Output didn't expire with the new ttl." >&2
+    exit 1
+fi
+
+echo 'spooled|444,spool|seq 1 100000' >> "${CONFIG}"
+if ! execfsctl "${CONTROL}" reload >/dev/null; then
+    echo "Failed to reload with a spool entry." >&2
+    exit 1
+fi
+EXPECTED=`seq 1 100000 | wc -c`
+SIZE=`cat "$1/spooled" | wc -c`
+if [ $? -ne 0 ]; then
+    echo "Failed to read from spooled." >&2
+    exit 1
+elif [ "${SIZE}" -ne "${EXPECTED}" ]; then
+    echo "Read ${SIZE} bytes of spooled instead of ${EXPECTED}." >&2
+    exit 1
+fi
@@ -0,0 +1,41 @@
+#!/bin/bash
+
+# Test that concurrent writers to a sink share one run of the command and
+# that their lines arrive whole. Each run of the command starts by writing
+# its PID.
+
+if [ $# -ne 1 ]; then
+    echo $#
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+OUT=/tmp/_execfs_test-sink.config.testing
+rm -f "${OUT}"
+for i in 1 2 3 4; do
+    (
+        for j in `seq 50`; do
+            printf "writer $i "
+            printf "line $j\n"
+        done >"$1/file"
+    ) &
+done
+wait
+
+# The command only finishes writing once it has the lines, so give it a moment.
+for i in `seq 50`; do
+    [ "`grep -c '^writer' "${OUT}" 2>/dev/null`" = "200" ] && break
+    sleep 0.1
+done
+LINES=`grep -c '^writer' "${OUT}"`
+PIDS=`grep '^pid ' "${OUT}" | sort -u | wc -l`
+if [ "${LINES}" != "200" ]; then
+    echo "Received ${LINES} lines instead of 200." >&2
+    exit 1
+elif grep -v '^pid [0-9]*$' "${OUT}" | grep -qvE '^writer [0-9] line [0-9]+$'; then
+    echo "Lines from different writers were interleaved." >&2
+    exit 1
+elif [ "${PIDS}" != "1" ]; then
+    echo "Writers were fed to ${PIDS} runs of the command instead of one." >&2
+    exit 1
+fi
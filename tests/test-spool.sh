@@ -0,0 +1,26 @@
+#!/bin/bash
+
+# Test that a spooled execfs file is read in full, beyond the default size
+# reported for files, and that it then reports its real size.
+
+if [ $# -ne 1 ]; then
+    echo $#
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+EXPECTED=`seq 1 100000 | wc -c`
+SIZE=`wc -c < "$1/file"`
+if [ $? -ne 0 ]; then
+    echo "Failed to read from file." >&2
+    exit 1
+elif [ "${SIZE}" -ne "${EXPECTED}" ]; then
+    echo "Read ${SIZE} bytes instead of ${EXPECTED}." >&2
+    exit 1
+fi
+
+SIZE=`stat -c %s "$1/file"`
+if [ "${SIZE}" -ne "${EXPECTED}" ]; then
+    echo "File reports ${SIZE} bytes instead of ${EXPECTED}." >&2
+    exit 1
+fi
@@ -0,0 +1,22 @@
+#!/bin/bash
+
+# Test that every open of an entry with standby children gets its own run of
+# the command, which sees the details of that open.
+
+if [ $# -ne 1 ]; then
+    echo $#
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+EXPECTED="`id -u` /file"
+for i in 1 2 3 4 5; do
+    DATA=`cat "$1/file"`
+    if [ $? -ne 0 ]; then
+        echo "Failed to read from file." >&2
+        exit 1
+    elif [ "${DATA}" != "${EXPECTED}" ]; then
+        echo "Read \"${DATA}\" instead of \"${EXPECTED}\"." >&2
+        exit 1
+    fi
+done
@@ -0,0 +1,61 @@
+#!/bin/bash
+
+# Test that the user.execfs.* extended attributes report an execfs file's
+# cache state, output hash and hit count.
+
+if [ $# -ne 1 ]; then
+    echo $#
+    echo "Usage: $0 mountpoint" >&2
+    exit 1
+fi
+
+if ! command -v getfattr >/dev/null; then
+    echo "getfattr not found, skipping." >&2
+    exit 0
+fi
+
+attr() {
+    getfattr --only-values -n "user.execfs.$1" "$2" 2>/dev/null
+}
+
+if [ "`attr cache_state "$1/file"`" != "missing" ]; then
+    echo "File was cached before it was read." >&2
+    exit 1
+elif [ -n "`attr output_hash "$1/file"`" ]; then
+    echo "Output hash was given before the file was read." >&2
+    exit 1
+fi
+
+if ! cat "$1/file" >/dev/null; then
+    echo "Failed to read from file." >&2
+    exit 1
+fi
+if [ "`attr cache_state "$1/file"`" != "cached" ]; then
+    echo "File was not cached after it was read." >&2
+    exit 1
+fi
+HASH=`attr output_hash "$1/file"`
+if ! [[ "${HASH}" =~ ^[0-9a-f]{16}$ ]]; then
+    echo "Output hash ${HASH} is not 16 hex digits." >&2
+    exit 1
+elif [ "`attr hits "$1/file"`" != "1" ]; then
+    echo "First open was not counted." >&2
+    exit 1
+fi
+
+if ! cat "$1/file" >/dev/null; then
+    echo "Failed to read from file again." >&2
+    exit 1
+elif [ "`attr output_hash "$1/file"`" != "${HASH}" ]; then
+    echo "Output hash changed between cached reads." >&2
+    exit 1
+elif [ "`attr hits "$1/file"`" != "2" ]; then
+    echo "Second open was not counted." >&2
+    exit 1
+fi
+
+if ! getfattr -d -m user.execfs "$1/file" | grep -q '^user.execfs.hits="2"$'
+then
+    echo "Attributes were not listed." >&2
+    exit 1
+fi
@@ -1,7 +1,9 @@
 #!/bin/bash
 
 # Mount an execfs file system, run a test on it, unmount it and delete the
-# mount point.
+# mount point. The test is given the mount point, and in CONFIG and CONTROL a
+# copy of the configuration that execfs reads and its control socket, so that
+# it can change the configuration and reload it.
 
 if [ $# -ne 2 ]; then
     echo "Usage: $0 script config" >&2
@@ -9,7 +11,10 @@ if [ $# -ne 2 ]; then
 fi
 
 MOUNT=`mktemp -d`
-execfs --config "$2" --fuse "${MOUNT}" && \
+export CONFIG="${MOUNT}.config"
+export CONTROL="${MOUNT}.sock"
+cp "$2" "${CONFIG}" && \
+ execfs --config "${CONFIG}" --control "${CONTROL}" --fuse "${MOUNT}" && \
  "$1" "${MOUNT}" && \
  fusermount -uz "${MOUNT}" && \
- rm -rf "${MOUNT}"
+ rm -rf "${MOUNT}" "${CONFIG}" "${CONTROL}"
@@ -0,0 +1,58 @@
+/* Repeatedly open a file, read it to EOF and close it, then report how many
+ * opens per second were achieved. Useful for comparing the cost of different
+ * kinds of execfs entries that produce the same output.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BUFFER_SIZE 65536
+#define DEFAULT_COUNT 1000
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    if (argc != 2 && argc != 3) {
+        fprintf(stderr, "Usage: %s file [count]\n", argv[0]);
+        return -1;
+    }
+    long count = argc == 3 ? atol(argv[2]) : DEFAULT_COUNT;
+    if (count <= 0) {
+        fprintf(stderr, "Invalid count %s\n", argv[2]);
+        return -1;
+    }
+
+    static char buffer[BUFFER_SIZE];
+    unsigned long long bytes = 0;
+    double start = now();
+    long i;
+    for (i = 0; i < count; ++i) {
+        int fd = open(argv[1], O_RDONLY);
+        if (fd == -1) {
+            fprintf(stderr, "Failed to open %s\n", argv[1]);
+            return -1;
+        }
+        ssize_t sz;
+        while ((sz = read(fd, buffer, sizeof(buffer))) > 0) {
+            bytes += sz;
+        }
+        if (sz == -1) {
+            fprintf(stderr, "Failed to read %s\n", argv[1]);
+            return -1;
+        }
+        close(fd);
+    }
+    double elapsed = now() - start;
+
+    printf("%s: %ld opens in %.3fs, %.0f opens/s, %.1fus/open, %llu bytes/open\n",
+        argv[1], count, elapsed, count / elapsed, elapsed * 1e6 / count,
+        bytes / count);
+    return 0;
+}
@@ -0,0 +1,18 @@
+#!/bin/bash
+
+# Mount an execfs configuration and run the bench tool over every entry in it,
+# so that entries producing the same output by different means can be
+# compared. Run from the top of the repository after `make execfs bench`.
+
+if [ $# -lt 1 -o $# -gt 2 ]; then
+    echo "Usage: $0 config [count]" >&2
+    exit 1
+fi
+
+MOUNT=`mktemp -d`
+./execfs --config "$1" --fuse "${MOUNT}" || exit 1
+for FILE in "${MOUNT}"/*; do
+    ./bench "${FILE}" $2
+done
+fusermount -uz "${MOUNT}"
+rm -rf "${MOUNT}"
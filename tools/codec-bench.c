@@ -0,0 +1,135 @@
+/* Compare the codecs available for compressed cache storage on some sample
+ * output. The files named on the command line are concatenated, as a cached
+ * output would be, and each codec reports its compression ratio, how fast it
+ * compresses and how fast the result can be read back both sequentially and
+ * in random 4KB pieces, as the kernel would.
+ */
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../compress.h"
+
+#define READ_SIZE 4096
+#define SEQUENTIAL_SIZE (128 * 1024)
+#define ROUNDS 20
+#define RANDOM_READS 100000
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Append the contents of path to *data. Returns 0 on success. */
+static int slurp(const char *path, char **data, size_t *size) {
+    int fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        return -1;
+    }
+    size_t cap = *size + 65536;
+    while (1) {
+        char *tmp = realloc(*data, cap);
+        if (tmp == NULL) {
+            close(fd);
+            return -1;
+        }
+        *data = tmp;
+        ssize_t sz = read(fd, *data + *size, cap - *size);
+        if (sz <= 0) {
+            close(fd);
+            return sz;
+        }
+        *size += sz;
+        if (*size == cap) {
+            cap *= 2;
+        }
+    }
+}
+
+static void bench(codec_t codec, const char *data, size_t size) {
+    static char buf[SEQUENTIAL_SIZE];
+    compressed_t *c = NULL;
+    int i;
+
+    double start = now();
+    for (i = 0; i < ROUNDS; ++i) {
+        compressed_free(c);
+        c = compress_buffer(codec, data, size);
+        if (c == NULL) {
+            printf("%-5s failed to compress\n", codec_name(codec));
+            return;
+        }
+    }
+    double compress = (now() - start) / ROUNDS;
+
+    start = now();
+    for (i = 0; i < ROUNDS; ++i) {
+        size_t off = 0;
+        ssize_t sz;
+        while ((sz = compressed_read(c, buf, sizeof(buf), off)) > 0) {
+            if (memcmp(buf, data + off, sz)) {
+                printf("%-5s corrupted output at %zu\n", codec_name(codec),
+                    off);
+                compressed_free(c);
+                return;
+            }
+            off += sz;
+        }
+    }
+    double sequential = (now() - start) / ROUNDS;
+
+    srand(1);
+    start = now();
+    for (i = 0; i < RANDOM_READS; ++i) {
+        off_t off = size > READ_SIZE ? rand() % (size - READ_SIZE) : 0;
+        compressed_read(c, buf, READ_SIZE, off);
+    }
+    double random = (now() - start) / RANDOM_READS;
+
+    printf("%-5s ratio %5.2f  compress %7.1f MB/s  read %7.1f MB/s  "
+        "4KB read %6.2fus\n", codec_name(codec),
+        (double)size / compressed_footprint(c), size / compress / 1e6,
+        size / sequential / 1e6, random * 1e6);
+    compressed_free(c);
+}
+
+int main(int argc, char **argv) {
+    if (argc < 2) {
+        fprintf(stderr, "Usage: %s file...\n", argv[0]);
+        return -1;
+    }
+    char *data = NULL;
+    size_t size = 0;
+    int i;
+    for (i = 1; i < argc; ++i) {
+        if (slurp(argv[i], &data, &size) != 0) {
+            fprintf(stderr, "Failed to read %s\n", argv[i]);
+            return -1;
+        }
+    }
+    printf("%zu bytes of sample output in %d byte chunks\n", size,
+        COMPRESS_CHUNK_SIZE);
+
+    const char *names[] = {"lz4", "zstd"};
+    int benched = 0;
+    for (i = 0; i < sizeof(names) / sizeof(names[0]); ++i) {
+        codec_t codec;
+        if (codec_parse(names[i], &codec) == 0) {
+            bench(codec, data, size);
+            benched = 1;
+        } else {
+            printf("%-5s not built in\n", names[i]);
+        }
+    }
+    free(data);
+    if (!benched) {
+        fprintf(stderr, "Build with LZ4=1 and/or ZSTD=1 to compare codecs\n");
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,279 @@
+/* This program reads binary logs written by execfs --binlog (see binlog.h)
+ * and prints their records as text, one per line, or with -s a summary of the
+ * latencies of each operation on each entry. It exits with 0 on success and 1
+ * if a log couldn't be read.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "../binlog.h"
+
+static const char *op_names[BINLOG_OPS] = {
+    [BINLOG_START] = "start",
+    [BINLOG_NAME] = "name",
+    [BINLOG_GETATTR] = "getattr",
+    [BINLOG_FGETATTR] = "fgetattr",
+    [BINLOG_OPEN] = "open",
+    [BINLOG_READ] = "read",
+    [BINLOG_READ_BUF] = "read_buf",
+    [BINLOG_WRITE] = "write",
+    [BINLOG_POLL] = "poll",
+    [BINLOG_FLUSH] = "flush",
+    [BINLOG_RELEASE] = "release",
+    [BINLOG_READDIR] = "readdir",
+    [BINLOG_GETXATTR] = "getxattr",
+    [BINLOG_LISTXATTR] = "listxattr",
+};
+
+/* Latencies of one operation on one entry, or on all of them if path is
+ * NULL.
+ */
+typedef struct {
+    char *path;
+    int op;
+    unsigned long long errors;
+    uint64_t *latencies;
+    size_t latencies_sz, latencies_cap;
+} group_t;
+
+static group_t *groups = NULL;
+static size_t groups_sz = 0;
+
+/* Paths of the entries of the current run, by id. */
+static char **names = NULL;
+static size_t names_sz = 0;
+
+static void forget_names(void) {
+    size_t i;
+    for (i = 0; i < names_sz; ++i) {
+        free(names[i]);
+    }
+    free(names);
+    names = NULL;
+    names_sz = 0;
+}
+
+static const char *name_of(uint32_t id) {
+    if (id == 0) {
+        return "/";
+    }
+    return id < names_sz && names[id] != NULL ? names[id] : "?";
+}
+
+static const char *op_name(uint16_t op) {
+    return op < BINLOG_OPS ? op_names[op] : "?";
+}
+
+static int add_latency(const char *path, int op, const binlog_record_t *r) {
+    group_t *g = NULL;
+    size_t i;
+    for (i = 0; i < groups_sz; ++i) {
+        if (groups[i].op == op && (path == NULL ? groups[i].path == NULL :
+                groups[i].path != NULL && !strcmp(groups[i].path, path))) {
+            g = &groups[i];
+            break;
+        }
+    }
+    if (g == NULL) {
+        group_t *tmp = realloc(groups, sizeof(group_t) * (groups_sz + 1));
+        if (tmp == NULL) {
+            return -1;
+        }
+        groups = tmp;
+        g = &groups[groups_sz];
+        memset(g, 0, sizeof(*g));
+        g->op = op;
+        if (path != NULL && (g->path = strdup(path)) == NULL) {
+            return -1;
+        }
+        groups_sz++;
+    }
+    if (g->latencies_sz == g->latencies_cap) {
+        size_t cap = g->latencies_cap == 0 ? 64 : g->latencies_cap * 2;
+        uint64_t *tmp = realloc(g->latencies, sizeof(uint64_t) * cap);
+        if (tmp == NULL) {
+            return -1;
+        }
+        g->latencies = tmp;
+        g->latencies_cap = cap;
+    }
+    g->latencies[g->latencies_sz++] = r->latency_ns;
+    if (r->error != 0) {
+        g->errors++;
+    }
+    return 0;
+}
+
+/* Read a name record's path and remember it under its id. */
+static int read_name(FILE *f, const binlog_record_t *r) {
+    size_t len = r->size;
+    size_t chunks = (len + sizeof(*r) - 1) / sizeof(*r);
+    char *path = malloc(chunks * sizeof(*r) + 1);
+    if (path == NULL || fread(path, sizeof(*r), chunks, f) != chunks) {
+        free(path);
+        return -1;
+    }
+    path[len] = '\0';
+    if (r->entry >= names_sz) {
+        char **tmp = realloc(names, sizeof(char*) * (r->entry + 1));
+        if (tmp == NULL) {
+            free(path);
+            return -1;
+        }
+        memset(tmp + names_sz, 0, sizeof(char*) * (r->entry + 1 - names_sz));
+        names = tmp;
+        names_sz = r->entry + 1;
+    }
+    free(names[r->entry]);
+    names[r->entry] = path;
+    return 0;
+}
+
+static int dump(const char *filename, FILE *f, int summarise) {
+    binlog_record_t r;
+    int first = 1;
+    size_t got;
+    while ((got = fread(&r, 1, sizeof(r), f)) == sizeof(r)) {
+        if (first && (r.op != BINLOG_START || r.handle != BINLOG_MAGIC)) {
+            fprintf(stderr, "%s is not an execfs binary log\n", filename);
+            return -1;
+        }
+        first = 0;
+        if (r.op == BINLOG_START) {
+            if (r.handle != BINLOG_MAGIC || r.size != BINLOG_VERSION) {
+                fprintf(stderr, "%s has a log of an unknown version\n",
+                    filename);
+                return -1;
+            }
+            forget_names();
+            if (!summarise) {
+                printf("%llu.%09llu start\n",
+                    (unsigned long long)(r.time_ns / 1000000000),
+                    (unsigned long long)(r.time_ns % 1000000000));
+            }
+            continue;
+        } else if (r.op == BINLOG_NAME) {
+            if (read_name(f, &r) != 0) {
+                fprintf(stderr, "%s is truncated\n", filename);
+                return -1;
+            }
+            continue;
+        }
+
+        const char *path = name_of(r.entry);
+        if (summarise) {
+            if (add_latency(path, r.op, &r) != 0 ||
+                    add_latency(NULL, r.op, &r) != 0) {
+                fprintf(stderr, "Out of memory\n");
+                return -1;
+            }
+        } else {
+            printf("%llu.%09llu %s %s handle=%llu size=%llu "
+                "latency_us=%.3f errno=%d\n",
+                (unsigned long long)(r.time_ns / 1000000000),
+                (unsigned long long)(r.time_ns % 1000000000), op_name(r.op),
+                path, (unsigned long long)r.handle,
+                (unsigned long long)r.size, r.latency_ns / 1000.0,
+                (int)r.error);
+        }
+    }
+    if (ferror(f)) {
+        fprintf(stderr, "Failed to read %s\n", filename);
+        return -1;
+    } else if (first) {
+        fprintf(stderr, "%s is empty\n", filename);
+        return -1;
+    } else if (got != 0) {
+        /* execfs was stopped part way through writing a record. */
+        fprintf(stderr, "Ignoring a partial record at the end of %s\n",
+            filename);
+    }
+    return 0;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/* All operations come first, then each entry, in order of path. */
+static int compare_groups(const void *a, const void *b) {
+    const group_t *x = a, *y = b;
+    if ((x->path == NULL) != (y->path == NULL)) {
+        return x->path == NULL ? -1 : 1;
+    } else if (x->path != NULL && strcmp(x->path, y->path) != 0) {
+        return strcmp(x->path, y->path);
+    }
+    return x->op - y->op;
+}
+
+/* Latency at the given percentile of the sorted latencies of g. */
+static double percentile(const group_t *g, int p) {
+    size_t rank = (g->latencies_sz * p + 99) / 100;
+    return g->latencies[rank == 0 ? 0 : rank - 1] / 1000.0;
+}
+
+static void summarise(void) {
+    qsort(groups, groups_sz, sizeof(group_t), compare_groups);
+    printf("%-24s %-10s %10s %8s %10s %10s %10s %10s\n", "entry", "op",
+        "calls", "errors", "mean_us", "p50_us", "p99_us", "max_us");
+    size_t i;
+    for (i = 0; i < groups_sz; ++i) {
+        group_t *g = &groups[i];
+        qsort(g->latencies, g->latencies_sz, sizeof(uint64_t),
+            compare_latencies);
+        double total = 0;
+        size_t j;
+        for (j = 0; j < g->latencies_sz; ++j) {
+            total += g->latencies[j];
+        }
+        printf("%-24s %-10s %10zu %8llu %10.3f %10.3f %10.3f %10.3f\n",
+            g->path == NULL ? "(all)" : g->path, op_name(g->op),
+            g->latencies_sz, g->errors, total / g->latencies_sz / 1000.0,
+            percentile(g, 50), percentile(g, 99),
+            g->latencies[g->latencies_sz - 1] / 1000.0);
+    }
+}
+
+int main(int argc, char **argv) {
+    int summary = 0;
+    int c;
+    while ((c = getopt(argc, argv, "s")) != -1) {
+        if (c == 's') {
+            summary = 1;
+        } else {
+            optind = argc + 1;
+            break;
+        }
+    }
+    if (optind >= argc) {
+        fprintf(stderr, "Usage: %s [-s] log...\n"
+                        "Print the records of execfs binary logs as text.\n"
+                        " -s    Summarise the latency of each operation on each\n"
+                        "       entry instead.\n",
+            argv[0]);
+        return 1;
+    }
+
+    int i;
+    for (i = optind; i < argc; ++i) {
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            fprintf(stderr, "Failed to open %s\n", argv[i]);
+            return 1;
+        }
+        int err = dump(argv[i], f, summary);
+        fclose(f);
+        forget_names();
+        if (err != 0) {
+            return 1;
+        }
+    }
+    if (summary) {
+        summarise();
+    }
+    return 0;
+}
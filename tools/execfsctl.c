@@ -0,0 +1,107 @@
+/* This program sends one command to the control socket of a running execfs
+ * (see control.h) and prints the reply. It exits with 0 if the command
+ * succeeded, 1 if execfs reported an error and 2 if it couldn't be reached.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define BUFFER_SIZE 4096
+
+static int send_all(int fd, const char *buf, size_t len) {
+    while (len > 0) {
+        ssize_t sent = write(fd, buf, len);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent <= 0) {
+            return -1;
+        }
+        buf += sent;
+        len -= sent;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    if (argc < 3) {
+        fprintf(stderr, "Usage: %s socket command [argument...]\n"
+                        "Commands:\n"
+                        " stats              Show statistics.\n"
+                        " flush [path...]    Drop cached output of entries, or of all.\n"
+                        " refresh path...    Regenerate cached output of entries.\n"
+                        " stderr path        Show recent stderr of an entry's command.\n"
+                        " log on|off         Resume or pause logging.\n"
+                        " set name value     Change backoff, cache-size,\n"
+                        "                    cache-max-object, prefetch,\n"
+                        "                    prefetch-workers or schedule-workers.\n"
+                        " reload             Read the configuration files again.\n",
+            argv[0]);
+        return 2;
+    }
+
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(argv[1]) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "Socket path %s is too long\n", argv[1]);
+        return 2;
+    }
+    strcpy(addr.sun_path, argv[1]);
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "Failed to connect to %s: %s\n", argv[1],
+            strerror(errno));
+        return 2;
+    }
+
+    int i;
+    for (i = 2; i < argc; ++i) {
+        if (send_all(fd, argv[i], strlen(argv[i])) != 0 ||
+                send_all(fd, i + 1 < argc ? " " : "\n", 1) != 0) {
+            fprintf(stderr, "Failed to send command\n");
+            return 2;
+        }
+    }
+    (void)shutdown(fd, SHUT_WR);
+
+    /* The first line is the status, the rest is output. */
+    char buf[BUFFER_SIZE];
+    char status[BUFFER_SIZE];
+    size_t status_sz = 0;
+    int in_status = 1;
+    ssize_t len;
+    while ((len = read(fd, buf, sizeof(buf))) != 0) {
+        if (len < 0 && errno == EINTR) {
+            continue;
+        } else if (len < 0) {
+            fprintf(stderr, "Failed to read reply\n");
+            return 2;
+        }
+        char *p = buf;
+        if (in_status) {
+            char *nl = memchr(buf, '\n', len);
+            size_t n = nl == NULL ? (size_t)len : (size_t)(nl - buf + 1);
+            if (status_sz + n < sizeof(status)) {
+                memcpy(status + status_sz, buf, n);
+                status_sz += n;
+            }
+            if (nl != NULL) {
+                in_status = 0;
+            }
+            p += n;
+            len -= n;
+        }
+        fwrite(p, 1, len, stdout);
+    }
+    close(fd);
+    status[status_sz] = '\0';
+
+    if (strcmp(status, "ok\n") != 0) {
+        fprintf(stderr, "%s", status_sz == 0 ? "No reply\n" : status);
+        return 1;
+    }
+    return 0;
+}
@@ -1,11 +1,18 @@
 /* This program opens a file and reads and writes from it. It is designed to be
  * used on an execfs-mounted file and does some things that don't make sense on
- * a normal file.
+ * a normal file. Each line of stdin is written to the file as a request and a
+ * single read collects the response. This relies on the entry being marked
+ * interactive so that execfs frames each read as one complete response.
  */
 
 #include <assert.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define BUFFER_SIZE 4096
 
 int main(int argc, char **argv) {
     if (argc != 2) {
@@ -13,35 +20,36 @@ int main(int argc, char **argv) {
         return -1;
     }
 
-    FILE *f = fopen(argv[1], "w+");
-    if (f == NULL) {
+    int fd = open(argv[1], O_RDWR);
+    if (fd == -1) {
         fprintf(stderr, "Failed to open %s\n", argv[1]);
         return -1;
     }
 
-    int c;
-    while ((c = getchar()) != EOF) {
-        fputc(c, f);
-        /* Assume when we hit a newline that we will have a line to read. */
-        if (c == '\n') {
-            /* We need to seek the file to make sure we don't skip over
-             * output.
-             */
-            if (fseek(f, 0, SEEK_SET) != 0) {
-                fprintf(stderr, "fseek failed\n");
-                return -1;
-            }
-            while ((c = fgetc(f)) != EOF && c != '\n') {
-                putchar(c);
-            }
-            /* Ignore EOF on the stdout of the command because it may just mean
-             * there is no output currently ready, not that the command has
-             * finished emitting.
-             */
-            if (c != EOF) {
-                putchar(c);
-            }
+    char *line = NULL;
+    size_t line_sz = 0;
+    ssize_t len;
+    char response[BUFFER_SIZE];
+    while ((len = getline(&line, &line_sz, stdin)) != -1) {
+        if (write(fd, line, len) != len) {
+            fprintf(stderr, "write failed\n");
+            return -1;
+        }
+        /* No fseek/newline guesswork required; execfs blocks this read until
+         * the command's response is complete.
+         */
+        ssize_t sz = read(fd, response, sizeof(response));
+        if (sz == -1) {
+            fprintf(stderr, "read failed\n");
+            return -1;
+        } else if (sz == 0) {
+            /* The command exited. */
+            break;
         }
+        fwrite(response, 1, sz, stdout);
+        fflush(stdout);
     }
+    free(line);
+    close(fd);
     return 0;
 }
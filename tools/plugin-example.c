@@ -0,0 +1,59 @@
+/* An example execfs plugin that behaves like `echo ARGS`. Build it with
+ * `make plugin-example.so` and use it with an entry such as
+ *  hello|444,plugin|./plugin-example.so:example_plugin hello world
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include "../execfs_plugin.h"
+
+typedef struct {
+    char *data;
+    size_t size;
+} output_t;
+
+static int example_open(const char *args, const char *path, int flags, void **ctx) {
+    output_t *o = malloc(sizeof(*o));
+    if (o == NULL) {
+        return -ENOMEM;
+    }
+    o->size = strlen(args) + 1;
+    o->data = malloc(o->size);
+    if (o->data == NULL) {
+        free(o);
+        return -ENOMEM;
+    }
+    memcpy(o->data, args, o->size - 1);
+    o->data[o->size - 1] = '\n';
+    *ctx = o;
+    return 0;
+}
+
+static ssize_t example_read(void *ctx, char *buf, size_t size, off_t offset) {
+    output_t *o = ctx;
+    if (offset >= o->size) {
+        return 0;
+    }
+    if (size > o->size - offset) {
+        size = o->size - offset;
+    }
+    memcpy(buf, o->data + offset, size);
+    return size;
+}
+
+static void example_release(void *ctx) {
+    output_t *o = ctx;
+    free(o->data);
+    free(o);
+}
+
+execfs_plugin_t example_plugin = {
+    .abi = EXECFS_PLUGIN_ABI,
+    .open = example_open,
+    .read = example_read,
+    .write = NULL,
+    .release = example_release,
+};
@@ -0,0 +1,347 @@
+/* Request tracing. */
+
+#define _GNU_SOURCE /* syscall() */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "trace.h"
+
+/* Events a thread collects before writing them out. */
+#define BUFFER_EVENTS 1024
+
+/* Kinds of event besides the phases. A request's beginning is recorded
+ * separately so that it comes before its first phase, which starts at the
+ * same time, in the trace.
+ */
+#define EVENT_BEGIN TRACE_SPANS
+#define EVENT_END (TRACE_SPANS + 1)
+#define EVENT_FIRST_BYTE (TRACE_SPANS + 2)
+
+struct trace_request {
+    unsigned long long id;
+    uint64_t start_ns;
+    uint64_t mark_ns; /* End of the last phase. */
+    int running;      /* Its command started but its exec isn't recorded. */
+    int output;       /* Whether the first byte has been read. */
+};
+
+typedef struct {
+    unsigned long long id;
+    int kind;
+    uint64_t start_ns;
+    uint64_t dur_ns;
+    char *path; /* Owned copy, for the ends of requests, or NULL. */
+} event_t;
+
+/* A thread's events. Buffers outlive their threads and are handed on to new
+ * ones, as FUSE starts and stops worker threads as load changes.
+ */
+typedef struct {
+    pid_t tid;
+    trace_request_t *current;
+    size_t used;
+    event_t events[BUFFER_EVENTS];
+} buffer_t;
+
+static const char *names[] = {
+    [TRACE_LOOKUP] = "lookup",
+    [TRACE_PERMISSION] = "permission",
+    [TRACE_CACHE] = "cache",
+    [TRACE_SPAWN] = "spawn",
+    [TRACE_EXEC] = "exec",
+    [EVENT_BEGIN] = "open",
+    [EVENT_END] = "open",
+    [EVENT_FIRST_BYTE] = "first byte",
+};
+
+static int enabled = 0;
+static unsigned int sample = TRACE_SAMPLE;
+static unsigned long long opens = 0;
+
+static pthread_key_t buffer_key;
+static pthread_once_t buffer_once = PTHREAD_ONCE_INIT;
+
+/* Protects everything below. */
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static FILE *file = NULL;
+static buffer_t **buffers = NULL;
+static size_t buffers_sz = 0;
+/* Buffers whose threads have exited. */
+static buffer_t **idle = NULL;
+static size_t idle_sz = 0;
+static trace_stats_t stats;
+
+static uint64_t now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Write s as a JSON string. */
+static void write_string(FILE *f, const char *s) {
+    fputc('"', f);
+    for (; *s != '\0'; ++s) {
+        if (*s == '"' || *s == '\\') {
+            fprintf(f, "\\%c", *s);
+        } else if ((unsigned char)*s < 0x20) {
+            fprintf(f, "\\u%04x", (unsigned char)*s);
+        } else {
+            fputc(*s, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/* Write one event as a nestable async event, which trace viewers show on a
+ * track of its own for each request id. Called with lock held.
+ */
+static void write_event(FILE *f, pid_t pid, pid_t tid, const event_t *ev,
+        char ph, uint64_t ns) {
+    fprintf(f, "{\"name\":\"%s\",\"cat\":\"execfs\",\"ph\":\"%c\","
+        "\"id\":%llu,\"pid\":%d,\"tid\":%d,\"ts\":%llu.%03llu",
+        names[ev->kind], ph, ev->id, (int)pid, (int)tid,
+        (unsigned long long)(ns / 1000), (unsigned long long)(ns % 1000));
+    if (ev->path != NULL) {
+        fprintf(f, ",\"args\":{\"path\":");
+        write_string(f, ev->path);
+        fputc('}', f);
+    }
+    fprintf(f, "},\n");
+}
+
+/* Write out and empty b. Called with lock held. */
+static void flush(buffer_t *b) {
+    size_t i;
+    if (file != NULL) {
+        pid_t pid = getpid();
+        for (i = 0; i < b->used; ++i) {
+            const event_t *ev = &b->events[i];
+            if (ev->kind == EVENT_BEGIN) {
+                write_event(file, pid, b->tid, ev, 'b', ev->start_ns);
+            } else if (ev->kind == EVENT_END) {
+                write_event(file, pid, b->tid, ev, 'e', ev->start_ns);
+            } else if (ev->kind == EVENT_FIRST_BYTE) {
+                write_event(file, pid, b->tid, ev, 'n', ev->start_ns);
+            } else {
+                write_event(file, pid, b->tid, ev, 'b', ev->start_ns);
+                write_event(file, pid, b->tid, ev, 'e',
+                    ev->start_ns + ev->dur_ns);
+            }
+        }
+        stats.events += b->used;
+    }
+    for (i = 0; i < b->used; ++i) {
+        free(b->events[i].path);
+    }
+    b->used = 0;
+}
+
+static void release_buffer(void *arg) {
+    buffer_t *b = arg;
+    pthread_mutex_lock(&lock);
+    flush(b);
+    b->current = NULL;
+    /* There is room, as the buffer came from buffers. */
+    idle[idle_sz++] = b;
+    pthread_mutex_unlock(&lock);
+}
+
+static void create_key(void) {
+    if (pthread_key_create(&buffer_key, release_buffer) != 0) {
+        LOG("Failed to create trace buffer key");
+    }
+}
+
+/* Get this thread's buffer, claiming one if necessary. */
+static buffer_t *thread_buffer(void) {
+    (void)pthread_once(&buffer_once, create_key);
+    buffer_t *b = pthread_getspecific(buffer_key);
+    if (b != NULL) {
+        return b;
+    }
+    pthread_mutex_lock(&lock);
+    if (idle_sz > 0) {
+        b = idle[--idle_sz];
+    } else {
+        buffer_t **tmp = realloc(buffers,
+            sizeof(buffer_t*) * (buffers_sz + 1));
+        buffer_t **tmp_idle = tmp == NULL ? NULL :
+            realloc(idle, sizeof(buffer_t*) * (buffers_sz + 1));
+        if (tmp != NULL) {
+            buffers = tmp;
+        }
+        if (tmp_idle != NULL) {
+            idle = tmp_idle;
+        }
+        b = tmp_idle == NULL ? NULL : calloc(1, sizeof(*b));
+        if (b != NULL) {
+            buffers[buffers_sz++] = b;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+    if (b == NULL) {
+        return NULL;
+    }
+    b->tid = syscall(SYS_gettid);
+    if (pthread_setspecific(buffer_key, b) != 0) {
+        release_buffer(b);
+        return NULL;
+    }
+    return b;
+}
+
+static void record(trace_request_t *r, int kind, uint64_t start_ns,
+        uint64_t end_ns, const char *path) {
+    buffer_t *b = thread_buffer();
+    if (b == NULL) {
+        return;
+    }
+    event_t *ev = &b->events[b->used++];
+    ev->id = r->id;
+    ev->kind = kind;
+    ev->start_ns = start_ns;
+    ev->dur_ns = end_ns - start_ns;
+    /* The event outlives the request, and path may belong to an entry that
+     * is freed before the buffer is flushed. Without memory the event is
+     * still recorded, just without its path.
+     */
+    ev->path = path == NULL ? NULL : strdup(path);
+    if (b->used == BUFFER_EVENTS) {
+        pthread_mutex_lock(&lock);
+        flush(b);
+        pthread_mutex_unlock(&lock);
+    }
+}
+
+int trace_enable(const char *path) {
+    assert(path != NULL);
+    FILE *f = fopen(path, "w");
+    if (f == NULL) {
+        return -1;
+    }
+    fprintf(f, "[\n");
+    pthread_mutex_lock(&lock);
+    if (file != NULL) {
+        fclose(file);
+    }
+    file = f;
+    pthread_mutex_unlock(&lock);
+    enabled = 1;
+    return 0;
+}
+
+void trace_set_sample(unsigned int n) {
+    assert(n >= 1);
+    sample = n;
+}
+
+void trace_stop(void) {
+    if (!enabled) {
+        return;
+    }
+    enabled = 0;
+    pthread_mutex_lock(&lock);
+    /* FUSE's threads have finished by now, so nothing is still recording. */
+    size_t i;
+    for (i = 0; i < buffers_sz; ++i) {
+        flush(buffers[i]);
+    }
+    if (file != NULL) {
+        fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,"
+            "\"args\":{\"name\":\"execfs\"}}\n]\n", (int)getpid());
+        fclose(file);
+        file = NULL;
+    }
+    pthread_mutex_unlock(&lock);
+}
+
+trace_request_t *trace_start(void) {
+    if (!enabled || __sync_fetch_and_add(&opens, 1) % sample != 0) {
+        return NULL;
+    }
+    buffer_t *b = thread_buffer();
+    trace_request_t *r = b == NULL ? NULL : malloc(sizeof(*r));
+    if (r == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&lock);
+    r->id = ++stats.requests;
+    pthread_mutex_unlock(&lock);
+    r->start_ns = r->mark_ns = now_ns();
+    r->running = 0;
+    r->output = 0;
+    b->current = r;
+    record(r, EVENT_BEGIN, r->start_ns, r->start_ns, NULL);
+    return r;
+}
+
+trace_request_t *trace_current(void) {
+    if (!enabled) {
+        return NULL;
+    }
+    (void)pthread_once(&buffer_once, create_key);
+    buffer_t *b = pthread_getspecific(buffer_key);
+    return b == NULL ? NULL : b->current;
+}
+
+void trace_detach(trace_request_t *r) {
+    buffer_t *b = r == NULL ? NULL : pthread_getspecific(buffer_key);
+    if (b != NULL && b->current == r) {
+        b->current = NULL;
+    }
+}
+
+void trace_phase(trace_request_t *r, trace_span_t span) {
+    if (r == NULL) {
+        return;
+    }
+    assert(span < TRACE_SPANS);
+    uint64_t ns = now_ns();
+    record(r, span, r->mark_ns, ns, NULL);
+    r->mark_ns = ns;
+    r->running = span == TRACE_SPAWN;
+}
+
+void trace_skip(trace_request_t *r) {
+    if (r != NULL) {
+        r->mark_ns = now_ns();
+    }
+}
+
+void trace_output(trace_request_t *r) {
+    /* Concurrent reads of one file only record this once. */
+    if (r == NULL || !__sync_bool_compare_and_swap(&r->output, 0, 1)) {
+        return;
+    }
+    if (r->running) {
+        trace_phase(r, TRACE_EXEC);
+    }
+    uint64_t ns = now_ns();
+    record(r, EVENT_FIRST_BYTE, ns, ns, NULL);
+}
+
+void trace_finish(trace_request_t *r, const char *path) {
+    if (r == NULL) {
+        return;
+    }
+    trace_detach(r);
+    uint64_t ns = now_ns();
+    record(r, EVENT_END, ns, ns, path);
+    free(r);
+}
+
+void trace_get_stats(trace_stats_t *out) {
+    assert(out != NULL);
+    pthread_mutex_lock(&lock);
+    *out = stats;
+    pthread_mutex_unlock(&lock);
+}
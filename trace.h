@@ -0,0 +1,67 @@
+#ifndef _EXECFS_TRACE_H_
+#define _EXECFS_TRACE_H_
+
+/* Request tracing. With --trace, one open in every --trace-sample is followed
+ * from the moment it arrives until its file is released, and the time spent
+ * in each phase of serving it is written to the trace file as Chrome
+ * trace-event JSON, which chrome://tracing and Perfetto load. Each traced
+ * open appears as its own track. Events are collected in buffers belonging
+ * to the threads that record them and written out whenever a buffer fills,
+ * so tracing takes no locks in the common case and its memory is bounded.
+ */
+
+#include <stddef.h>
+
+/* Default number of opens per traced open. */
+#define TRACE_SAMPLE 100
+
+/* Phases of serving an open. Each runs from the end of the previous one. */
+typedef enum {
+    TRACE_LOOKUP,     /* Finding the entry. */
+    TRACE_PERMISSION, /* Checking the caller may open it. */
+    TRACE_CACHE,      /* Looking up cached output, waiting for any filler. */
+    TRACE_SPAWN,      /* Starting the command, or handing over to standby. */
+    TRACE_EXEC,       /* Running the command until its output arrives. */
+    TRACE_SPANS,
+} trace_span_t;
+
+/* One traced open. */
+typedef struct trace_request trace_request_t;
+
+/* Start writing traces to path, which is opened straight away. Returns 0 on
+ * success.
+ */
+int trace_enable(const char *path);
+/* Trace one open in every sample, which must be at least 1. */
+void trace_set_sample(unsigned int sample);
+/* Write out what remains and close the trace file. */
+void trace_stop(void);
+
+/* Begin an open, which becomes the current request of this thread until
+ * trace_detach(). Returns NULL if the open isn't sampled.
+ */
+trace_request_t *trace_start(void);
+trace_request_t *trace_current(void);
+void trace_detach(trace_request_t *r);
+
+/* Record that the phase since the last one has finished. r may be NULL. */
+void trace_phase(trace_request_t *r, trace_span_t span);
+/* Leave the time since the last phase out of the next one. */
+void trace_skip(trace_request_t *r);
+/* Record that the first byte of output has been read. This ends the exec
+ * phase of a command that was started but hasn't finished.
+ */
+void trace_output(trace_request_t *r);
+/* Complete r when its file is released, or when the open fails. path is the
+ * entry's path or NULL if there was none. Frees r.
+ */
+void trace_finish(trace_request_t *r, const char *path);
+
+typedef struct {
+    unsigned long long requests; /* Traced opens. */
+    unsigned long long events;   /* Written to the trace file. */
+} trace_stats_t;
+
+void trace_get_stats(trace_stats_t *out);
+
+#endif
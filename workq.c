@@ -0,0 +1,192 @@
+/* Pool of worker threads. */
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "workq.h"
+
+typedef struct job {
+    workq_fn_t fn;
+    void *arg;
+    struct job *next;
+} job_t;
+
+struct workq {
+    pthread_mutex_t lock;
+    pthread_cond_t work;  /* Signalled when a job is queued or on shutdown. */
+    pthread_cond_t idle;  /* Signalled when the last outstanding job ends. */
+    job_t *head, *tail;
+    size_t pending;       /* Jobs waiting for a worker. */
+    size_t max_pending;
+    size_t outstanding;   /* Jobs waiting or running. */
+    int running;          /* Jobs running. */
+    int limit;            /* Most jobs to run at once. */
+    int stopping;
+    workq_fn_t discard;
+    pthread_t *threads;
+    int threads_sz;
+};
+
+static void *worker_main(void *arg) {
+    workq_t *q = arg;
+    pthread_mutex_lock(&q->lock);
+    while (1) {
+        while ((q->head == NULL || q->running >= q->limit) &&
+                !q->stopping) {
+            pthread_cond_wait(&q->work, &q->lock);
+        }
+        if (q->stopping) {
+            break;
+        }
+        job_t *j = q->head;
+        q->head = j->next;
+        if (q->head == NULL) {
+            q->tail = NULL;
+        }
+        q->pending--;
+        q->running++;
+        pthread_mutex_unlock(&q->lock);
+
+        j->fn(j->arg);
+        free(j);
+
+        pthread_mutex_lock(&q->lock);
+        q->running--;
+        if (--q->outstanding == 0) {
+            pthread_cond_broadcast(&q->idle);
+        }
+    }
+    pthread_mutex_unlock(&q->lock);
+    return NULL;
+}
+
+workq_t *workq_create(int threads, size_t max_pending, workq_fn_t discard) {
+    assert(threads > 0);
+    workq_t *q = calloc(1, sizeof(*q));
+    if (q == NULL) {
+        return NULL;
+    }
+    q->threads = calloc(threads, sizeof(pthread_t));
+    if (q->threads == NULL) {
+        free(q);
+        return NULL;
+    }
+    pthread_mutex_init(&q->lock, NULL);
+    pthread_cond_init(&q->work, NULL);
+    pthread_cond_init(&q->idle, NULL);
+    q->max_pending = max_pending;
+    q->discard = discard;
+    q->limit = threads;
+
+    for (q->threads_sz = 0; q->threads_sz < threads; ++q->threads_sz) {
+        if (pthread_create(&q->threads[q->threads_sz], NULL, worker_main,
+                q) != 0) {
+            LOG("Failed to start worker thread");
+            workq_destroy(q);
+            return NULL;
+        }
+    }
+    return q;
+}
+
+int workq_submit(workq_t *q, workq_fn_t fn, void *arg) {
+    assert(q != NULL);
+    assert(fn != NULL);
+    job_t *j = malloc(sizeof(*j));
+    if (j == NULL) {
+        return -1;
+    }
+    j->fn = fn;
+    j->arg = arg;
+    j->next = NULL;
+
+    pthread_mutex_lock(&q->lock);
+    if (q->stopping ||
+            (q->max_pending != 0 && q->pending >= q->max_pending)) {
+        pthread_mutex_unlock(&q->lock);
+        free(j);
+        return -1;
+    }
+    if (q->tail != NULL) {
+        q->tail->next = j;
+    } else {
+        q->head = j;
+    }
+    q->tail = j;
+    q->pending++;
+    q->outstanding++;
+    pthread_cond_signal(&q->work);
+    pthread_mutex_unlock(&q->lock);
+    return 0;
+}
+
+int workq_set_threads(workq_t *q, int threads) {
+    assert(q != NULL);
+    assert(threads > 0);
+    pthread_mutex_lock(&q->lock);
+    if (threads > q->threads_sz) {
+        pthread_t *tmp = realloc(q->threads, sizeof(pthread_t) * threads);
+        if (tmp == NULL) {
+            pthread_mutex_unlock(&q->lock);
+            return -1;
+        }
+        q->threads = tmp;
+        while (q->threads_sz < threads) {
+            if (pthread_create(&q->threads[q->threads_sz], NULL, worker_main,
+                    q) != 0) {
+                LOG("Failed to start worker thread");
+                break;
+            }
+            q->threads_sz++;
+        }
+    }
+    /* Surplus threads stay, idle, until the pool is destroyed. */
+    q->limit = threads < q->threads_sz ? threads : q->threads_sz;
+    pthread_cond_broadcast(&q->work);
+    int result = q->limit == threads ? 0 : -1;
+    pthread_mutex_unlock(&q->lock);
+    return result;
+}
+
+void workq_wait(workq_t *q) {
+    assert(q != NULL);
+    pthread_mutex_lock(&q->lock);
+    while (q->outstanding > 0) {
+        pthread_cond_wait(&q->idle, &q->lock);
+    }
+    pthread_mutex_unlock(&q->lock);
+}
+
+void workq_destroy(workq_t *q) {
+    if (q == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&q->lock);
+    q->stopping = 1;
+    job_t *j = q->head;
+    q->head = q->tail = NULL;
+    pthread_cond_broadcast(&q->work);
+    pthread_mutex_unlock(&q->lock);
+
+    while (j != NULL) {
+        job_t *next = j->next;
+        if (q->discard != NULL) {
+            q->discard(j->arg);
+        }
+        free(j);
+        j = next;
+    }
+
+    int i;
+    for (i = 0; i < q->threads_sz; ++i) {
+        pthread_join(q->threads[i], NULL);
+    }
+    pthread_cond_destroy(&q->idle);
+    pthread_cond_destroy(&q->work);
+    pthread_mutex_destroy(&q->lock);
+    free(q->threads);
+    free(q);
+}
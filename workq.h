@@ -0,0 +1,36 @@
+#ifndef _EXECFS_WORKQ_H_
+#define _EXECFS_WORKQ_H_
+
+/* A pool of threads running queued jobs in the order they were submitted. */
+
+#include <stddef.h>
+
+typedef struct workq workq_t;
+
+typedef void (*workq_fn_t)(void *arg);
+
+/* Start a pool of threads workers. At most max_pending jobs may be waiting
+ * for a worker, or any number if max_pending is 0. Jobs that are never run
+ * because the pool is destroyed first have their arg passed to discard, if
+ * given. Returns NULL on failure.
+ */
+workq_t *workq_create(int threads, size_t max_pending, workq_fn_t discard);
+
+/* Queue fn(arg) to be run by a worker. Returns -1 without queueing it if the
+ * queue is full or out of memory.
+ */
+int workq_submit(workq_t *q, workq_fn_t fn, void *arg);
+
+/* Change how many jobs may run at once, starting more workers if needed.
+ * Jobs already running beyond a lowered limit are let finish. Returns 0 on
+ * success.
+ */
+int workq_set_threads(workq_t *q, int threads);
+
+/* Wait until every submitted job has finished. */
+void workq_wait(workq_t *q);
+
+/* Discard waiting jobs, let running ones finish and stop the workers. */
+void workq_destroy(workq_t *q);
+
+#endif
@@ -0,0 +1,128 @@
+/* Extended attributes describing entries. */
+
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cache.h"
+#include "entry.h"
+#include "reap.h"
+#include "xattr.h"
+
+/* Longest value, which is a number. */
+#define VALUE_SIZE 32
+
+typedef enum {
+    ATTR_CACHE_STATE,
+    ATTR_OUTPUT_HASH,
+    ATTR_LAST_RUN_NS,
+    ATTR_LAST_EXIT,
+    ATTR_HITS,
+    ATTR_MEAN_LATENCY_US,
+    ATTRS,
+} attr_t;
+
+static const char *names[ATTRS] = {
+    [ATTR_CACHE_STATE] = XATTR_PREFIX "cache_state",
+    [ATTR_OUTPUT_HASH] = XATTR_PREFIX "output_hash",
+    [ATTR_LAST_RUN_NS] = XATTR_PREFIX "last_run_ns",
+    [ATTR_LAST_EXIT] = XATTR_PREFIX "last_exit",
+    [ATTR_HITS] = XATTR_PREFIX "hits",
+    [ATTR_MEAN_LATENCY_US] = XATTR_PREFIX "mean_latency_us",
+};
+
+void xattr_opened(entry_t *e, unsigned long long ns) {
+    assert(e != NULL);
+    __sync_fetch_and_add(&e->open_ns, ns);
+    __sync_fetch_and_add(&e->opens, 1);
+}
+
+/* Render attribute a of e for the given caller into value. Returns its
+ * length, or -1 if it has no value.
+ */
+static int render(entry_t *e, uid_t uid, gid_t gid, pid_t pid, attr_t a,
+        char value[VALUE_SIZE]) {
+    if (a == ATTR_CACHE_STATE || a == ATTR_OUTPUT_HASH) {
+        if (e->cache_policy == CACHE_NONE) {
+            return a == ATTR_CACHE_STATE ?
+                snprintf(value, VALUE_SIZE, "uncached") : -1;
+        }
+        char *key = cache_key(e, uid, gid, pid);
+        cache_obj_t *o = key == NULL ? NULL : cache_peek(e, key);
+        free(key);
+        int len = -1;
+        if (a == ATTR_CACHE_STATE) {
+            len = snprintf(value, VALUE_SIZE, o == NULL ? "missing" : "cached");
+        } else if (o != NULL) {
+            len = snprintf(value, VALUE_SIZE, "%016" PRIx64, cache_digest(o));
+        }
+        cache_release(o);
+        return len;
+    } else if (a == ATTR_LAST_RUN_NS || a == ATTR_LAST_EXIT) {
+        reap_last_t last;
+        reap_get_last(e, &last);
+        if (a == ATTR_LAST_RUN_NS) {
+            return last.started_ns == 0 ? -1 :
+                snprintf(value, VALUE_SIZE, "%" PRIu64, last.started_ns);
+        }
+        return !last.exited ? -1 :
+            snprintf(value, VALUE_SIZE, "%d", last.status);
+    } else if (a == ATTR_HITS) {
+        return snprintf(value, VALUE_SIZE, "%llu", e->opens);
+    }
+
+    assert(a == ATTR_MEAN_LATENCY_US);
+    /* Read the total first, so a racing open can only make the mean look
+     * smaller.
+     */
+    unsigned long long ns = e->open_ns;
+    __sync_synchronize();
+    unsigned long long opens = e->opens;
+    return opens == 0 ? -1 :
+        snprintf(value, VALUE_SIZE, "%llu", ns / opens / 1000);
+}
+
+int xattr_list(entry_t *e, uid_t uid, gid_t gid, pid_t pid, char *buf,
+        size_t size) {
+    assert(e != NULL);
+    assert(buf != NULL || size == 0);
+    size_t len = 0;
+    attr_t a;
+    for (a = 0; a < ATTRS; ++a) {
+        char value[VALUE_SIZE];
+        if (render(e, uid, gid, pid, a, value) < 0) {
+            continue;
+        }
+        size_t n = strlen(names[a]) + 1;
+        if (size > 0 && len + n > size) {
+            return -ERANGE;
+        } else if (size > 0) {
+            memcpy(buf + len, names[a], n);
+        }
+        len += n;
+    }
+    return len;
+}
+
+int xattr_get(entry_t *e, uid_t uid, gid_t gid, pid_t pid, const char *name,
+        char *buf, size_t size) {
+    assert(e != NULL);
+    assert(name != NULL);
+    assert(buf != NULL || size == 0);
+    attr_t a;
+    for (a = 0; a < ATTRS && strcmp(name, names[a]); ++a) {
+    }
+    char value[VALUE_SIZE];
+    int len = a == ATTRS ? -1 : render(e, uid, gid, pid, a, value);
+    if (len < 0) {
+        return -ENODATA;
+    } else if (size > 0 && (size_t)len > size) {
+        return -ERANGE;
+    } else if (size > 0) {
+        memcpy(buf, value, len);
+    }
+    return len;
+}
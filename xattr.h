@@ -0,0 +1,46 @@
+#ifndef _EXECFS_XATTR_H_
+#define _EXECFS_XATTR_H_
+
+/* Extended attributes describing entries, so clients can check whether output
+ * changed without reading it again and operators can look at one file without
+ * going through the whole stats dump. They are read-only and each is only
+ * present once it has a value:
+ *  user.execfs.cache_state      "uncached" for entries without a cache
+ *                               policy, otherwise "cached" or "missing"
+ *                               depending on whether the caller's open would
+ *                               be served cached output.
+ *  user.execfs.output_hash      Hash of that cached output in hex, which only
+ *                               changes when the output does.
+ *  user.execfs.last_run_ns      When the command was last started, in
+ *                               nanoseconds since the epoch.
+ *  user.execfs.last_exit        Exit status of the last run to finish, or 128
+ *                               plus the signal that killed it.
+ *  user.execfs.hits             Successful opens of the entry.
+ *  user.execfs.mean_latency_us  Mean time those opens took, in microseconds.
+ */
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "entry.h"
+
+#define XATTR_PREFIX "user.execfs."
+
+/* Record a successful open of e that took ns nanoseconds. */
+void xattr_opened(entry_t *e, unsigned long long ns);
+
+/* List the names of e's attributes as seen by the given caller into buf,
+ * each terminated by a NUL. If size is 0 only the length is computed.
+ * Returns the length of the list, or a negative errno.
+ */
+int xattr_list(entry_t *e, uid_t uid, gid_t gid, pid_t pid, char *buf,
+        size_t size);
+
+/* Fetch the value of e's attribute name as seen by the given caller into buf.
+ * If size is 0 only the length is computed. Returns the length of the value,
+ * or a negative errno.
+ */
+int xattr_get(entry_t *e, uid_t uid, gid_t gid, pid_t pid, const char *name,
+        char *buf, size_t size);
+
+#endif